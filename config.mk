@@ -74,7 +74,7 @@ UPDATE_METHOD = afs
 # A list of the test programs you want compiled in from the user/progs
 # directory.
 #
-STUDENTTESTS = beady_test agility_drill cvar_test join_specific_test largetest multitest switzerland thr_exit_join
+STUDENTTESTS = beady_test agility_drill color_bench cvar_test join_specific_test largetest memory_stats_test mlfq_test multitest switzerland thr_exit_join weight_test
 
 ###########################################################################
 # Data files provided by course staff to build into the RAM disk
@@ -112,7 +112,8 @@ SYSCALL_OBJS = print.o set_status.o vanish.o deschedule.o exec.o fork.o \
                getchar.o get_cursor_pos.o get_ticks.o gettid.o halt.o \
 			   make_runnable.o misbehave.o new_pages.o readfile.o readline.o \
 			   remove_pages.o set_cursor_pos.o set_term_color.o sleep.o \
-			   swexn.o task_vanish.o wait.o yield.o memory_check.o
+			   swexn.o task_vanish.o wait.o yield.o memory_check.o \
+			   memory_stats.o set_priority.o set_weight.o
 
 ###########################################################################
 # Object files for your automatic stack handling
@@ -129,19 +130,20 @@ AUTOSTACK_OBJS = autostack.o
 #
 # Kernel object files you provide in from kern/
 #
-KERNEL_OBJS = kernel.o loader/loader.o list/list.o drivers/console/console.o \
+KERNEL_OBJS = kernel.o loader/loader.o loader/text_cache.o list/list.o list/rb_tree.o drivers/console/console.o \
 			  drivers/console/console_util.o drivers/timer/timer.o drivers/timer/timer_handler.o \
 			  interrupts/interrupt_handlers.o interrupts/idt_entry.o interrupts/fault_handlers.o \
 			  interrupts/fault_handlers_asm.o \
 			  drivers/keyboard/keyboard.o drivers/keyboard/keyboard_handler.o allocator/frame_allocator.o \
-			  sync/mutex.o sync/cond_var.o  sync/sem.o \
-			  vm/vm.o core/task.o core/thread.o core/fork.o asm/asm.o syscalls/syscall_handlers.o \
+			  sync/mutex.o sync/cond_var.o  sync/sem.o sync/spinlock.o \
+			  vm/vm.o vm/tlb.o vm/region.o vm/uaccess.o vm/uaccess_asm.o vm/kstack.o vm/zswap.o vm/merge.o vm/reaper.o core/task.o core/thread.o core/fork.o asm/asm.o syscalls/syscall_handlers.o \
 			  syscalls/thread_syscalls.o syscalls/thread_syscalls_asm.o syscalls/console_syscalls.o \
 			  syscalls/console_syscalls_asm.o syscalls/lifecycle_syscalls.o syscalls/lifecycle_syscalls_asm.o \
 			  common/assert.o common/malloc_wrappers.o core/context.o core/scheduler.o core/exec.o syscalls/misc_syscalls.o \
 			  syscalls/misc_syscalls_asm.o core/wait_vanish.o syscalls/memory_syscalls.o syscalls/memory_syscalls_asm.o \
 			  drivers/keyboard/keyboard_circular_buffer.o syscalls/system_check_syscalls.o \
-			  syscalls/system_check_syscalls_asm.o core/sleep.o	syscalls/syscall_util.o
+			  syscalls/system_check_syscalls_asm.o core/sleep.o	syscalls/syscall_util.o \
+			  core/cpu.o
 
 
 ###########################################################################
@@ -156,11 +158,12 @@ KERNEL_OBJS = kernel.o loader/loader.o list/list.o drivers/console/console.o \
 # A list of the programs in 410user/progs which are provided in source
 # form and NECESSARY FOR THE KERNEL TO RUN.
 #
-# The shell is a really good thing to keep here.  Don't delete idle
-# or init unless you are writing your own, and don't do that unless
-# you have a really good reason to do so.
+# The shell is a really good thing to keep here.  Don't delete init
+# unless you are writing your own, and don't do that unless you have a
+# really good reason to do so.  The kernel runs its own idle task, so
+# idle is not needed.
 #
-410REQPROGS = idle init shell
+410REQPROGS = init shell
 
 ###########################################################################
 # Mandatory programs whose source is provided by you
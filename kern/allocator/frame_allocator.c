@@ -7,155 +7,906 @@
 #include <allocator/frame_allocator.h>
 #include <common/malloc_wrappers.h>
 #include <common_kern.h>
-#include <limits.h>
+#include <asm/asm.h>
 #include <simics.h>
-#include <sync/mutex.h>
+#include <sync/spinlock.h>
 #include <page.h>
 #include <stddef.h>
 #include <common/assert.h>
+#include <asm.h>
+#include <eflags.h>
+#include <vm/vm.h>
 
-#define FREE_FRAME_LIST_END UINT_MAX
+#define FREE_FRAME_LIST_END 0xffffff  /* Largest value of frame_info_t.next */
 #define PAGE_ALIGNMENT_CHECK 0x00000fff
+#define FRAME_ADDR(index) ((void *)(USER_MEM_START + ((index) * PAGE_SIZE)))
+#define MAGAZINE_SIZE 32    /* Frames cached in front of the free lists */
+#define MAGAZINE_REFILL 16  /* Frames moved into an empty magazine at once */
+#define ZERO_POOL_SIZE 256  /* Pre-zeroed frames kept for new mappings */
+#define ZERO_POOL_REFILL 32 /* Frames zeroed per idle timer tick */
 
-static int *free_frames_arr;        /* stack of free physical frames */
-static mutex_t *free_frames_lock;   /* locks for the physical frames */
+/** @brief a small cache of free frames in front of the free lists
+ *
+ *  Its spinlock is only held to move a few pointers, so most
+ *  allocations and frees never take list_lock.
+ */
+typedef struct frame_magazine {
+    spinlock_t lock;
+    int count;
+    void *frames[MAGAZINE_SIZE];
+} frame_magazine_t;
+
+static frame_info_t *frame_info;    /* metadata for the physical frames */
+static unsigned int frame_count;    /* number of user physical frames */
+
+/* Buddy free lists. Blocks of 2^order frames, aligned to their size, are
+ * chained through the frame_info_t of their first frame. 
+ * FREE_FRAME_LIST_END => no free blocks of that order */
+static unsigned int free_area_head[MAX_FRAME_ORDER + 1];
+static int free_area_count[MAX_FRAME_ORDER + 1];
+static ticket_lock_t list_lock;  /* Protects the free frame lists */
+static frame_magazine_t magazine;
 
-static void *free_list_head; /* Head of free list,UINT_MAX => no free frames */
-static mutex_t list_mut;     /* Mutex to synchronize access to free frame list */
+/* Free frames already filled with zeroes by the idle thread. Like the
+ * magazine it has a spinlock of its own. Neither lock is held while
+ * taking list_lock or the other one. */
+static spinlock_t zero_pool_lock;
+static void *zero_pool[ZERO_POOL_SIZE];
+static int zero_pool_count;
+static int zero_pool_refilling;
+
+/* Free frames sorted by color, for the color aware mode. They are taken
+ * out of the buddy lists one aligned block of PAGE_COLORS frames, i.e.
+ * one frame of every color, at a time and chained through
+ * frame_info_t.next. Protected by list_lock. */
+static unsigned int color_head[PAGE_COLORS];
+static int color_count;
+static volatile int frame_coloring;
+static volatile int colored_hits;   /* Got a frame of the color asked for */
+static volatile int colored_misses; /* Had to settle for another color */
+
+static int pop_free_list(void **frames, int count);
+static void push_free_list(void **frames, int count);
+static int fill_magazine(void **frames, int count);
+static int empty_magazine(void **frames, int count);
+static int take_zero_pool(void **frames, int count);
+static unsigned int buddy_alloc(int order);
+static void buddy_free(unsigned int index, int order);
+static void add_free_block(unsigned int index, int order);
+static void remove_free_block(unsigned int index);
+static void mark_block(unsigned int index, int order, int free);
+static unsigned int pop_color_list(int color);
+static unsigned int pop_any_color();
+static void split_color_block(unsigned int index);
+static void drain_color_lists();
 
 static void init_free_list();
+static frame_info_t *get_frame_info(void *frame_addr);
 
 /** @brief initialize the free frame allocator
  *
- *  initialize the free list and also the mutex to synchronize access to the 
- *  free frame list.
+ *  initialize the free lists and also the locks to synchronize access to
+ *  the free frame lists, the magazine and the zero pool.
  *
  *  @return void
  */
 void init_frame_allocator() {
-    /* create the free list of frames */
+    /* create the free lists of frames */
     init_free_list();
 
-    kernel_assert(mutex_init(&list_mut) == 0);
+    ticket_init(&list_lock);
+    spin_init(&magazine.lock);
+    spin_init(&zero_pool_lock);
 }
 
-/** @brief initialize the free frame list on system startup
+/** @brief initialize the free frame lists on system startup
  *
- *  allocates space for the free frame stack and the frame locks
- *  initializes the mutexes for each physical frame. Initialize
- *  free_list_head to USER_MEM_START
+ *  allocates space for the frame metadata and carves the physical 
+ *  memory into the largest aligned blocks that fit.
  *
  *  @return void
  */
 void init_free_list() {
+	int order;
+	unsigned int i;
 
-	/*Initialize the free list array*/
-	free_frames_arr = (int *)smalloc(FREE_FRAMES_COUNT*sizeof(int));
-	kernel_assert(free_frames_arr != NULL);
-	free_frames_lock = (mutex_t *)smalloc(FREE_FRAMES_COUNT*sizeof(mutex_t));
-	kernel_assert(free_frames_lock != NULL);
+	frame_count = FREE_FRAMES_COUNT;
+	kernel_assert(frame_count < FREE_FRAME_LIST_END);
+	frame_info = (frame_info_t *)smalloc(frame_count*sizeof(frame_info_t));
+	kernel_assert(frame_info != NULL);
 
-	int i;
-	for(i = 0; i < FREE_FRAMES_COUNT - 1; i++) {
-		free_frames_arr[i] = (USER_MEM_START + ((i+1) * PAGE_SIZE));
-		kernel_assert(mutex_init(&free_frames_lock[i]) == 0);
+	for(order = 0; order <= MAX_FRAME_ORDER; order++) {
+		free_area_head[order] = FREE_FRAME_LIST_END;
+		free_area_count[order] = 0;
 	}
-	free_frames_arr[FREE_FRAMES_COUNT - 1] = FREE_FRAME_LIST_END;
-	kernel_assert(mutex_init(&free_frames_lock[FREE_FRAMES_COUNT - 1]) == 0);
+	for(i = 0; i < PAGE_COLORS; i++) {
+		color_head[i] = FREE_FRAME_LIST_END;
+	}
+	color_count = 0;
 
-	free_list_head = (void *)USER_MEM_START;
+	for(i = 0; i < frame_count; i++) {
+		frame_info[i].ref_count = 0;
+		frame_info[i].flags = 0;
+	}
+
+	i = 0;
+	while(i < frame_count) {
+		order = MAX_FRAME_ORDER;
+		while((i & ((1 << order) - 1)) || i + (1 << order) > frame_count) {
+			order--;
+		}
+		mark_block(i, order, 1);
+		add_free_block(i, order);
+		i += 1 << order;
+	}
 }
 
 /** @brief get a free physical frame
  *
- *  This function locks the frame list (which functions as a stack)
- *  and returns the top of the frame list. If there are no more free frames 
- *  the function returns null.
- *
- *  @return void * physical address of the free frame
+ *  @return void * physical address of the free frame, NULL if there
+ *          are no more free frames
  */
 void *allocate_frame() {
-    mutex_lock(&list_mut);
-	if ((int)free_list_head == FREE_FRAME_LIST_END) {
-        mutex_unlock(&list_mut);
+    void *frame_addr;
+    if (allocate_frames(&frame_addr, 1) == 0) {
         return NULL;
     }
-    void *frame_addr = free_list_head; 
-	free_list_head = (void *)free_frames_arr[FRAME_INDEX(frame_addr)];
-	mutex_unlock(&list_mut);
-
-    kernel_assert(((int)frame_addr & PAGE_ALIGNMENT_CHECK) == 0);
-	kernel_assert(FRAME_INDEX(frame_addr) >= 0);
-	kernel_assert(FRAME_INDEX(frame_addr) < FREE_FRAMES_COUNT);
-
     return frame_addr;
 }
 
-/** @brief return a physical frame to the free frame stack
+/** @brief get a free physical frame filled with zeroes
  *
- *  This function locks the frame list (which functions as a stack)
- *  adds a frame back to the top of the frame stack.
+ *  @return void * physical address of the frame, NULL if there
+ *          are no more free frames
+ */
+void *allocate_zeroed_frame() {
+    void *frame_addr;
+    if (allocate_zeroed_frames(&frame_addr, 1) == 0) {
+        return NULL;
+    }
+    return frame_addr;
+}
+
+/** @brief return a physical frame to the free frame lists
  *
  *  @param frame_addr the address of the frame to be freed.
  *  @return void
  */
 void deallocate_frame(void *frame_addr) {
-    kernel_assert(((int)frame_addr & PAGE_ALIGNMENT_CHECK) == 0);
-    kernel_assert(frame_addr != NULL);
-	kernel_assert(FRAME_INDEX(frame_addr) >= 0);
-	kernel_assert(FRAME_INDEX(frame_addr) < FREE_FRAMES_COUNT);
+    free_frames(&frame_addr, 1);
+}
 
-    mutex_lock(&list_mut);
-	int index = FRAME_INDEX(frame_addr);
-	free_frames_arr[index] = (unsigned int)free_list_head;
-	free_list_head = frame_addr;
-    mutex_unlock(&list_mut);
+/** @brief get several free physical frames at once
+ *
+ *  Frames are taken from the magazine first. Whatever is missing is
+ *  taken from the buddy free lists along with a refill for the
+ *  magazine, all under a single acquisition of list_lock. Once those
+ *  are empty, the frames of the pre-zeroed pool are handed out too.
+ *
+ *  @param frames array to store the addresses of the frames in
+ *  @param count the number of frames wanted
+ *  @return int the number of frames allocated, which is less than 
+ *          count only if the system runs out of frames
+ */
+int allocate_frames(void **frames, int count) {
+    int allocated, refilled = 0, cached, int_flag, i;
+    void *refill[MAGAZINE_REFILL];
+
+    allocated = empty_magazine(frames, count);
+    if (allocated < count) {
+        int_flag = ticket_lock_irqsave(&list_lock);
+        allocated += pop_free_list(frames + allocated, count - allocated);
+        refilled = pop_free_list(refill, MAGAZINE_REFILL);
+        ticket_unlock_irqrestore(&list_lock, int_flag);
+
+        /* Someone may have filled the magazine up in the mean time */
+        cached = fill_magazine(refill, refilled);
+        if (cached < refilled) {
+            int_flag = ticket_lock_irqsave(&list_lock);
+            push_free_list(refill + cached, refilled - cached);
+            ticket_unlock_irqrestore(&list_lock, int_flag);
+        }
+    }
+
+    if (allocated < count) {
+        allocated += take_zero_pool(frames + allocated, count - allocated);
+    }
+
+    for (i = 0; i < allocated; i++) {
+        frame_info_t *info = get_frame_info(frames[i]);
+        kernel_assert(info->flags & FRAME_FREE);
+        kernel_assert(info->ref_count == 0);
+        info->flags &= ~FRAME_FREE;
+    }
+    return allocated;
 }
 
-/** @brief Function to lock a particular physical frame
+/** @brief get several free physical frames filled with zeroes
  *
- *  @param frame_addr The address of the frame that must be locked
+ *  Frames are taken from the pre-zeroed pool first. When the pool runs
+ *  dry the rest come from allocate_frames() and are zeroed right here.
  *
+ *  @param frames array to store the addresses of the frames in
+ *  @param count the number of frames wanted
+ *  @return int the number of frames allocated, which is less than 
+ *          count only if the system runs out of frames
+ */
+int allocate_zeroed_frames(void **frames, int count) {
+    int allocated, dirty, i;
+
+    allocated = take_zero_pool(frames, count);
+    for (i = 0; i < allocated; i++) {
+        frame_info_t *info = get_frame_info(frames[i]);
+        kernel_assert(info->flags & FRAME_FREE);
+        kernel_assert(info->ref_count == 0);
+        info->flags &= ~FRAME_FREE;
+    }
+
+    if (allocated < count) {
+        dirty = allocate_frames(frames + allocated, count - allocated);
+        for (i = allocated; i < allocated + dirty; i++) {
+            clear_frame(frames[i]);
+        }
+        allocated += dirty;
+    }
+    return allocated;
+}
+
+/** @brief turn the color aware mode on or off
+ *
+ *  When it is off the color lists are handed back to the buddy lists
+ *  so that the frames in them can be merged again.
+ *
+ *  @param enable non zero to turn the mode on
  *  @return void
  */
-void lock_frame(void *frame_addr) {
-	kernel_assert(frame_addr != NULL);
-	kernel_assert(FRAME_INDEX(frame_addr) >= 0);
-	kernel_assert(FRAME_INDEX(frame_addr) < FREE_FRAMES_COUNT);
+void set_frame_coloring(int enable) {
+    int int_flag = ticket_lock_irqsave(&list_lock);
+
+    frame_coloring = enable != 0;
+    if (!frame_coloring) {
+        drain_color_lists();
+    }
+    ticket_unlock_irqrestore(&list_lock, int_flag);
+}
+
+/** @brief check whether the color aware mode is on
+ *
+ *  @return int 1 if it is on, 0 if not
+ */
+int frame_coloring_enabled() {
+    return frame_coloring;
+}
+
+/** @brief get a free physical frame for a user page
+ *
+ *  In the color aware mode the frame has the same color as the page it
+ *  is for, so that pages which are contiguous in virtual memory do not
+ *  fight over the same cache sets. If no frame of that color is left
+ *  any frame is handed out instead.
+ *
+ *  @param addr the virtual address the frame will be mapped at
+ *  @return void * physical address of the frame, NULL if there are no
+ *          more free frames
+ */
+void *allocate_colored_frame(void *addr) {
+    int color = PAGE_COLOR(addr);
+    unsigned int index;
+    int int_flag;
+
+    if (!frame_coloring) {
+        return allocate_frame();
+    }
+
+    int_flag = ticket_lock_irqsave(&list_lock);
+    index = pop_color_list(color);
+    if (index == FREE_FRAME_LIST_END) {
+        index = buddy_alloc(PAGE_COLOR_ORDER);
+        if (index != FREE_FRAME_LIST_END) {
+            split_color_block(index);
+            index = pop_color_list(color);
+        }
+    }
+    ticket_unlock_irqrestore(&list_lock, int_flag);
+
+    if (index == FREE_FRAME_LIST_END) {
+        atomic_add(&colored_misses, 1);
+        return allocate_frame();
+    }
+    atomic_add(&colored_hits, 1);
+    mark_block(index, 0, 0);
+    return FRAME_ADDR(index);
+}
+
+/** @brief get a free physical frame filled with zeroes for a user page
+ *
+ *  Same as allocate_colored_frame(). The pre-zeroed pool is searched
+ *  for a frame of the right color before one is zeroed here.
+ *
+ *  @param addr the virtual address the frame will be mapped at
+ *  @return void * physical address of the frame, NULL if there are no
+ *          more free frames
+ */
+void *allocate_colored_zeroed_frame(void *addr) {
+    int color = PAGE_COLOR(addr);
+    void *frame_addr = NULL;
+    int int_flag, i;
+
+    if (!frame_coloring) {
+        return allocate_zeroed_frame();
+    }
+
+    int_flag = spin_lock_irqsave(&zero_pool_lock);
+    for (i = 0; i < zero_pool_count; i++) {
+        if (PAGE_COLOR(zero_pool[i]) == color) {
+            frame_addr = zero_pool[i];
+            zero_pool[i] = zero_pool[--zero_pool_count];
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&zero_pool_lock, int_flag);
+    if (frame_addr != NULL) {
+        atomic_add(&colored_hits, 1);
+        mark_block(FRAME_INDEX(frame_addr), 0, 0);
+        return frame_addr;
+    }
+
+    frame_addr = allocate_colored_frame(addr);
+    if (frame_addr != NULL) {
+        clear_frame(frame_addr);
+    }
+    return frame_addr;
+}
+
+/** @brief zero some free frames ahead of time
+ *
+ *  Called from the loop of the idle thread, with interrupts enabled.
+ *  Frames are taken from the magazine, or from the free lists if
+ *  list_lock happens to be free. The idle thread never waits for a
+ *  lock here. The frames are zeroed with interrupts enabled, so a timer
+ *  tick arriving in the middle simply switches away from it, and the
+ *  frames join the pool once it runs again.
+ *
+ *  @return void
+ */
+void refill_zero_pool() {
+    void *frames[ZERO_POOL_REFILL];
+    int count, wanted, int_flag, i;
+
+    int_flag = spin_lock_irqsave(&zero_pool_lock);
+    if (zero_pool_refilling || zero_pool_count == ZERO_POOL_SIZE) {
+        spin_unlock_irqrestore(&zero_pool_lock, int_flag);
+        return;
+    }
+    zero_pool_refilling = 1;
+    wanted = ZERO_POOL_SIZE - zero_pool_count;
+    if (wanted > ZERO_POOL_REFILL) {
+        wanted = ZERO_POOL_REFILL;
+    }
+    spin_unlock_irqrestore(&zero_pool_lock, int_flag);
+
+    count = empty_magazine(frames, wanted);
+    if (count < wanted) {
+        int_flag = get_eflags() & EFL_IF;
+        disable_interrupts();
+        if (ticket_trylock(&list_lock) == 0) {
+            count += pop_free_list(frames + count, wanted - count);
+            ticket_unlock(&list_lock);
+        }
+        if (int_flag) {
+            enable_interrupts();
+        }
+    }
+
+    /* The frames stay marked FRAME_FREE, nobody else can see them */
+    for (i = 0; i < count; i++) {
+        clear_frame_idle(frames[i]);
+    }
+
+    int_flag = spin_lock_irqsave(&zero_pool_lock);
+    for (i = 0; i < count; i++) {
+        zero_pool[zero_pool_count++] = frames[i];
+    }
+    zero_pool_refilling = 0;
+    spin_unlock_irqrestore(&zero_pool_lock, int_flag);
+}
+
+/** @brief return several physical frames at once
+ *
+ *  The frames go into the magazine as long as it has room, the rest
+ *  go back to the buddy free lists under a single acquisition
+ *  of list_lock.
+ *
+ *  @param frames the addresses of the frames to be freed
+ *  @param count the number of frames
+ *  @return void
+ */
+void free_frames(void **frames, int count) {
+    int cached, int_flag, i;
+
+    for (i = 0; i < count; i++) {
+        frame_info_t *info = get_frame_info(frames[i]);
+        kernel_assert(!(info->flags & FRAME_FREE));
+        info->flags |= FRAME_FREE;
+    }
+
+    cached = fill_magazine(frames, count);
+    if (cached < count) {
+        int_flag = ticket_lock_irqsave(&list_lock);
+        push_free_list(frames + cached, count - cached);
+        ticket_unlock_irqrestore(&list_lock, int_flag);
+    }
+}
+
+/** @brief return physical frames without ever blocking
+ *
+ *  Same as free_frames(), for the idle thread. Frames which do not fit
+ *  in the magazine go to the free lists only if list_lock happens to be
+ *  free, otherwise they are left to the caller.
+ *
+ *  @pre interrupts are disabled
+ *
+ *  @param frames the addresses of the frames to be freed
+ *  @param count the number of frames
+ *  @return int the number of frames freed, from the start of frames
+ */
+int free_frames_idle(void **frames, int count) {
+    int freed, i;
+
+    for (i = 0; i < count; i++) {
+        frame_info_t *info = get_frame_info(frames[i]);
+        kernel_assert(!(info->flags & FRAME_FREE));
+        info->flags |= FRAME_FREE;
+    }
+
+    freed = fill_magazine(frames, count);
+    if (freed < count && ticket_trylock(&list_lock) == 0) {
+        push_free_list(frames + freed, count - freed);
+        ticket_unlock(&list_lock);
+        freed = count;
+    }
+    for (i = freed; i < count; i++) {
+        get_frame_info(frames[i])->flags &= ~FRAME_FREE;
+    }
+    return freed;
+}
+
+/** @brief get a physically contiguous run of frames
+ *
+ *  The run is 2^order frames long and aligned to its size. Frames 
+ *  sitting in the magazine, the zero pool or the color lists cannot be
+ *  merged with their buddies, so all of them are emptied and the
+ *  allocation retried before giving up.
+ *
+ *  @param order log2 of the number of frames, at most MAX_FRAME_ORDER
+ *  @return void * physical address of the first frame, NULL if no
+ *          run that large is free
+ */
+void *allocate_frame_block(int order) {
+    int int_flag;
+
+    kernel_assert(order >= 0 && order <= MAX_FRAME_ORDER);
+
+    int_flag = ticket_lock_irqsave(&list_lock);
+    unsigned int index = buddy_alloc(order);
+    ticket_unlock_irqrestore(&list_lock, int_flag);
+    if (index == FREE_FRAME_LIST_END && order > 0) {
+        void *cached[MAGAZINE_SIZE];
+        int count;
+
+        /* The zero pool is large, hand the frames back a batch at a time
+         * to keep this off the kernel stack */
+        do {
+            count = empty_magazine(cached, MAGAZINE_SIZE);
+            count += take_zero_pool(cached + count, MAGAZINE_SIZE - count);
+            int_flag = ticket_lock_irqsave(&list_lock);
+            push_free_list(cached, count);
+            ticket_unlock_irqrestore(&list_lock, int_flag);
+        } while (count == MAGAZINE_SIZE);
+        int_flag = ticket_lock_irqsave(&list_lock);
+        drain_color_lists();
+        index = buddy_alloc(order);
+        ticket_unlock_irqrestore(&list_lock, int_flag);
+    }
+    if (index == FREE_FRAME_LIST_END) {
+        return NULL;
+    }
+    mark_block(index, order, 0);
+    return FRAME_ADDR(index);
+}
+
+/** @brief return a run obtained from allocate_frame_block()
+ *
+ *  @param frame_addr physical address of the first frame
+ *  @param order the order the run was allocated with
+ *  @return void
+ */
+void free_frame_block(void *frame_addr, int order) {
+    int int_flag;
+
+    kernel_assert(order >= 0 && order <= MAX_FRAME_ORDER);
+    kernel_assert((FRAME_INDEX(frame_addr) & ((1 << order) - 1)) == 0);
+
+    mark_block(FRAME_INDEX(frame_addr), order, 1);
+    int_flag = ticket_lock_irqsave(&list_lock);
+    buddy_free(FRAME_INDEX(frame_addr), order);
+    ticket_unlock_irqrestore(&list_lock, int_flag);
+}
+
+/** @brief Function to get the number of free blocks of an order
+ *
+ *  Frames cached in the magazine are not counted.
+ *
+ *  @param order the order
+ *  @return int the number of free blocks
+ */
+int frame_free_blocks(int order) {
+    kernel_assert(order >= 0 && order <= MAX_FRAME_ORDER);
+    return free_area_count[order];
+}
+
+/** @brief put free frames into the magazine
+ *
+ *  @param frames the addresses of the frames
+ *  @param count the number of frames
+ *  @return int the number of frames that fit in the magazine
+ */
+int fill_magazine(void **frames, int count) {
+    int cached = 0;
+    int int_flag = spin_lock_irqsave(&magazine.lock);
+
+    while (cached < count && magazine.count < MAGAZINE_SIZE) {
+        magazine.frames[magazine.count++] = frames[cached++];
+    }
+    spin_unlock_irqrestore(&magazine.lock, int_flag);
+    return cached;
+}
+
+/** @brief take free frames out of the magazine
+ *
+ *  @param frames array to store the addresses of the frames in
+ *  @param count the number of frames wanted
+ *  @return int the number of frames taken
+ */
+int empty_magazine(void **frames, int count) {
+    int taken = 0;
+    int int_flag = spin_lock_irqsave(&magazine.lock);
+
+    while (taken < count && magazine.count > 0) {
+        frames[taken++] = magazine.frames[--magazine.count];
+    }
+    spin_unlock_irqrestore(&magazine.lock, int_flag);
+    return taken;
+}
+
+/** @brief take frames out of the pre-zeroed pool
+ *
+ *  @param frames array to store the addresses of the frames in
+ *  @param count the number of frames wanted
+ *  @return int the number of frames taken
+ */
+int take_zero_pool(void **frames, int count) {
+    int taken = 0;
+    int int_flag = spin_lock_irqsave(&zero_pool_lock);
+
+    while (taken < count && zero_pool_count > 0) {
+        frames[taken++] = zero_pool[--zero_pool_count];
+    }
+    spin_unlock_irqrestore(&zero_pool_lock, int_flag);
+    return taken;
+}
+
+/** @brief take single frames out of the buddy free lists
+ *
+ *  Frames sorted by color are only used once the buddy lists are empty.
+ *
+ *  @pre list_lock is held
+ *  @param frames array to store the addresses of the frames in
+ *  @param count the number of frames wanted
+ *  @return int the number of frames taken
+ */
+int pop_free_list(void **frames, int count) {
+    int popped = 0;
+    unsigned int index;
+    while (popped < count) {
+        index = buddy_alloc(0);
+        if (index == FREE_FRAME_LIST_END) {
+            index = pop_any_color();
+        }
+        if (index == FREE_FRAME_LIST_END) {
+            break;
+        }
+        frames[popped++] = FRAME_ADDR(index);
+    }
+    return popped;
+}
+
+/** @brief give single frames back to the buddy free lists
+ *
+ *  @pre list_lock is held
+ *  @param frames the addresses of the frames
+ *  @param count the number of frames
+ *  @return void
+ */
+void push_free_list(void **frames, int count) {
+    int i;
+    for (i = 0; i < count; i++) {
+        buddy_free(FRAME_INDEX(frames[i]), 0);
+    }
+}
+
+/** @brief take a block out of the buddy free lists
+ *
+ *  The smallest free block which is large enough is split in halves
+ *  until it has the right size. The unused halves go back to the
+ *  free lists.
+ *
+ *  @pre list_lock is held
+ *  @param order the order of the block
+ *  @return unsigned int index of the first frame of the block,
+ *          FREE_FRAME_LIST_END if there is none
+ */
+unsigned int buddy_alloc(int order) {
+    int cur_order = order;
+    while (cur_order <= MAX_FRAME_ORDER 
+           && free_area_head[cur_order] == FREE_FRAME_LIST_END) {
+        cur_order++;
+    }
+    if (cur_order > MAX_FRAME_ORDER) {
+        return FREE_FRAME_LIST_END;
+    }
+
+    unsigned int index = free_area_head[cur_order];
+    remove_free_block(index);
+    while (cur_order > order) {
+        cur_order--;
+        add_free_block(index + (1 << cur_order), cur_order);
+    }
+    return index;
+}
+
+/** @brief put a block back into the buddy free lists
+ *
+ *  The block is merged with its buddy for as long as the buddy is free
+ *  as a whole.
+ *
+ *  @pre list_lock is held
+ *  @param index index of the first frame of the block
+ *  @param order the order of the block
+ *  @return void
+ */
+void buddy_free(unsigned int index, int order) {
+    while (order < MAX_FRAME_ORDER) {
+        unsigned int buddy = index ^ (1 << order);
+        if (buddy >= frame_count || !(frame_info[buddy].flags & FRAME_BUDDY)
+            || frame_info[buddy].order != order) {
+            break;
+        }
+        remove_free_block(buddy);
+        if (buddy < index) {
+            index = buddy;
+        }
+        order++;
+    }
+    add_free_block(index, order);
+}
+
+/** @brief push a block onto the free list of its order
+ *
+ *  @pre list_lock is held
+ *  @param index index of the first frame of the block
+ *  @param order the order of the block
+ *  @return void
+ */
+void add_free_block(unsigned int index, int order) {
+    frame_info_t *info = &frame_info[index];
+    info->flags |= FRAME_BUDDY;
+    info->order = order;
+    info->prev = FREE_FRAME_LIST_END;
+    info->next = free_area_head[order];
+    if (free_area_head[order] != FREE_FRAME_LIST_END) {
+        frame_info[free_area_head[order]].prev = index;
+    }
+    free_area_head[order] = index;
+    free_area_count[order]++;
+}
+
+/** @brief unlink a block from the free list of its order
+ *
+ *  @pre list_lock is held
+ *  @param index index of the first frame of the block
+ *  @return void
+ */
+void remove_free_block(unsigned int index) {
+    frame_info_t *info = &frame_info[index];
+    int order = info->order;
+    if (info->prev == FREE_FRAME_LIST_END) {
+        free_area_head[order] = info->next;
+    } else {
+        frame_info[info->prev].next = info->next;
+    }
+    if (info->next != FREE_FRAME_LIST_END) {
+        frame_info[info->next].prev = info->prev;
+    }
+    info->flags &= ~FRAME_BUDDY;
+    free_area_count[order]--;
+}
 
-	mutex_lock(&free_frames_lock[FRAME_INDEX(frame_addr)]);
+/** @brief mark every frame of a block as free or as in use
+ *
+ *  @param index index of the first frame of the block
+ *  @param order the order of the block
+ *  @param free 1 if the block is being freed, 0 if it is being allocated
+ *  @return void
+ */
+void mark_block(unsigned int index, int order, int free) {
+    unsigned int i;
+    for (i = index; i < index + (1 << order); i++) {
+        if (free) {
+            kernel_assert(!(frame_info[i].flags & FRAME_FREE));
+            frame_info[i].flags |= FRAME_FREE;
+        } else {
+            kernel_assert(frame_info[i].flags & FRAME_FREE);
+            kernel_assert(frame_info[i].ref_count == 0);
+            frame_info[i].flags &= ~FRAME_FREE;
+        }
+    }
 }
 
-/** @brief Function to unlock a particular physical frame
+/** @brief take a frame of some color off the color lists
  *
- *  @param frame_addr The address of the frame that must be unlocked
+ *  @pre list_lock is held
+ *  @param color the color
+ *  @return unsigned int index of the frame, FREE_FRAME_LIST_END if
+ *          there is no free frame of that color
+ */
+unsigned int pop_color_list(int color) {
+    unsigned int index = color_head[color];
+    if (index != FREE_FRAME_LIST_END) {
+        color_head[color] = frame_info[index].next;
+        color_count--;
+    }
+    return index;
+}
+
+/** @brief take a frame of any color off the color lists
+ *
+ *  @pre list_lock is held
+ *  @return unsigned int index of the frame, FREE_FRAME_LIST_END if
+ *          the color lists are empty
+ */
+unsigned int pop_any_color() {
+    int color;
+    if (color_count == 0) {
+        return FREE_FRAME_LIST_END;
+    }
+    for (color = 0; color < PAGE_COLORS; color++) {
+        if (color_head[color] != FREE_FRAME_LIST_END) {
+            return pop_color_list(color);
+        }
+    }
+    return FREE_FRAME_LIST_END;
+}
+
+/** @brief sort the frames of a block taken from the buddy lists
+ *         into the color lists
  *
+ *  @pre list_lock is held
+ *  @param index index of the first frame of a block of order
+ *         PAGE_COLOR_ORDER
  *  @return void
  */
-void unlock_frame(void *frame_addr) {
-	kernel_assert(frame_addr != NULL);
-	kernel_assert(FRAME_INDEX(frame_addr) >= 0);
+void split_color_block(unsigned int index) {
+    unsigned int i;
+    for (i = index; i < index + PAGE_COLORS; i++) {
+        int color = PAGE_COLOR(FRAME_ADDR(i));
+        frame_info[i].next = color_head[color];
+        color_head[color] = i;
+        color_count++;
+    }
+}
+
+/** @brief give every frame on the color lists back to the buddy lists
+ *
+ *  @pre list_lock is held
+ *  @return void
+ */
+void drain_color_lists() {
+    unsigned int index;
+    while ((index = pop_any_color()) != FREE_FRAME_LIST_END) {
+        buddy_free(index, 0);
+    }
+}
+
+/** @brief Function to take a reference on a physical frame
+ *
+ *  @param frame_addr The address of the frame
+ *
+ *  @return int The reference count after taking the reference
+ */
+int frame_ref(void *frame_addr) {
+	return atomic_add(&get_frame_info(frame_addr)->ref_count, 1);
+}
+
+/** @brief Function to drop a reference on a physical frame
+ *
+ *  The frame is not freed when the count drops to zero, that is up
+ *  to the caller.
+ *
+ *  @param frame_addr The address of the frame
+ *
+ *  @return int The reference count after dropping the reference
+ */
+int frame_unref(void *frame_addr) {
+	int refs = atomic_add(&get_frame_info(frame_addr)->ref_count, -1);
+	kernel_assert(refs >= 0);
+	return refs;
+}
+
+/** @brief Function to get the reference count of a physical frame
+ *
+ *  @param frame_addr The address of the frame
+ *
+ *  @return int The reference count
+ */
+int frame_ref_count(void *frame_addr) {
+	return get_frame_info(frame_addr)->ref_count;
+}
+
+/** @brief Function to get the metadata of a physical frame
+ *
+ *  @param frame_addr The address of the frame
+ *
+ *  @return frame_info_t * The metadata of the frame
+ */
+frame_info_t *get_frame_info(void *frame_addr) {
+    kernel_assert(((int)frame_addr & PAGE_ALIGNMENT_CHECK) == 0);
+	kernel_assert((unsigned int)frame_addr >= USER_MEM_START);
 	kernel_assert(FRAME_INDEX(frame_addr) < FREE_FRAMES_COUNT);
 
-	mutex_unlock(&free_frames_lock[FRAME_INDEX(frame_addr)]);
+	return &frame_info[FRAME_INDEX(frame_addr)];
 }
 
 /** @brief Function used to check the physical frames status
  *
- *  Used for debugging
+ *  Used for debugging. Prints the number of free blocks of every order
+ *  along with the order of the largest free block, which shows how 
+ *  fragmented physical memory is.
  * 
  *  @return int Number of free physical frames
  */
 int check_physical_memory() {
-    int free_count = 0;
-    void *first = free_list_head;
+    int free_count = 0, largest = -1, order;
+    unsigned int index;
+    int int_flag = ticket_lock_irqsave(&list_lock);
 
-    while ((int)first != FREE_FRAME_LIST_END) {
-		kernel_assert((unsigned int)first >= USER_MEM_START);
-		kernel_assert((unsigned int)first <= FREE_FRAME_LIST_END);
-	    first = (void *)(free_frames_arr[FRAME_INDEX(first)]);
-        free_count++;
+    for (order = 0; order <= MAX_FRAME_ORDER; order++) {
+        int blocks = 0;
+        for (index = free_area_head[order]; index != FREE_FRAME_LIST_END;
+             index = frame_info[index].next) {
+            kernel_assert(index < frame_count);
+            kernel_assert(frame_info[index].flags & FRAME_BUDDY);
+            kernel_assert(frame_info[index].order == order);
+            blocks++;
+        }
+        kernel_assert(blocks == free_area_count[order]);
+        if (blocks > 0) {
+            largest = order;
+            lprintf("Order %d: %d free blocks", order, blocks);
+        }
+        free_count += blocks << order;
     }
-    lprintf("Total free physical frames: %d, next free frame %p",free_count, free_list_head);
+    free_count += color_count;
+    lock_print_stats("free frame lists", &list_lock.stats);
+    lock_print_stats("frame magazine", &magazine.lock.stats);
+    lock_print_stats("zero pool", &zero_pool_lock.stats);
+    ticket_unlock_irqrestore(&list_lock, int_flag);
+    free_count += magazine.count + zero_pool_count;
+    lprintf("Total free physical frames: %d, largest free block order %d",
+            free_count, largest);
+    lprintf("Pre-zeroed frames: %d", zero_pool_count);
+    lprintf("Frame coloring %s: %d frames sorted by color, %d allocations "
+            "got their color, %d did not", frame_coloring ? "on" : "off",
+            color_count, colored_hits, colored_misses);
     return free_count;	
 }
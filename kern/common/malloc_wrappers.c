@@ -12,6 +12,7 @@
 #include <malloc_internal.h>
 #include <sync/mutex.h>
 #include <common/assert.h>
+#include <common/errors.h>
 
 static mutex_t mutex;
 
@@ -132,3 +133,20 @@ void sfree(void *buf, size_t size) {
     _sfree(buf, size);
 	mutex_unlock_int_save(&mutex);
 }
+
+/** @brief sfree() for callers which must not block
+ *
+ *  @param buf Buffer to be sfree'd
+ *  @param size Size of the buffer
+ *
+ *  @return int 0 if the buffer was freed, ERR_BUSY if someone holds
+ *          the lock, in which case the buffer is left alone
+ */
+int sfree_nowait(void *buf, size_t size) {
+	if (mutex_trylock(&mutex) < 0) {
+		return ERR_BUSY;
+	}
+    _sfree(buf, size);
+	mutex_unlock_int_save(&mutex);
+	return 0;
+}
@@ -0,0 +1,143 @@
+/** @file cpu.c
+ *  @brief bringing up the other processors
+ *
+ *  At boot the bootstrap processor reads the MP table, maps its local
+ *  APIC at LAPIC_VIRT_BASE and starts the application processors with
+ *  smp_boot(). Each of them turns on paging with the kernel page
+ *  directory, enables its local APIC and comes online.
+ *
+ *  Threads are only run by the bootstrap processor, from the single run
+ *  queue in scheduler.c. The run queue, the timer wheel, the free frame
+ *  lists and the thread map have spinlocks, but the mutexes, the frame
+ *  magazine and the fault paths still keep each other out by disabling
+ *  interrupts, which does not stop another processor, and nothing
+ *  shoots down stale TLB entries on the other processors. Until both
+ *  are done the application processors stay halted once online.
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+#include <core/cpu.h>
+#include <vm/vm.h>
+#include <smp/smp.h>
+#include <smp/apic.h>
+#include <smp/mptable.h>
+#include <asm.h>
+#include <asm/asm.h>
+#include <simics.h>
+#include <common/assert.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define TSS_DESC_TYPE 0x900       /* Available 32 bit TSS */
+#define TSS_DESC_PRESENT 0x8000
+
+static cpu_t cpus[MAX_CPUS];
+static int lapic_mapped;            /* Whether the local APIC can be used */
+static volatile int cpus_online;
+
+static void ap_main(int cpu);
+
+/** @brief start the application processors, if there are any
+ *
+ *  Called once on the bootstrap processor, after paging is on and
+ *  before any thread is queued.
+ *
+ *  @param mbinfo the multiboot information, used to find the MP table
+ *  @return void
+ */
+void smp_start(mbinfo_t *mbinfo) {
+    int cpu;
+
+    cpus[0].online = 1;
+    cpus_online = 1;
+    if (smp_init(mbinfo) < 0 || smp_num_cpus() < 2) {
+        return;
+    }
+
+    map_device_page((void *)LAPIC_VIRT_BASE, smp_lapic_base());
+    lapic_mapped = 1;
+
+    /* The MP table decides which number the bootstrap processor gets */
+    cpu = cpu_id();
+    kernel_assert(cpu < MAX_CPUS);
+    cpus[0].online = 0;
+    cpus[cpu].online = 1;
+
+    smp_boot(ap_main);
+    lprintf("%d processors online", cpus_online);
+}
+
+/** @brief get the number of the processor running the caller
+ *
+ *  @return int the processor number
+ */
+int cpu_id() {
+    return lapic_mapped ? smp_get_cpu() : 0;
+}
+
+/** @brief get the number of processors running the kernel
+ *
+ *  @return int the number of processors online
+ */
+int cpu_count() {
+    return cpus_online;
+}
+
+/** @brief print the state of every processor
+ *
+ *  Used for debugging.
+ *
+ *  @return void
+ */
+void cpu_print_stats() {
+    int cpu;
+
+    for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (!cpus[cpu].online) {
+            continue;
+        }
+        lprintf("CPU %d: %s", cpu, cpu == cpu_id() ? "scheduling" : "halted");
+    }
+}
+
+/** @brief build the GDT descriptor of a task state segment
+ *
+ *  smp_boot() gives each application processor a TSS of its own with
+ *  it. The descriptor is for an available 32 bit TSS, present, with
+ *  byte granularity.
+ *
+ *  @param tss the task state segment
+ *  @param tss_size its size
+ *  @return uint64_t the descriptor
+ */
+uint64_t tss_desc_create(void *tss, size_t tss_size) {
+    uint32_t base = (uint32_t)tss;
+    uint32_t limit = tss_size - 1;
+    uint32_t low, high;
+
+    low = (limit & 0xFFFF) | ((base & 0xFFFF) << 16);
+    high = ((base >> 16) & 0xFF) | TSS_DESC_TYPE | TSS_DESC_PRESENT
+           | (limit & 0xF0000) | (base & 0xFF000000);
+    return ((uint64_t)high << 32) | low;
+}
+
+/* ---------- Static local functions ----------- */
+
+/** @brief the first kernel code run by an application processor
+ *
+ *  Runs on the boot stack smp_boot() gave the processor, with paging
+ *  off and interrupts disabled.
+ *
+ *  @param cpu the processor number
+ *  @return Does not return
+ */
+void ap_main(int cpu) {
+    vm_init_ap();
+    apic_init();
+    cpus[cpu].online = 1;
+    atomic_add(&cpus_online, 1);
+    while (1) {
+        wait_for_interrupt();
+    }
+}
@@ -12,25 +12,43 @@
 #include <common/assert.h>
 #include <string/string.h>
 #include <vm/vm.h>
+#include <vm/region.h>
 #include <cr.h>
+#include <common_kern.h>
 #include <common/errors.h>
 #include <core/task.h>
 #include <core/task.h>
 #include <core/scheduler.h>
 #include <loader/loader.h>
-#include <syscalls/syscall_util.h>
+#include <vm/uaccess.h>
+#include <core/wait_vanish.h>
+
+#define EXEC_FAIL_EXIT_STATUS -2  /* Exit status of a task whose exec
+                                     failed past the point of no return */
 
 static int get_num_args(char **argvec);
 static char **copy_args(int num_args,char **argvec);
 static void free_args(char **argvec, int num);
 
 /** @brief The entry point for exec
+ *
+ *  The new program is loaded into the address space of the caller,
+ *  which is emptied first. The frames it needs are set aside before
+ *  that, so running out of them fails the call and the old program
+ *  goes on.
+ *
+ *  Past that point there is no old program to return to. If loading
+ *  still fails, e.g. because the kernel heap has no room for the
+ *  regions of the new program, exec does not return: the task is
+ *  killed as if it had called vanish() with status
+ *  EXEC_FAIL_EXIT_STATUS (-2), which is what wait() reports to its
+ *  parent.
  *
  *  @param arg_packet The address of argument packet containing 
  *  the required arguments for exec.
  *
- *  @return nothing if the call succeeds. If exec
- *  fails, then a negative number is returned.
+ *  @return nothing if the call succeeds. If exec fails before the
+ *  point of no return, a negative number is returned.
  */
 int do_exec(void *arg_packet) {
     task_struct_t *t = get_curr_task();
@@ -39,9 +57,15 @@ int do_exec(void *arg_packet) {
      * same time */
     mutex_lock(&t->exec_mutex);
 
-    char *execname = (char *)(*((int *)arg_packet));
-    char **argvec = (char **)(*((int *)arg_packet + 1));
+    int args[2];
+    if (copy_from_user(args, arg_packet, sizeof(args)) < 0) {
+    	mutex_unlock(&t->exec_mutex);
+        return ERR_INVAL;
+    }
+    char *execname = (char *)args[0];
+    char **argvec = (char **)args[1];
     int num_args, retval;
+    frame_reserve_t reserve;
 
     /* Copy execname to kernel memory after checking validity */
     char execname_kern[EXECNAME_MAX];
@@ -49,7 +73,7 @@ int do_exec(void *arg_packet) {
     	mutex_unlock(&t->exec_mutex);
         return ERR_NOMEM;
     }
-    if (copy_user_data(execname_kern, execname, EXECNAME_MAX) < 0) {
+    if (copy_string_from_user(execname_kern, execname, EXECNAME_MAX) < 0) {
     	mutex_unlock(&t->exec_mutex);
         return ERR_INVAL;
     }
@@ -68,7 +92,6 @@ int do_exec(void *arg_packet) {
     	mutex_unlock(&t->exec_mutex);
         return ERR_FAILURE;
     }
-    void *old_pd = (void *)get_cr3();
 
     /* Copy the argument vector into kernel space as we will be freeing
      * the old process's address space soon */
@@ -78,20 +101,49 @@ int do_exec(void *arg_packet) {
         return ERR_FAILURE;
     }
 
-    retval = load_task(execname_kern, num_args, argvec_kern, t);
+    simple_elf_t se_hdr;
+    if (elf_load_helper(&se_hdr, execname_kern) != ELF_SUCCESS) {
+        free_args(argvec_kern, num_args);
+    	mutex_unlock(&t->exec_mutex);
+        return ERR_FAILURE;
+    }
+
+    retval = vm_reserve_frames(&reserve, t->pdbr, &se_hdr,
+                               user_args_size(num_args, argvec_kern));
     if (retval < 0) {
         free_args(argvec_kern, num_args);
-        set_cur_pd(old_pd);
     	mutex_unlock(&t->exec_mutex);
         return retval;
     }
 
+    /* Point of no return. The old program goes away, the page
+     * directory and whatever page tables and frames fit the new one
+     * stay. The new program starts out with a region tree of its own. */
+    mutex_lock(&t->region_mutex);
+    reset_paging_info(t->pdbr, &t->regions, &se_hdr);
+    region_tree_destroy(&t->regions);
+    region_tree_init(&t->regions);
+    mutex_unlock(&t->region_mutex);
+
+    retval = load_task(execname_kern, num_args, argvec_kern, t);
+    vm_release_frames(&reserve);
+
     /* Free kernel argvec and execname */
-    free_paging_info(old_pd);
     free_args(argvec_kern, num_args);
-
     mutex_unlock(&t->exec_mutex);
 
+    if (retval < 0) {
+        /* Whatever got mapped may not be covered by a region yet, let
+         * vanish look at all of user memory */
+        mutex_lock(&t->region_mutex);
+        region_tree_destroy(&t->regions);
+        region_tree_init(&t->regions);
+        region_insert(&t->regions, (void *)USER_MEM_START,
+                      USER_MEM_END - USER_MEM_START, REGION_READ);
+        mutex_unlock(&t->region_mutex);
+        t->exit_status = EXEC_FAIL_EXIT_STATUS;
+        do_vanish();
+    }
     return 0;
 }
 
@@ -105,7 +157,7 @@ int do_exec(void *arg_packet) {
  */
 char **copy_args(int num_args,char **argvec) {
     int i;
-    char *arg;
+    char *arg, *user_arg;
     char **argvec_kern = (char **)smalloc((num_args + 1) * sizeof(char *));
     if(argvec_kern == NULL) {
         return NULL;
@@ -116,7 +168,8 @@ char **copy_args(int num_args,char **argvec) {
             free_args(argvec_kern, i);
             return NULL;
         }
-        if (copy_user_data(arg, argvec[i], ARGNAME_MAX) < 0) {
+        if (copy_from_user(&user_arg, &argvec[i], sizeof(char *)) < 0
+            || copy_string_from_user(arg, user_arg, ARGNAME_MAX) < 0) {
             free_args(argvec_kern, i);
             return NULL;
         }
@@ -161,12 +214,15 @@ void free_args(char **argvec, int num_args) {
  */
 int get_num_args(char **argvec) {
     int count = 0;
-    if (is_pointer_valid(argvec, sizeof(char *)) < 0) {
-        return ERR_INVAL;
-    }
+    char *arg;
 
-    while ((is_pointer_valid(argvec[count], sizeof(char *)) == 0)
-            && argvec[count] != '\0') {
+    while (1) {
+        if (copy_from_user(&arg, &argvec[count], sizeof(char *)) < 0) {
+            return ERR_INVAL;
+        }
+        if (arg == NULL) {
+            break;
+        }
         count++;
         if (count > NUM_ARGS_MAX) {
             return ERR_BIG;
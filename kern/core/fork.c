@@ -11,6 +11,8 @@
 #include <core/thread.h>
 #include <core/scheduler.h>
 #include <vm/vm.h>
+#include <vm/region.h>
+#include <vm/merge.h>
 #include <asm/asm.h>
 #include <common/errors.h>
 #include <string.h>
@@ -41,9 +43,18 @@ int do_fork() {
     add_to_tail(&child_task->child_task_link, &curr_task->child_task_head);
     mutex_unlock(&curr_task->vanish_mutex);
 	
-	/* Clone the address space */
-	void *new_pd_addr = clone_paging_info(curr_task->pdbr);
+	/* Clone the address space. Other threads must not add or remove
+	 * regions while it is being copied. */
+	mutex_lock(&curr_task->region_mutex);
+	void *new_pd_addr = NULL;
+	if(region_tree_clone(&child_task->regions, &curr_task->regions) == 0) {
+		new_pd_addr = clone_paging_info(curr_task->pdbr, 
+										&curr_task->regions);
+	}
+	mutex_unlock(&curr_task->region_mutex);
 	if(new_pd_addr == NULL) {
+		merge_remove_task(child_task);
+		region_tree_destroy(&child_task->regions);
 		thread_free_resources(child_task->thr);
 		sfree(child_task, sizeof(task_struct_t));
 		mutex_unlock(&curr_task->fork_mutex);
@@ -67,9 +78,6 @@ int do_fork() {
 	/* Add the first thread of the new task to runnable queue */
 	runq_add_thread(child_task->thr);
 
-	/* Dummy operation to invalidate TLB */
-	set_cur_pd(curr_task->pdbr);
-
 	mutex_unlock(&curr_task->fork_mutex);
 
 	return child_task->id;	
@@ -116,5 +124,6 @@ int do_thread_fork() {
 void thread_free_resources(thread_struct_t *thr) {
 	mutex_destroy(&thr->deschedule_mutex);
 	cond_destroy(&thr->deschedule_cond_var);
+	kstack_free(thr->k_stack);
     sfree(thr, sizeof(thread_struct_t));
 }
@@ -1,6 +1,35 @@
 /** @file scheduler.c
  *  @brief implementation of scheduler functions
  *
+ *  Runnable threads wait in one FIFO queue per priority, and the
+ *  highest priority with a thread waiting is found from a bitmap of the
+ *  queues which are not empty. A task whose threads run for the whole
+ *  quantum of a priority between them has its threads at that priority
+ *  moved down one, and a task whose threads block before that keeps
+ *  it, so threads waiting for input get ahead of threads computing.
+ *  The quantum belongs to the task and not to each thread, so that a
+ *  task cannot stay at a high priority longer by spreading its work
+ *  over more threads. Lower priorities get longer quanta, and at the
+ *  lowest one a task is switched out once it used up its quantum.
+ *
+ *  Every SCHED_BOOST_TICKS ticks every thread goes back to the priority
+ *  set for it with set_priority(), and every task gets its quanta back,
+ *  so that threads left at the lowest priority still get to run.
+ *
+ *  Within a priority the CPU is shared between tasks, not threads. Each
+ *  task has a weight set with set_weight() and a virtual runtime which
+ *  grows with every tick its threads run, more slowly the larger the
+ *  weight. The queue of a priority is a tree of the tasks having threads
+ *  runnable at it, ordered by virtual runtime, and the next thread is
+ *  the first of the task which is furthest behind. A task with many
+ *  threads thus gets no more than its share, and its threads take turns
+ *  in FIFO order. A task which had nothing to run starts from the
+ *  smallest virtual runtime seen so far, so it cannot save up CPU time
+ *  while blocked.
+ *
+ *  The run queues are protected by runq_lock, a ticket lock held with
+ *  interrupts disabled.
+ *
  *  @author Rohit Upadhyaya (rjupadhy)
  *  @author Prajwal Yadapadithaya (pyadapad)
  */
@@ -12,38 +41,182 @@
 #include <sync/mutex.h>
 #include <simics.h>
 #include <core/sleep.h>
+#include <core/ktimer.h>
 #include <drivers/timer/timer.h>
+#include <common/errors.h>
+#include <eflags.h>
+#include <sync/spinlock.h>
 
 static thread_struct_t *curr_thread; /* The thread currently being run */
 
-static list_head runnable_threads;    /* List of runnable threads */
+static rb_root run_queues[SCHED_LEVELS];    /* Tasks by virtual runtime */
+static unsigned int runq_bitmap;    /* Bit set for each queue not empty */
+static unsigned int min_vruntime;   /* Lower bound for queued tasks */
+static ticket_lock_t runq_lock;     /* Protects the run queues */
+
+static int boost_epoch;             /* Number of boosts so far */
+static ktimer_t boost_timer;
 
 static thread_struct_t *runq_get_head();
+static void runq_enqueue(thread_struct_t *thr);
+static void runq_dequeue(thread_struct_t *thr);
+static void refresh_priority(thread_struct_t *thr);
+static void use_up_level(task_struct_t *t, int level);
+static void entity_insert(sched_entity_t *se, int level);
+static void entity_erase(sched_entity_t *se, int level);
+static void charge_task(task_struct_t *t);
+static void boost_priorities(void *arg);
 
 /** @brief initialize the scheduler data structures
  *
  *  @return void
  */
 void init_scheduler() {
-	init_head(&runnable_threads);
-    init_sleeping_threads();
+    int i;
+    for (i = 0; i < SCHED_LEVELS; i++) {
+        rb_init_root(&run_queues[i]);
+    }
+    runq_bitmap = 0;
+    min_vruntime = 0;
+    ticket_init(&runq_lock);
+    boost_epoch = 0;
+    init_timer_wheel();
+    ktimer_init(&boost_timer, boost_priorities, NULL);
+    ktimer_add(&boost_timer, SCHED_BOOST_TICKS);
+}
+
+/** @brief set up the scheduling state of a new task
+ *
+ *  The task gets the weight of its parent, if any, and starts level
+ *  with the tasks already queued.
+ *
+ *  @param t the new task
+ *  @param parent the task creating it, NULL if none
+ *  @return void
+ */
+void sched_init_task(task_struct_t *t, task_struct_t *parent) {
+    int i;
+
+    t->weight = parent != NULL ? parent->weight : SCHED_WEIGHT_DEFAULT;
+    t->vruntime = min_vruntime;
+    t->cpu_ticks = 0;
+    t->runq_levels = 0;
+    t->used_levels = 0;
+    t->boost_epoch = boost_epoch;
+    for (i = 0; i < SCHED_LEVELS; i++) {
+        init_head(&t->sched[i].threads);
+        t->sched[i].task = t;
+        t->sched[i].ticks_used = 0;
+    }
+}
+
+/** @brief set up the scheduling state of a new thread
+ *
+ *  The thread gets the priority set for the thread creating it, if any.
+ *
+ *  @param thr the new thread
+ *  @return void
+ */
+void sched_init_thread(thread_struct_t *thr) {
+    thr->base_priority = curr_thread != NULL ? curr_thread->base_priority : 0;
+    thr->priority = thr->base_priority;
+    thr->boost_epoch = boost_epoch;
+    thr->on_runq = 0;
+}
+
+/** @brief account a timer tick to the running thread
+ *
+ *  Called from the timer interrupt. Once the threads of its task used
+ *  up the quantum of its priority, the thread is moved down along with
+ *  the other threads of the task at that priority.
+ *
+ *  @return int 1 if the running thread is to be switched out, 0 if it
+ *          goes on running
+ */
+int sched_tick() {
+    thread_struct_t *thr = curr_thread;
+    sched_entity_t *se;
+    int preempt;
+
+    if (thr == NULL || thr->status != RUNNING
+        || thr == get_idle_task()->thr) {
+        return 1;
+    }
+    ticket_lock(&runq_lock);
+    refresh_priority(thr);
+    charge_task(thr->parent_task);
+    se = &thr->parent_task->sched[thr->priority];
+    if (++se->ticks_used >= SCHED_QUANTUM(thr->priority)) {
+        if (thr->priority < SCHED_LEVELS - 1) {
+            use_up_level(thr->parent_task, thr->priority);
+            refresh_priority(thr);
+        } else {
+            se->ticks_used = 0;
+        }
+        preempt = 1;
+    } else {
+        /* Only a thread of higher priority may cut the quantum short */
+        preempt = (runq_bitmap & ((1u << thr->priority) - 1)) != 0;
+    }
+    ticket_unlock(&runq_lock);
+    return preempt;
+}
+
+/** @brief set the priority of a thread
+ *
+ *  @param thr the thread
+ *  @param priority the new priority, 0 being the highest
+ *  @return int 0 on success, ERR_INVAL if the priority does not exist
+ */
+int sched_set_priority(thread_struct_t *thr, int priority) {
+    int int_flag;
+
+    if (priority < 0 || priority >= SCHED_LEVELS) {
+        return ERR_INVAL;
+    }
+    int_flag = ticket_lock_irqsave(&runq_lock);
+    thr->base_priority = priority;
+    thr->priority = priority;
+    if (thr->on_runq) {
+        runq_dequeue(thr);
+        runq_enqueue(thr);
+    }
+    ticket_unlock_irqrestore(&runq_lock, int_flag);
+    return 0;
+}
+
+/** @brief set the weight of a task
+ *
+ *  The task gets a share of the CPU proportional to its weight, among
+ *  the tasks with threads runnable at the same priority.
+ *
+ *  @param t the task
+ *  @param weight the new weight
+ *  @return int 0 on success, ERR_INVAL if the weight is out of range
+ */
+int sched_set_weight(task_struct_t *t, int weight) {
+    int int_flag;
+
+    if (weight <= 0 || weight > SCHED_WEIGHT_MAX) {
+        return ERR_INVAL;
+    }
+    /* charge_task() reads the weight under runq_lock */
+    int_flag = ticket_lock_irqsave(&runq_lock);
+    t->weight = weight;
+    ticket_unlock_irqrestore(&runq_lock, int_flag);
+    return 0;
 }
 
 /** @brief return the next thread to be run
  *
  *  Implements a round robin scheduling strategy. Returns the next thread
  *  to be run. This will be invoked by context switching code ONLY.
+ *  Sleeping threads are put back on the run queue by their timers.
  *
  *  @return thread_struct_t a struct containing scheduling information 
  *                          for the next thread
  */
 thread_struct_t *next_thread() {
-    /* See if any sleeping thread can be woken up */
-    thread_struct_t *sleeping_thread = get_sleeping_thread();
-    if (sleeping_thread != NULL) {
-        return sleeping_thread;
-    }
-
     /* Get the thread at the head of the runqueue */
     thread_struct_t *head = runq_get_head();
     if (head == NULL) {
@@ -52,33 +225,43 @@ thread_struct_t *next_thread() {
     return head;
 }
 
-/** @brief Function to get the first thread present in the runnable queue.
+/** @brief Function to get the first thread present in the runnable queue
+ *         of the highest priority.
  *
  *  @return thread_struct_t * Pointer to the thread struct.
  */
 thread_struct_t *runq_get_head() {
-    list_head *head = get_first(&runnable_threads);
-    if (head == NULL) {
+    ticket_lock(&runq_lock);
+    if (runq_bitmap == 0) {
+        ticket_unlock(&runq_lock);
         return NULL;
     }
+    rb_node *node = rb_first(&run_queues[__builtin_ctz(runq_bitmap)]);
+    task_struct_t *t = get_entry(node, sched_entity_t, node)->task;
+    list_head *head = get_first(&get_entry(node, sched_entity_t,
+                                           node)->threads);
     thread_struct_t *head_thread = get_entry(head, thread_struct_t, runq_link);
-    del_entry(head);
+    if ((int)(t->vruntime - min_vruntime) > 0) {
+        min_vruntime = t->vruntime;
+    }
+    runq_dequeue(head_thread);
+    ticket_unlock(&runq_lock);
     return head_thread;
 }
 
 /** @brief Function to add a particular thread to the runnable queue.
  *
- *  This function disable interrupts when adding the thread to the queue
- *  to maintain the data structure consistency.
+ *  This function disables interrupts while it holds runq_lock, and
+ *  enables them again if they were enabled.
  *
  *  @param thr The thread struct that must be added to the runnable queue
  *
  *  @return void
  */
 void runq_add_thread(thread_struct_t *thr) {
-    disable_interrupts();
-    add_to_tail(&thr->runq_link, &runnable_threads);
-    enable_interrupts();
+    int int_flag = ticket_lock_irqsave(&runq_lock);
+    runq_enqueue(thr);
+    ticket_unlock_irqrestore(&runq_lock, int_flag);
 }
 
 /** @brief Function to add a particular thread to the runnable queue.
@@ -91,7 +274,9 @@ void runq_add_thread(thread_struct_t *thr) {
  *  @return void
  */
 void runq_add_thread_interruptible(thread_struct_t *thr) {
-    add_to_tail(&thr->runq_link, &runnable_threads);
+    ticket_lock(&runq_lock);
+    runq_enqueue(thr);
+    ticket_unlock(&runq_lock);
 }
 
 /** @brief get the currently running thread
@@ -128,12 +313,236 @@ void set_running_thread(thread_struct_t *thr) {
  *  @return void
  */
 void print_runnable_list() {
-	list_head *temp = get_first(&runnable_threads);
+	int i;
+	int int_flag = ticket_lock_irqsave(&runq_lock);
 	lprintf("-------Beginning of runnable threads--------");
-	while(temp != NULL && temp != &runnable_threads) {
-		thread_struct_t *thr = get_entry(temp, thread_struct_t, runq_link);
-		lprintf("-------Thread %d-------", thr->id);
-		temp = temp->next;
+	for(i = 0; i < SCHED_LEVELS; i++) {
+		rb_node *node;
+		for(node = rb_first(&run_queues[i]); node != NULL;
+		    node = rb_next(node)) {
+			sched_entity_t *se = get_entry(node, sched_entity_t, node);
+			list_head *temp = get_first(&se->threads);
+			lprintf("-------Task %d, vruntime %u, weight %d-------",
+			        se->task->id, se->task->vruntime, se->task->weight);
+			while(temp != NULL && temp != &se->threads) {
+				thread_struct_t *thr = get_entry(temp, thread_struct_t, 
+				                                 runq_link);
+				lprintf("-------Thread %d, priority %d-------", thr->id, i);
+				temp = temp->next;
+			}
+		}
 	}
 	lprintf("--------End of runnable threads-------");
+	lock_print_stats("run queue", &runq_lock.stats);
+	ticket_unlock_irqrestore(&runq_lock, int_flag);
+}
+
+/* --------------- Static local functions ----------------*/
+
+/** @brief add a thread behind the other runnable threads of its task at
+ *         its priority
+ *
+ *  The task is put in the queue of the priority if it was not there.
+ *  A task with no thread queued at all is brought up to min_vruntime
+ *  first.
+ *
+ *  @pre interrupts are disabled
+ *  @param thr the thread
+ *  @return void
+ */
+void runq_enqueue(thread_struct_t *thr) {
+    task_struct_t *t = thr->parent_task;
+    sched_entity_t *se;
+
+    refresh_priority(thr);
+    se = &t->sched[thr->priority];
+    if (get_first(&se->threads) == NULL) {
+        if (t->runq_levels == 0 && (int)(t->vruntime - min_vruntime) < 0) {
+            t->vruntime = min_vruntime;
+        }
+        entity_insert(se, thr->priority);
+    }
+    add_to_tail(&thr->runq_link, &se->threads);
+    thr->on_runq = 1;
+}
+
+/** @brief take a thread off its run queue
+ *
+ *  @pre interrupts are disabled, the thread is on a run queue
+ *  @param thr the thread
+ *  @return void
+ */
+void runq_dequeue(thread_struct_t *thr) {
+    sched_entity_t *se = &thr->parent_task->sched[thr->priority];
+
+    del_entry(&thr->runq_link);
+    if (get_first(&se->threads) == NULL) {
+        entity_erase(se, thr->priority);
+    }
+    thr->on_runq = 0;
+}
+
+/** @brief put a task in the queue of a priority
+ *
+ *  Tasks with the same virtual runtime are run in the order they were
+ *  queued.
+ *
+ *  @pre interrupts are disabled, the task is not in that queue
+ *  @param se the entity of the task at the priority
+ *  @param level the priority
+ *  @return void
+ */
+void entity_insert(sched_entity_t *se, int level) {
+    rb_node **link = &run_queues[level].node, *parent = NULL;
+
+    while (*link != NULL) {
+        task_struct_t *other;
+        parent = *link;
+        other = get_entry(parent, sched_entity_t, node)->task;
+        if ((int)(se->task->vruntime - other->vruntime) < 0) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+        }
+    }
+    rb_link_node(&se->node, parent, link);
+    rb_insert_color(&se->node, &run_queues[level]);
+    se->task->runq_levels |= 1u << level;
+    runq_bitmap |= 1u << level;
+}
+
+/** @brief take a task out of the queue of a priority
+ *
+ *  @pre interrupts are disabled, the task is in that queue
+ *  @param se the entity of the task at the priority
+ *  @param level the priority
+ *  @return void
+ */
+void entity_erase(sched_entity_t *se, int level) {
+    rb_erase(&se->node, &run_queues[level]);
+    se->task->runq_levels &= ~(1u << level);
+    if (run_queues[level].node == NULL) {
+        runq_bitmap &= ~(1u << level);
+    }
+}
+
+/** @brief account a tick run by a thread of a task
+ *
+ *  The task is taken out of the queues it is in while its virtual
+ *  runtime changes, and put back at its new place.
+ *
+ *  @pre interrupts are disabled
+ *  @param t the task
+ *  @return void
+ */
+void charge_task(task_struct_t *t) {
+    unsigned int levels = t->runq_levels;
+    int level;
+
+    for (level = 0; level < SCHED_LEVELS; level++) {
+        if (levels & (1u << level)) {
+            entity_erase(&t->sched[level], level);
+        }
+    }
+    t->cpu_ticks++;
+    t->vruntime += SCHED_WEIGHT_DEFAULT * SCHED_WEIGHT_DEFAULT / t->weight;
+    for (level = 0; level < SCHED_LEVELS; level++) {
+        if (levels & (1u << level)) {
+            entity_insert(&t->sched[level], level);
+        }
+    }
+}
+
+/** @brief apply the boosts a thread and its task missed, and move the
+ *         thread below the priorities whose quantum its task used up
+ *
+ *  @pre runq_lock is held, the thread is not queued
+ *  @param thr the thread
+ *  @return void
+ */
+void refresh_priority(thread_struct_t *thr) {
+    task_struct_t *t = thr->parent_task;
+    int i;
+
+    if (t->boost_epoch != boost_epoch) {
+        t->boost_epoch = boost_epoch;
+        t->used_levels = 0;
+        for (i = 0; i < SCHED_LEVELS; i++) {
+            t->sched[i].ticks_used = 0;
+        }
+    }
+    if (thr->boost_epoch != boost_epoch) {
+        thr->boost_epoch = boost_epoch;
+        thr->priority = thr->base_priority;
+    }
+    while (thr->priority < SCHED_LEVELS - 1
+           && (t->used_levels & (1u << thr->priority))) {
+        thr->priority++;
+    }
+}
+
+/** @brief move the threads of a task down from a priority whose quantum
+ *         the task used up
+ *
+ *  The threads queued at the priority are moved right away. The others
+ *  are moved by refresh_priority() when they are queued or run next.
+ *
+ *  @pre runq_lock is held
+ *  @param t the task
+ *  @param level the priority, not the lowest one
+ *  @return void
+ */
+void use_up_level(task_struct_t *t, int level) {
+    sched_entity_t *se = &t->sched[level];
+    list_head demoted, *entry;
+
+    t->used_levels |= 1u << level;
+    if (!(t->runq_levels & (1u << level))) {
+        return;
+    }
+    init_head(&demoted);
+    while ((entry = get_first(&se->threads)) != NULL) {
+        del_entry(entry);
+        add_to_tail(entry, &demoted);
+    }
+    entity_erase(se, level);
+    while ((entry = get_first(&demoted)) != NULL) {
+        del_entry(entry);
+        runq_enqueue(get_entry(entry, thread_struct_t, runq_link));
+    }
+}
+
+/** @brief move every thread back to the priority set for it
+ *
+ *  Called from the timer interrupt every SCHED_BOOST_TICKS ticks.
+ *  Threads which are not queued get theirs back the next time they
+ *  are queued or run.
+ *
+ *  @param arg unused
+ *  @return void
+ */
+void boost_priorities(void *arg) {
+    list_head demoted, *entry;
+    rb_node *node;
+    int i;
+
+    ticket_lock(&runq_lock);
+    boost_epoch++;
+    init_head(&demoted);
+    for (i = 1; i < SCHED_LEVELS; i++) {
+        while ((node = rb_first(&run_queues[i])) != NULL) {
+            sched_entity_t *se = get_entry(node, sched_entity_t, node);
+            while ((entry = get_first(&se->threads)) != NULL) {
+                del_entry(entry);
+                add_to_tail(entry, &demoted);
+            }
+            entity_erase(se, i);
+        }
+    }
+    while ((entry = get_first(&demoted)) != NULL) {
+        del_entry(entry);
+        runq_enqueue(get_entry(entry, thread_struct_t, runq_link));
+    }
+    ticket_unlock(&runq_lock);
+    ktimer_add(&boost_timer, SCHED_BOOST_TICKS);
 }
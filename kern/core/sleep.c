@@ -1,7 +1,22 @@
 /** @file sleep.c
  *
  *  File which implements the functions required for sleep
- *  system call.
+ *  system call, and the kernel timers sleeping threads are woken up by.
+ *
+ *  Timers are kept in a hierarchical timing wheel. The first level has
+ *  a slot for each of the next WHEEL_SIZE ticks. A slot of the next
+ *  level covers a whole turn of the level below it, and so on. Adding
+ *  or cancelling a timer only links it in or out of a slot. On every
+ *  tick the timers in the slot of that tick are run, and each time a
+ *  level comes round, the slot of the next level up is emptied into the
+ *  level below. A timer is moved at most once per level, so the cost of
+ *  a timer is constant however many others there are, and every thread
+ *  whose sleep is over is woken up on the very tick it ends.
+ *
+ *  The wheel is protected by wheel_lock, held with interrupts disabled.
+ *  It is dropped while a timer function runs, since waking a thread
+ *  takes the run queue lock, which is held when a timer is added by the
+ *  scheduler.
  *
  *  @author Rohit Upadhyaya (rjupadhy)
  *  @author Prajwal Yadapadithaya (pyadapad)
@@ -15,23 +30,40 @@
 #include <drivers/timer/timer.h>
 #include <core/context.h>
 #include <core/thread.h>
-#include <sync/mutex.h> 
+#include <core/ktimer.h>
+#include <sync/spinlock.h>
 #include <asm.h>
-#include <common/malloc_wrappers.h>
+#include <eflags.h>
+
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)    /* Slots in a level of the wheel */
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4                  /* Timers up to 2^24 ticks ahead */
+#define WHEEL_SHIFT(level) ((level) * WHEEL_BITS)
+#define WHEEL_INDEX(time, level) (((time) >> WHEEL_SHIFT(level)) & WHEEL_MASK)
+#define WHEEL_SPAN (1u << WHEEL_SHIFT(WHEEL_LEVELS))
 
-static list_head *sleeping_threads;    /* List of threads that are 'sleep'ing */
+static list_head wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static unsigned int wheel_time;     /* Next tick whose timers are run */
+static spinlock_t wheel_lock;       /* Protects the wheel */
 
-static mutex_t sleep_list_mutex;
+static void add_to_wheel(ktimer_t *timer);
+static int cascade(int level);
+static void wake_sleeper(void *arg);
 
-/** @brief Function to initialize the list of sleeping threads
+/** @brief Function to initialize the timing wheel
  *
  *  @return void
  */
-void init_sleeping_threads() {
-    mutex_init(&sleep_list_mutex);
-    sleeping_threads = (list_head *)smalloc(sizeof(list_head));
-    kernel_assert(sleeping_threads != NULL);
-    init_head(sleeping_threads);
+void init_timer_wheel() {
+    int level, slot;
+    for (level = 0; level < WHEEL_LEVELS; level++) {
+        for (slot = 0; slot < WHEEL_SIZE; slot++) {
+            init_head(&wheel[level][slot]);
+        }
+    }
+    wheel_time = total_ticks();
+    spin_init(&wheel_lock);
 }
 
 /** @brief The entry point for sleep
@@ -52,41 +84,10 @@ int do_sleep(int ticks) {
 
 }
 
-/** @brief return next sleeping thread ready to be woken if any
- *
- *  Check if the first sleeping thread is ready to be woken up (based on
- *  the current ticks and the first thread's wake time). If any thread is
- *  to be woken up, return that. Else return NULL.
- *
- *  @return thread_struct_t NULL if no thread existing or ready to be woken up
- */
-thread_struct_t *get_sleeping_thread() {
-    /* Check if any sleeping thread can be woken up */
-    if (sleeping_threads != NULL) {
-        list_head *thr_entry = get_first(sleeping_threads);
-        if (thr_entry != NULL) {
-            int curr_ticks = total_ticks();
-            thread_struct_t *thr = get_entry(thr_entry, thread_struct_t, 
-                                             sleepq_link);
-            if (thr->wake_time < curr_ticks) {
-                del_entry(&thr->sleepq_link);
-                return thr;
-            }
-        }
-    }
-    return NULL;
-}
-
-
 /** @brief schedule a thread for sleeping
  *
- *  calculate the time at which the current thread will be woken up given
- *  the number of ticks that the thread has to sleep. Then obtain a lock 
- *  on the sleeping thread queue, temporarily set the sleeping thread head to 
- *  NULL (so that the scheduler can run in parallel and not interfere with 
- *  the code to maintain the list in sorted order). Then we find the right 
- *  position for this thread based on the time it has to wake up, with the 
- *  head of the queue being the earliest wake time.
+ *  A timer of the thread puts it back on the run queue once the given
+ *  number of ticks has gone by, on the tick after the last one.
  *
  *  @param ticks number of ticks to sleep for
  *  @return void
@@ -100,29 +101,166 @@ void schedule_sleep(int ticks) {
 		return;
 	}
 
-    thr->wake_time = curr_ticks + ticks;
+    ktimer_init(&thr->sleep_timer, wake_sleeper, thr);
+    disable_interrupts();
+    ktimer_add(&thr->sleep_timer, ticks + 1);
+    thr->status = WAITING;
+    context_switch();
+}
+
+/** @brief set up a timer
+ *
+ *  @param timer the timer
+ *  @param fn the function the timer calls
+ *  @param arg the argument fn is called with
+ *  @return void
+ */
+void ktimer_init(ktimer_t *timer, void (*fn)(void *), void *arg) {
+    timer->pending = 0;
+    timer->fn = fn;
+    timer->arg = arg;
+}
 
-    mutex_lock(&sleep_list_mutex);
-    list_head *temp_head = sleeping_threads;
-    sleeping_threads = NULL;
-    list_head *entry = get_first(temp_head);
-    while (entry != NULL && entry != temp_head) {
-        thread_struct_t *thread = get_entry(entry, thread_struct_t, 
-                                            sleepq_link);
-        if (thread->wake_time > thr->wake_time) {
-            break;
+/** @brief have a timer go off after a number of ticks
+ *
+ *  A timer already pending is moved to the new tick.
+ *
+ *  @param timer the timer
+ *  @param ticks the number of timer interrupts to let go by, the
+ *         function is called from the last one. With 0, it is called
+ *         from the next one.
+ *  @return void
+ */
+void ktimer_add(ktimer_t *timer, unsigned int ticks) {
+    int int_flag = spin_lock_irqsave(&wheel_lock);
+
+    if (timer->pending) {
+        del_entry(&timer->link);
+    }
+    timer->expires = total_ticks() + ticks;
+    timer->pending = 1;
+    add_to_wheel(timer);
+    spin_unlock_irqrestore(&wheel_lock, int_flag);
+}
+
+/** @brief stop a timer from going off
+ *
+ *  @param timer the timer
+ *  @return int 1 if the timer was pending, 0 if it already went off or
+ *          was never added
+ */
+int ktimer_cancel(ktimer_t *timer) {
+    int int_flag = spin_lock_irqsave(&wheel_lock);
+    int was_pending;
+
+    was_pending = timer->pending;
+    if (was_pending) {
+        del_entry(&timer->link);
+        timer->pending = 0;
+    }
+    spin_unlock_irqrestore(&wheel_lock, int_flag);
+    return was_pending;
+}
+
+/** @brief run the timers of every tick up to now
+ *
+ *  Called from the timer interrupt, before the scheduler runs, so that
+ *  the threads woken up are already on the run queue. The timer
+ *  functions are called without wheel_lock, and may add timers again.
+ *
+ *  @pre interrupts are disabled
+ *  @param now the current tick
+ *  @return void
+ */
+void run_timers(unsigned int now) {
+    list_head *entry;
+    ktimer_t *timer;
+    int level;
+
+    spin_lock(&wheel_lock);
+    while ((int)(now - wheel_time) >= 0) {
+        /* A turn of a level is over, bring down the timers of the next
+         * slot of the level above */
+        for (level = 1; level < WHEEL_LEVELS; level++) {
+            if (WHEEL_INDEX(wheel_time, level - 1) != 0
+                || cascade(level) != 0) {
+                break;
+            }
+        }
+
+        list_head *slot = &wheel[0][wheel_time & WHEEL_MASK];
+        while ((entry = get_first(slot)) != NULL) {
+            timer = get_entry(entry, ktimer_t, link);
+            del_entry(entry);
+            timer->pending = 0;
+            spin_unlock(&wheel_lock);
+            timer->fn(timer->arg);
+            spin_lock(&wheel_lock);
         }
-        entry = entry->next;
+        wheel_time++;
     }
-    if (entry == NULL) {
-        add_to_tail(&thr->sleepq_link, temp_head);
+    spin_unlock(&wheel_lock);
+}
+
+/* ---------- Static local functions ----------- */
+
+/** @brief put a timer in the slot of the wheel it belongs to
+ *
+ *  The level is the lowest one whose slots, from the current one on,
+ *  reach the tick of the timer. A timer further away than the whole
+ *  wheel goes in the last slot, and is put back in the right place
+ *  when it comes down from there.
+ *
+ *  @param timer the timer
+ *  @return void
+ */
+void add_to_wheel(ktimer_t *timer) {
+    unsigned int expires = timer->expires;
+    unsigned int delta = expires - wheel_time;
+    int level;
+
+    if ((int)delta < 0) {
+        /* Already due, run it on the next tick */
+        add_to_tail(&timer->link, &wheel[0][wheel_time & WHEEL_MASK]);
+        return;
     }
-    else {
-        add_to_list(&thr->sleepq_link, entry->prev, entry);
+    if (delta >= WHEEL_SPAN) {
+        expires = wheel_time + WHEEL_SPAN - 1;
+        delta = WHEEL_SPAN - 1;
     }
-    mutex_unlock(&sleep_list_mutex);
-    disable_interrupts();
-    sleeping_threads = temp_head;
-    thr->status = WAITING;
-    context_switch();
+    for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+        if (delta < (1u << WHEEL_SHIFT(level + 1))) {
+            break;
+        }
+    }
+    add_to_tail(&timer->link, &wheel[level][WHEEL_INDEX(expires, level)]);
+}
+
+/** @brief move the timers of the current slot of a level to the levels
+ *         below
+ *
+ *  @param level the level, above the first one
+ *  @return int the index of the slot, 0 when the level came round too
+ */
+int cascade(int level) {
+    int index = WHEEL_INDEX(wheel_time, level);
+    list_head *slot = &wheel[level][index];
+    list_head *entry;
+
+    while ((entry = get_first(slot)) != NULL) {
+        del_entry(entry);
+        add_to_wheel(get_entry(entry, ktimer_t, link));
+    }
+    return index;
+}
+
+/** @brief the timer function of a sleeping thread
+ *
+ *  @param arg the thread
+ *  @return void
+ */
+void wake_sleeper(void *arg) {
+    thread_struct_t *thr = arg;
+    thr->status = RUNNABLE;
+    runq_add_thread_interruptible(thr);
 }
@@ -6,16 +6,22 @@
  */
 #include <common/malloc_wrappers.h>
 #include <seg.h>
+#include <asm.h>
 #include <cr.h>
 #include <vm/vm.h>
+#include <vm/region.h>
 #include <simics.h>
 #include <stddef.h>
 #include <eflags.h>
 #include <core/task.h>
+#include <vm/merge.h>
+#include <vm/reaper.h>
+#include <allocator/frame_allocator.h>
 #include <asm/asm.h>
 #include <core/thread.h>
 #include <core/scheduler.h>
 #include <loader/loader.h>
+#include <loader/text_cache.h>
 #include <ureg.h>
 #include <syscall.h>
 #include <string.h>
@@ -34,6 +40,7 @@ static void set_task_stack(void *kernel_stack_base, int entry_addr,
                            void *user_stack_top);
 static void *copy_user_args(int num_args, char **argvec);
 static void init_task_structures(task_struct_t *t);
+static void idle_loop();
 
 
 /** @brief Create a new task
@@ -59,6 +66,7 @@ task_struct_t *create_task(task_struct_t *parent) {
 
     /* Initialize various task data structures */
     init_task_structures(t);
+    sched_init_task(t, parent);
 
     thread_struct_t *thr = create_thread(t);
 	if(thr == NULL) {
@@ -67,6 +75,9 @@ task_struct_t *create_task(task_struct_t *parent) {
 	}
 	t->thr = thr;
 	t->id = thr->id;
+
+    /* Identical pages of the task get merged once it has some */
+    merge_add_task(t);
     return t;
 }
 
@@ -94,6 +105,11 @@ void init_task_structures(task_struct_t *t) {
     t->eip = NULL;
     t->swexn_args = NULL;
 
+    /* The address space is empty until a program gets loaded */
+    t->pdbr = NULL;
+    region_tree_init(&t->regions);
+    mutex_init(&t->region_mutex);
+
 	mutex_init(&t->fork_mutex);
 	mutex_init(&t->exec_mutex);
 
@@ -122,17 +138,17 @@ void load_init_task(char *prog_name) {
     runq_add_thread_interruptible(t->thr);
 }
 
-/** @brief start a bootstrap task
+/** @brief start the idle task
  *
- *  This process is started in a special way since it is one of
- *  the first processes to run on the system. We use an IRET
- *  to get to running this task.
+ *  The idle task has no program of its own. Its only thread runs
+ *  idle_loop() in kernel mode, on its own kernel stack, which is
+ *  switched to here. The boot stack is left behind for good.
  *
- *  @return void
+ *  @return Does not return
  */
-void load_bootstrap_task(char *prog_name) {
+void run_idle_task() {
+    uint32_t *esp;
 
-    int retval;
     /* ask vm to give us a zero filled frame for the page directory */
     void *pd_addr = create_page_directory();
 
@@ -147,34 +163,25 @@ void load_bootstrap_task(char *prog_name) {
     kernel_assert(t != NULL);
     t->pdbr = pd_addr;
 
-    /* Read the idle task header to set up VM */
-	simple_elf_t se_hdr;
-
-    elf_load_helper(&se_hdr, prog_name);
-    
-    /* Invoke VM to setup the page directory/page table for a given binary */
-    retval = setup_page_table(&se_hdr, pd_addr);
-    kernel_assert(retval == 0);
-
-    /* Copy program into memory */
-    retval = load_program(&se_hdr);
-    kernel_assert(retval == 0);
-
 	set_running_thread(t->thr);
 	t->thr->status = RUNNING;
     set_esp0(t->thr->k_stack_base);
 
-	uint32_t EFLAGS = setup_user_eflags();
-	unsigned long entry = se_hdr.e_entry;
-	
 	idle_task = t;
 
 	enable_mutex_lib(); /* We need to enable mutex library */
 
-	call_iret(EFLAGS, entry);
+    /* Return into idle_loop() on the kernel stack of the thread */
+    esp = (uint32_t *)t->thr->k_stack_base;
+    *--esp = 0;
+    *--esp = (uint32_t)idle_loop;
+    update_stack_single((uint32_t)esp, t->thr->k_stack_base);
 }
 
 /** @brief Function to load a program into a given task.
+ *
+ *  A task without an address space gets a new page directory. A task
+ *  which has one already, emptied by reset_paging_info(), keeps it.
  *
  *  @param prog_name Name of the program to be loaded
  *  @param num_args Number of arguments to the program
@@ -188,24 +195,33 @@ int load_task(char *prog_name, int num_args, char **argvec,
                task_struct_t *t) {
 
 	int retval;
-    /* ask vm to give us a zero filled frame for the page directory */
-    void *pd_addr = create_page_directory();
+    void *pd_addr = t->pdbr;
     if (pd_addr == NULL) {
-        return ERR_NOMEM;
-    }
+        /* ask vm to give us a zero filled frame for the page directory */
+        pd_addr = create_page_directory();
+        if (pd_addr == NULL) {
+            return ERR_NOMEM;
+        }
 
-    /* Paging enabled! */
-	set_cur_pd(pd_addr);
+        /* Paging enabled! */
+        set_cur_pd(pd_addr);
 
-    t->pdbr = pd_addr;
+        t->pdbr = pd_addr;
+    }
 
     /* Read the idle task header to set up VM */
 	simple_elf_t se_hdr;
 
     elf_load_helper(&se_hdr, prog_name);
+
+    /* Map the text and rodata pages shared with other tasks */
+    retval = text_cache_map(&se_hdr, pd_addr);
+    if (retval < 0) {
+        return retval;
+    }
     
     /* Invoke VM to setup the page directory/page table for a given binary */
-    retval = setup_page_table(&se_hdr, pd_addr);
+    retval = setup_page_table(&se_hdr, pd_addr, &t->regions);
     if (retval < 0) {
         return retval;
     }
@@ -229,6 +245,24 @@ int load_task(char *prog_name, int num_args, char **argvec,
     return 0;
 }
 
+/** @brief Function to get the number of bytes copy_user_args() puts
+ *  on the user stack
+ *
+ *  @param num_args Number of arguments to the program
+ *  @param argvec Character array of the argument vector
+ *
+ *  @return unsigned int the number of bytes
+ */
+unsigned int user_args_size(int num_args, char **argvec) {
+    unsigned int size = 1 + (num_args + 1) * sizeof(char *)
+                        + 5 * sizeof(int *);
+    int i;
+    for (i = 0; i < num_args; i++) {
+        size += strlen(argvec[i]) + 1;
+    }
+    return size;
+}
+
 /* ------------ Static local functions --------------*/
 
 /** @brief Function to hand create the stack for a new task to
@@ -299,6 +333,26 @@ void *copy_user_args(int num_args, char **argvec) {
     return user_stack_top;
 }
 
+/** @brief what the idle thread runs
+ *
+ *  Frames are zeroed ahead of time, identical pages merged and the
+ *  address spaces of dead tasks freed, a bounded amount each time
+ *  round, then the processor halts until the next interrupt. The loop
+ *  runs with interrupts enabled, so a timer tick switches away from
+ *  it as soon as any other thread is runnable.
+ *
+ *  @return Does not return
+ */
+void idle_loop() {
+    enable_interrupts();
+    while (1) {
+        refill_zero_pool();
+        merge_pages_idle();
+        reap_pages_idle();
+        wait_for_interrupt();
+    }
+}
+
 /** @brief set user EFLAGS 
  *
  *  The EFLAGS for user have interrupts enabled (IF), IOPL set to 3
@@ -9,6 +9,7 @@
 #include <loader/loader.h>
 #include <core/thread.h>
 #include <sync/mutex.h>
+#include <sync/spinlock.h>
 #include <cr.h>
 #include <seg.h>
 #include <syscall.h>
@@ -22,7 +23,7 @@
 
 static int next_tid;
 static mutex_t mutex;
-static mutex_t map_mutex;
+static spinlock_t map_lock;     /* Protects thread_map */
 static list_head thread_map[HASHMAP_SIZE];
 
 static void init_thread_map();
@@ -36,6 +37,7 @@ void kernel_threads_init() {
     next_tid = 0;
     mutex_init(&mutex);
     init_thread_map();
+    kstack_init();
 }
 
 /** @brief create a new thread.
@@ -55,6 +57,11 @@ thread_struct_t *create_thread(task_struct_t *task) {
     if(thr == NULL) {
         return NULL;
     }
+	thr->k_stack = kstack_alloc();
+	if(thr->k_stack == NULL) {
+		sfree(thr, sizeof(thread_struct_t));
+		return NULL;
+	}
 
     /* Assign thread id to thread and add it to task's thread list*/
     mutex_lock(&mutex);
@@ -74,6 +81,7 @@ thread_struct_t *create_thread(task_struct_t *task) {
 	thr->cur_esp = thr->k_stack_base;
 	thr->cur_ebp = thr->k_stack_base;
 	thr->status = RUNNABLE; /* Default value */
+	sched_init_thread(thr);
     return thr;
 }
 
@@ -93,7 +101,7 @@ void init_thread_map() {
     for (i = 0; i < HASHMAP_SIZE; i++) {
         init_head(&thread_map[i]);
     }
-    mutex_init(&map_mutex);
+    spin_init(&map_lock);
 }
 
 /** @brief add a thread to the hashmap
@@ -106,9 +114,9 @@ void init_thread_map() {
  */
 void add_thread_to_map(thread_struct_t *thr) {
     int index = thr->id % HASHMAP_SIZE;
-    mutex_lock(&map_mutex);
+    int int_flag = spin_lock_irqsave(&map_lock);
     add_to_tail(&thr->thread_map_link, &thread_map[index]);
-    mutex_unlock(&map_mutex);
+    spin_unlock_irqrestore(&map_lock, int_flag);
 }
 
 /** @brief return thread struct for a given thread id
@@ -120,18 +128,18 @@ void add_thread_to_map(thread_struct_t *thr) {
 thread_struct_t *get_thread_from_id(int thr_id) {
     int index = thr_id % HASHMAP_SIZE;
     list_head *bucket_head = &thread_map[index];
-    mutex_lock(&map_mutex);
+    int int_flag = spin_lock_irqsave(&map_lock);
     list_head *thr_node = get_first(bucket_head);
 	while(thr_node != NULL && thr_node != bucket_head) {
         thread_struct_t *thr = get_entry(thr_node, thread_struct_t, 
                                           thread_map_link);
         if (thr->id == thr_id) {
-            mutex_unlock(&map_mutex);
+            spin_unlock_irqrestore(&map_lock, int_flag);
             return thr;
         }
 		thr_node = thr_node->next;
 	}
-    mutex_unlock(&map_mutex);
+    spin_unlock_irqrestore(&map_lock, int_flag);
     return NULL;
 }
 
@@ -143,17 +151,17 @@ thread_struct_t *get_thread_from_id(int thr_id) {
 void remove_thread_from_map(int thr_id) {
     int index = thr_id % HASHMAP_SIZE;
     list_head *bucket_head = &thread_map[index];
-    mutex_lock(&map_mutex);
+    int int_flag = spin_lock_irqsave(&map_lock);
     list_head *thr_node = get_first(bucket_head);
 	while(thr_node != NULL && thr_node != bucket_head) {
         thread_struct_t *thr = get_entry(thr_node, thread_struct_t, 
                                           thread_map_link);
         if (thr->id == thr_id) {
             del_entry(thr_node);
-            mutex_unlock(&map_mutex);
+            spin_unlock_irqrestore(&map_lock, int_flag);
             return;
         }
 		thr_node = thr_node->next;
 	}
-    mutex_unlock(&map_mutex);
+    spin_unlock_irqrestore(&map_lock, int_flag);
 }
@@ -15,6 +15,10 @@
 #include <common/malloc_wrappers.h>
 #include <asm/asm.h>
 #include <vm/vm.h>
+#include <vm/region.h>
+#include <vm/merge.h>
+#include <vm/reaper.h>
+#include <vm/uaccess.h>
 #include <simics.h>
 #include <ureg.h>
 #include <syscalls/syscall_util.h>
@@ -39,9 +43,11 @@ static void reparent_to_init(list_head *task_list, int task_type,
 int do_wait(void *arg_packet) {
 
     int *status_ptr = (int *)arg_packet;
-    if (status_ptr != NULL && 
-			((is_pointer_valid(status_ptr, sizeof(int *)) < 0)
-        		|| (is_memory_writable(status_ptr, sizeof(int *)) < 0))) {
+    int status;
+
+    /* Find out if status_ptr is writable before a child gets reaped */
+    if (status_ptr != NULL
+        && check_user_writable(status_ptr, sizeof(int)) < 0) {
         return ERR_INVAL;
     }
     
@@ -70,7 +76,10 @@ int do_wait(void *arg_packet) {
                                              dead_child_link);
         int dead_task_id = dead_task->id;
         if (status_ptr != NULL) {
-            *status_ptr = dead_task->exit_status;
+            status = dead_task->exit_status;
+            if (copy_to_user(status_ptr, &status, sizeof(int)) < 0) {
+                dead_task_id = ERR_INVAL;
+            }
         }
 	
 		/* Free task resources */
@@ -120,10 +129,18 @@ void do_vanish() {
         mutex_unlock(&curr_task->vanish_mutex);
         enable_interrupts();
 		
+		/* The merging scan must be done with the address space before
+		 * it goes away */
+		merge_remove_task(curr_task);
 		void *curr_pdbr = curr_task->pdbr;
 		curr_task->pdbr = get_kernel_pd();
         set_kernel_pd();
-       	free_paging_info(curr_pdbr);
+		/* The address space is freed in the background, unless the
+		 * reaper cannot take it */
+		if(reap_address_space(curr_pdbr, &curr_task->regions) < 0) {
+			free_paging_info(curr_pdbr, &curr_task->regions);
+			region_tree_destroy(&curr_task->regions);
+		}
 
 		disable_interrupts(); /* Ensuring that only I run after signaling the parent */
 	    task_struct_t *parent_task = curr_task->parent;	
@@ -172,6 +189,7 @@ void remove_thread_from_task(thread_struct_t *thr) {
 void thread_free_resources(thread_struct_t *thr) {
 	mutex_destroy(&thr->deschedule_mutex);
 	cond_destroy(&thr->deschedule_cond_var);
+	kstack_free(thr->k_stack);
 	sfree(thr, sizeof(thread_struct_t));
 }
 
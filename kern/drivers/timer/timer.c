@@ -14,6 +14,7 @@
 #include <interrupts/idt_entry.h>
 #include <interrupts/interrupt_handlers.h>
 #include <drivers/timer/timer_handler.h>
+#include <core/ktimer.h>
 
 #define INT_FREQ 10
 #define MILLISECONDS 1000
@@ -62,7 +63,9 @@ int install_timer_handler() {
 /** @brief called by interrupt to do any processing needed
  *
  *  This function increments a variable keeping count of the number of
- *  ticks so far and calls the callback function with this variable. We
+ *  ticks so far, runs the kernel timers due by then, which puts threads
+ *  done sleeping back on the run queue, and calls the callback function
+ *  with this variable. We
  *  acknowledge interrupts immediately since the timer interrupt is an
  *  interrupt gate and we iret from a different in case of fork and the
  *  initial task
@@ -72,6 +75,7 @@ int install_timer_handler() {
 void callback_handler() {
     acknowledge_interrupt();
     tick_counter++;
+    run_timers(tick_counter);
     callback(tick_counter);
     return;
 }
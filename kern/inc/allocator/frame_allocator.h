@@ -10,16 +10,73 @@
 #define FREE_FRAMES_COUNT ((machine_phys_frames())-(USER_MEM_START / PAGE_SIZE))
 #define FRAME_INDEX(addr) ((((unsigned int)addr)-(USER_MEM_START))/(PAGE_SIZE))
 
+#define MAX_FRAME_ORDER 10  /* Largest contiguous run is 2^10 frames (4 MB) */
+
+/* Pages whose addresses differ by a multiple of PAGE_COLORS pages share
+ * the same sets in a physically indexed cache. 64 colors cover a cache
+ * way of 256 KB, e.g. a 2 MB 8 way L2. */
+#define PAGE_COLOR_ORDER 6
+#define PAGE_COLORS (1 << PAGE_COLOR_ORDER)
+#define PAGE_COLOR(addr) ((((unsigned int)(addr)) / PAGE_SIZE) \
+                          & (PAGE_COLORS - 1))
+
+#define FRAME_FREE 1    /* The frame is not allocated */
+#define FRAME_BUDDY 2   /* The frame heads a block in the buddy free lists */
+
+/** @brief the metadata kept for every physical frame
+ *
+ *  The flags have a word of their own, since FRAME_FREE is set and
+ *  cleared without list_lock by whoever holds the frame. The list
+ *  links and the order are only touched under list_lock. FRAME_BUDDY
+ *  is only changed under list_lock too, while the frame is on the free
+ *  lists and nobody holds it, so the two flags never change at once.
+ */
+typedef struct frame_info {
+    volatile int ref_count;     /* Number of mappings of the frame */
+    unsigned int flags;         /* FRAME_* flags */
+    unsigned int next : 24;     /* Index of the next block in the free list */
+    unsigned int order : 8;     /* Order of the free block this frame heads */
+    unsigned int prev;          /* Index of the previous block in the list */
+} frame_info_t;
+
 void init_frame_allocator();
 
 void *allocate_frame();
 
+void *allocate_zeroed_frame();
+
 void deallocate_frame(void *frame_addr);
 
+int allocate_frames(void **frames, int count);
+
+int allocate_zeroed_frames(void **frames, int count);
+
+void refill_zero_pool();
+
+void free_frames(void **frames, int count);
+
+int free_frames_idle(void **frames, int count);
+
+void *allocate_frame_block(int order);
+
+void free_frame_block(void *frame_addr, int order);
+
+int frame_free_blocks(int order);
+
+void set_frame_coloring(int enable);
+
+int frame_coloring_enabled();
+
+void *allocate_colored_frame(void *addr);
+
+void *allocate_colored_zeroed_frame(void *addr);
+
 int check_physical_memory();
 
-void lock_frame(void *frame_addr);
+int frame_ref(void *frame_addr);
+
+int frame_unref(void *frame_addr);
 
-void unlock_frame(void *frame_addr);
+int frame_ref_count(void *frame_addr);
 
 #endif /* __FRAME_ALLOCATOR_H */
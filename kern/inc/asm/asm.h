@@ -117,4 +117,45 @@ void *get_err_instr();
  */
 void invalidate_tlb_page(void *addr);
 
+/** @brief Function to atomically add to a counter
+ *
+ *  @param addr Address of the counter
+ *  @param val Value to be added, can be negative
+ *
+ *  @return The value of the counter after the addition
+ */
+int atomic_add(volatile int *addr, int val);
+
+/** @brief Function to enable interrupts and halt the processor until
+ *  the next one comes in
+ *
+ *  @return void
+ */
+void wait_for_interrupt();
+
+/** @brief Function to atomically swap a new value into a word
+ *
+ *  @param addr Address of the word
+ *  @param val The new value
+ *
+ *  @return The value the word had before
+ */
+int atomic_xchg(volatile int *addr, int val);
+
+/** @brief Function to atomically replace a word if it has a given value
+ *
+ *  @param addr Address of the word
+ *  @param old The value the word must have
+ *  @param val The value to put in it if it does
+ *
+ *  @return The value the word had before, old if it was replaced
+ */
+int atomic_cmpxchg(volatile int *addr, int old, int val);
+
+/** @brief Function to let the processor know the caller is spinning
+ *
+ *  @return void
+ */
+void cpu_relax();
+
 #endif
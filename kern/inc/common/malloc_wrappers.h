@@ -18,5 +18,6 @@ void free(void *buf);
 void *smalloc(size_t size);
 void *smemalign(size_t alignment, size_t size);
 void sfree(void *buf, size_t size);
+int sfree_nowait(void *buf, size_t size);
 
 #endif  /* __MALLOC_WRAPPERS_H */
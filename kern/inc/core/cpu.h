@@ -0,0 +1,25 @@
+/** @file cpu.h
+ *  @brief the processors of the machine
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+#ifndef __CPU_H
+#define __CPU_H
+
+#include <multiboot.h>
+
+/** @brief what the kernel knows about a processor */
+typedef struct cpu {
+    int online;             /* Whether the processor is running the kernel */
+} cpu_t;
+
+void smp_start(mbinfo_t *mbinfo);
+
+int cpu_id();
+
+int cpu_count();
+
+void cpu_print_stats();
+
+#endif  /* __CPU_H */
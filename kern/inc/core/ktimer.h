@@ -0,0 +1,37 @@
+/** @file ktimer.h
+ *
+ *  Kernel timers, which call a function once a number of timer ticks
+ *  have gone by. They are kept in the timing wheel of sleep.c, which
+ *  also wakes up sleeping threads.
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+
+#ifndef __KTIMER_H
+#define __KTIMER_H
+
+#include <list/list.h>
+
+/** @brief a function to be called at some timer tick
+ *
+ *  The function is called from the timer interrupt, with interrupts
+ *  disabled, and must not block.
+ */
+typedef struct ktimer {
+    list_head link;             /* Link in a slot of the timing wheel */
+    unsigned int expires;       /* Tick at which the function is called */
+    int pending;                /* Whether the timer is in the wheel */
+    void (*fn)(void *);         /* The function */
+    void *arg;                  /* Its argument */
+} ktimer_t;
+
+void ktimer_init(ktimer_t *timer, void (*fn)(void *), void *arg);
+
+void ktimer_add(ktimer_t *timer, unsigned int ticks);
+
+int ktimer_cancel(ktimer_t *timer);
+
+void run_timers(unsigned int now);
+
+#endif  /* __KTIMER_H */
@@ -8,10 +8,26 @@
 #define __SCHEDULER_H
 #include <core/thread.h>
 
+#define SCHED_QUANTUM(prio) ((prio) + 1)    /* Ticks before demotion */
+#define SCHED_BOOST_TICKS 100           /* Ticks between priority boosts */
+
+#define SCHED_WEIGHT_DEFAULT 1024       /* Weight of a task at creation */
+#define SCHED_WEIGHT_MAX 65536          /* Largest weight a task can get */
+
 thread_struct_t *next_thread();
 
 void init_scheduler();
 
+void sched_init_task(task_struct_t *t, task_struct_t *parent);
+
+void sched_init_thread(thread_struct_t *thr);
+
+int sched_tick();
+
+int sched_set_priority(thread_struct_t *thr, int priority);
+
+int sched_set_weight(task_struct_t *t, int weight);
+
 thread_struct_t *get_curr_thread();
 
 task_struct_t *get_curr_task();
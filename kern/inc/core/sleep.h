@@ -12,8 +12,6 @@
 
 int do_sleep();
 
-thread_struct_t *get_sleeping_thread();
-
-void init_sleeping_threads();
+void init_timer_wheel();
 
 #endif  /* __SLEEP_H */
@@ -8,6 +8,7 @@
 #define __TASK_H
 
 #include <list/list.h>
+#include <list/rb_tree.h>
 #include <core/task.h>
 #include <sync/cond_var.h>
 #include <sync/mutex.h>
@@ -29,8 +30,18 @@
 #define NUM_ARGS_MAX 16
 #define ARGNAME_MAX 255 
 
+#define SCHED_LEVELS 8                  /* Priorities, 0 is the highest */
 
 struct thread_struct;
+struct task_struct;
+
+/** @brief the runnable threads of a task at one priority */
+typedef struct sched_entity {
+    rb_node node;               /* Node in the tree of tasks at the priority */
+    list_head threads;          /* Runnable threads, first to run first */
+    struct task_struct *task;   /* The task */
+    int ticks_used;             /* Ticks its threads ran at the priority */
+} sched_entity_t;
 
 /** @brief the protection domain comprising a task */
 typedef struct task_struct {
@@ -51,6 +62,11 @@ typedef struct task_struct {
     void *swexn_args;               /* Arguments to the swexn function */
     void *swexn_esp;                /* ESP to run the swexn handler on */
 
+    rb_root regions;                /* Tree of the user memory regions */
+    list_head merge_link;           /* Link in the tasks scanned for merging */
+    /* Mutex to synchronize access to the region tree */
+    mutex_t region_mutex;
+
     /* Cond var for threads of THIS task to wait on child vanish()es */
     cond_t exit_cond_var;           
     /* Mutex to synchronize access to dead and alive child task lists */    
@@ -63,18 +79,29 @@ typedef struct task_struct {
 	/* Used when tasks containing multiple threads call system calls */
 	mutex_t fork_mutex;	/* Semaphore to allow only one fork to run per task */
 	mutex_t exec_mutex; /* Semaphore to allow only one exec to run per task */
+
+    /* Share of the CPU of the task, see scheduler.c */
+    int weight;                     /* Weight set with set_weight() */
+    unsigned int vruntime;          /* Ticks run, scaled down by the weight */
+    unsigned int cpu_ticks;         /* Ticks run by all threads of the task */
+    unsigned int runq_levels;       /* Bit set for each non empty entity */
+    unsigned int used_levels;       /* Bit set for each quantum used up */
+    int boost_epoch;                /* Last priority boost applied */
+    sched_entity_t sched[SCHED_LEVELS];
      
 } task_struct_t;
 
 task_struct_t *create_task(task_struct_t *parent);
 
-void load_bootstrap_task(char *prog_name);
+void run_idle_task();
 
 void load_init_task(char *prog_name);
 
 int load_task(char *prog_name, int num_arg, char **argvec, 
                task_struct_t *t);
 
+unsigned int user_args_size(int num_args, char **argvec);
+
 task_struct_t *get_init_task();
 
 task_struct_t *get_idle_task();
@@ -14,8 +14,9 @@
 #include <syscall.h>
 #include <sync/mutex.h>
 #include <sync/cond_var.h>
+#include <vm/kstack.h>
+#include <core/ktimer.h>
 
-#define KERNEL_STACK_SIZE ((PAGE_SIZE) * 3)
 /* Thread states */
 #define RUNNING 0
 #define RUNNABLE 1
@@ -32,18 +33,21 @@
 typedef struct thread_struct {
     int id;                     /* A unique identifier for a thread */
     task_struct_t *parent_task; /* The parent task for this thread */
-    char k_stack[KERNEL_STACK_SIZE];	/* Kernel stack for the thread */
+    char *k_stack;				/* Lowest address of the kernel stack */
 	uint32_t k_stack_base;		/* Top of the kernel stack for the thread */
 	uint32_t cur_esp;		 	/* Current value of the kernel stack %esp */
 	uint32_t cur_ebp;			/* Current value of the kernel stack %ebp */
 	int status;         	    /* Life state of the thread */
     list_head runq_link;        /* Link structure for the run queue */
-    list_head sleepq_link;      /* Link structure for the sleep queue */
     list_head thread_map_link;  /* Link structure for the hash map */
 	list_head cond_wait_link;	/* Link structure for cond_wait */
 	list_head mutex_link;		/* Link structure for mutex */
     list_head task_thread_link; /* Link structure for list of threads in parent */
-    long wake_time;             /* Time when this thread is to be woken up */
+    ktimer_t sleep_timer;       /* Wakes the thread up when it sleeps */
+    int priority;               /* Run queue the thread goes in */
+    int base_priority;          /* Priority set with set_priority() */
+    int boost_epoch;            /* Last priority boost applied */
+    int on_runq;                /* Whether the thread is in a run queue */
 
     /* Mutex to protect use of the "reject" variable while descheduling */
     mutex_t deschedule_mutex;  
@@ -6,6 +6,17 @@
 
 #ifndef __FAULT_HANDLERS_H
 #define __FAULT_HANDLERS_H
+
+#include <ureg.h>
+
+/** @brief what the swexn handler finds on its stack when it is called */
+typedef struct swexn_frame {
+	unsigned int ret_addr;	/* Fake return address */
+	void *arg;				/* First argument to the handler */
+	ureg_t *ureg_ptr;		/* Second argument, points to ureg below */
+	ureg_t ureg;			/* The registers at the time of the fault */
+} swexn_frame_t;
+
 void tickback(unsigned int ticks);
 
 void divide_error_handler_c();
@@ -21,7 +32,7 @@ void invalid_tss_handler_c();
 void snp_handler_c();
 void ssf_handler_c();
 void gpf_handler_c();
-void page_fault_handler_c();
+void page_fault_handler_c(int err_code, unsigned int *eip);
 void math_fault_handler_c();
 void alignment_check_handler_c();
 void machine_check_handler_c();
@@ -0,0 +1,48 @@
+/** @file rb_tree.h
+ *  @brief an implementation of a red-black tree
+ *
+ *  Like list.h, the tree is intrusive: an rb_node is embedded in the
+ *  struct being stored and get_entry() gets the struct back. The tree
+ *  does not know how nodes are ordered, so the caller walks down from
+ *  the root to find where a new node goes, links it there with
+ *  rb_link_node() and then calls rb_insert_color() to rebalance. This
+ *  is the same split the Linux kernel rbtree uses.
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+
+#ifndef __RB_TREE_H
+#define __RB_TREE_H
+#include <stddef.h>
+
+#define RB_RED 0
+#define RB_BLACK 1
+
+struct rb_node;
+typedef struct rb_node {
+    struct rb_node *parent;
+    struct rb_node *left;
+    struct rb_node *right;
+    int color;
+} rb_node;
+
+typedef struct rb_root {
+    rb_node *node;
+} rb_root;
+
+void rb_init_root(rb_root *root);
+
+void rb_link_node(rb_node *node, rb_node *parent, rb_node **link);
+
+void rb_insert_color(rb_node *node, rb_root *root);
+
+void rb_erase(rb_node *node, rb_root *root);
+
+rb_node *rb_first(rb_root *root);
+
+rb_node *rb_next(rb_node *node);
+
+rb_node *rb_prev(rb_node *node);
+
+#endif  /* __RB_TREE_H */
@@ -12,10 +12,18 @@
 #define PROG_PRESENT_VALID 0
 #define PROG_ABSENT_INVALID 1
 
+void loader_init();
+
 int load_program(simple_elf_t *se_hdr);
 
 int getbytes(const char *filename, int offset, int size, char *buf);
 
+int getbytes_user(const char *filename, int offset, int size, char *buf);
+
 int check_program(const char *prog_name);
 
+int find_program(const char *filename);
+
+const char *file_bytes(const char *filename, int offset, int *size);
+
 #endif /* __LOADER_H */
@@ -0,0 +1,26 @@
+/** @file text_cache.h
+ *  @brief read only pages of programs shared by the tasks running them
+ *
+ *  The pages of a program holding only text and rodata are loaded once
+ *  into frames kept by the cache, and mapped read only into every task
+ *  running the program. Pages which also hold data or bss stay private.
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+#ifndef __TEXT_CACHE_H
+#define __TEXT_CACHE_H
+
+#include <elf_410.h>
+
+void text_cache_init();
+
+int text_cache_map(simple_elf_t *se_hdr, void *pd_addr);
+
+int text_cache_page_shared(simple_elf_t *se_hdr, unsigned long addr);
+
+int text_cache_trim(int count);
+
+void text_cache_print_stats();
+
+#endif /* __TEXT_CACHE_H */
@@ -12,6 +12,7 @@ void enable_mutex_lib();
 int mutex_init( mutex_t *mp );
 void mutex_destroy( mutex_t *mp );
 void mutex_lock( mutex_t *mp );
+int mutex_trylock( mutex_t *mp );
 void mutex_unlock( mutex_t *mp );
 void mutex_lock_int_save( mutex_t *mp );
 void mutex_unlock_int_save( mutex_t *mp );
@@ -0,0 +1,46 @@
+/** @file spinlock.h
+ *  @brief spinlocks and ticket locks for short critical sections
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+
+#ifndef __SPINLOCK_H
+#define __SPINLOCK_H
+
+/** @brief how much a lock was used */
+typedef struct lock_stats {
+    int acquisitions;       /* Times the lock was taken */
+    int contended;          /* Of those, times it had to be waited for */
+} lock_stats_t;
+
+/** @brief a lock waited for by spinning, in no particular order */
+typedef struct spinlock {
+    volatile int locked;    /* 1 while held */
+    lock_stats_t stats;
+} spinlock_t;
+
+/** @brief a lock waited for by spinning, first come first served */
+typedef struct ticket_lock {
+    volatile int next;      /* Ticket the next one to come gets */
+    volatile int owner;     /* Ticket of the holder */
+    lock_stats_t stats;
+} ticket_lock_t;
+
+void spin_init(spinlock_t *lock);
+void spin_lock(spinlock_t *lock);
+int spin_trylock(spinlock_t *lock);
+void spin_unlock(spinlock_t *lock);
+int spin_lock_irqsave(spinlock_t *lock);
+void spin_unlock_irqrestore(spinlock_t *lock, int int_flag);
+
+void ticket_init(ticket_lock_t *lock);
+void ticket_lock(ticket_lock_t *lock);
+int ticket_trylock(ticket_lock_t *lock);
+void ticket_unlock(ticket_lock_t *lock);
+int ticket_lock_irqsave(ticket_lock_t *lock);
+void ticket_unlock_irqrestore(ticket_lock_t *lock, int int_flag);
+
+void lock_print_stats(const char *name, lock_stats_t *stats);
+
+#endif /* __SPINLOCK_H */
@@ -14,4 +14,8 @@ int readfile_handler();
 
 int readfile_handler_c(void *arg_packet);
 
+void misbehave_handler();
+
+void misbehave_handler_c(int mode);
+
 #endif  /* __MISC_SYSCALLS_H */
@@ -8,8 +8,20 @@
 #ifndef __SYSTEM_CHECK_SYSCALLS_H
 #define __SYSTEM_CHECK_SYSCALLS_H
 
+#include <vm/vm.h>
+
+/** @brief what memory_stats() hands back to the caller */
+typedef struct memory_stats {
+    vm_task_stats_t task;       /* Pages of the calling task */
+    vm_fault_stats_t faults;    /* Faults handled for all tasks */
+} memory_stats_t;
+
 void memory_check_handler();
 
 void memory_check_handler_c();
 
+void memory_stats_handler();
+
+int memory_stats_handler_c(memory_stats_t *stats);
+
 #endif  /* __SYSTEM_CHECK_SYSCALLS_H */
@@ -32,6 +32,14 @@ unsigned int get_ticks_handler();
 
 unsigned int get_ticks_handler_c();
 
+int set_priority_handler();
+
+int set_priority_handler_c(void *arg_packet);
+
+int set_weight_handler();
+
+int set_weight_handler_c(void *arg_packet);
+
 int swexn_handler();
 
 int swexn_handler_c(void *arg_packet);
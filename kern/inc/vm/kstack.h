@@ -0,0 +1,23 @@
+/** @file kstack.h
+ *  @brief kernel stacks for threads
+ *
+ *  Kernel stacks are made of user frames, mapped above KERNEL_HIGH_START
+ *  in every address space. Each stack has an unmapped guard page below
+ *  it, so an overflow faults instead of running into the next stack.
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+#ifndef __KSTACK_H
+#define __KSTACK_H
+
+#define KERNEL_STACK_PAGES 3
+#define KERNEL_STACK_SIZE ((PAGE_SIZE) * KERNEL_STACK_PAGES)
+
+void kstack_init();
+
+void *kstack_alloc();
+
+void kstack_free(void *stack);
+
+#endif /* __KSTACK_H */
@@ -0,0 +1,36 @@
+/** @file merge.h
+ *  @brief merging identical user pages while the system is idle
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+#ifndef __MERGE_H
+#define __MERGE_H
+
+#include <core/task.h>
+
+#define MERGE_TABLE_SIZE 512        /* Merged frames known at a time */
+#define MERGE_VISITS_PER_TICK 256   /* Page table entries looked at */
+#define MERGE_HASHES_PER_TICK 8     /* Pages hashed and compared */
+#define MERGE_SWEEP_PER_TICK 8      /* Table slots checked for stale frames */
+
+/** @brief counters describing page merging */
+typedef struct merge_stats {
+    int merged;             /* Pages merged since boot */
+    int zero_merged;        /* Of those, pages which were all zeroes */
+    int stable_frames;      /* Frames in the table right now */
+} merge_stats_t;
+
+void merge_init();
+
+void merge_add_task(task_struct_t *t);
+
+void merge_remove_task(task_struct_t *t);
+
+void merge_pages_idle();
+
+void merge_get_stats(merge_stats_t *stats);
+
+void merge_print_stats();
+
+#endif /* __MERGE_H */
@@ -0,0 +1,36 @@
+/** @file reaper.h
+ *  @brief freeing the address spaces of dead tasks in the background
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+#ifndef __REAPER_H
+#define __REAPER_H
+
+#include <list/rb_tree.h>
+
+#define REAP_ENTRIES_PER_TICK 512   /* Page table entries released */
+#define REAP_PENDING_MAX 64         /* Frames waiting for a free list */
+#define REAP_QUEUE_MAX 16           /* Address spaces waiting to be freed */
+
+/** @brief counters describing the reaper */
+typedef struct reaper_stats {
+    int queued;             /* Address spaces handed over since boot */
+    int waiting;            /* Of those, address spaces not freed yet */
+    int frames_freed;       /* Frames given back since boot */
+    int drains;             /* Times a thread had to do the work itself */
+} reaper_stats_t;
+
+void reaper_init();
+
+int reap_address_space(int *pd, rb_root *regions);
+
+void reap_pages_idle();
+
+int reap_drain(int count);
+
+void reaper_get_stats(reaper_stats_t *stats);
+
+void reaper_print_stats();
+
+#endif /* __REAPER_H */
@@ -0,0 +1,44 @@
+/** @file region.h
+ *  @brief the regions making up the user part of an address space
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+#ifndef __REGION_H
+#define __REGION_H
+
+#include <list/rb_tree.h>
+
+#define REGION_READ 1
+#define REGION_WRITE 2
+#define REGION_EXEC 4
+#define REGION_NEW_PAGES 8  /* Created by new_pages(), removable */
+
+/** @brief a contiguous range of user memory with one protection */
+typedef struct vm_region {
+    rb_node node;           /* Link in the task's region tree */
+    unsigned int base;      /* First byte of the region */
+    unsigned int len;       /* Length of the region in bytes */
+    int flags;              /* REGION_* flags */
+} vm_region_t;
+
+void region_tree_init(rb_root *root);
+
+int region_insert(rb_root *root, void *base, unsigned int len, int flags);
+
+vm_region_t *region_find(rb_root *root, void *addr);
+
+int region_overlaps(rb_root *root, void *base, unsigned int len);
+
+int region_range_allows(rb_root *root, void *base, unsigned int len,
+                        int flags);
+
+int region_remove(rb_root *root, void *base, int flags);
+
+int region_tree_clone(rb_root *dst, rb_root *src);
+
+void region_tree_destroy(rb_root *root);
+
+int region_tree_destroy_nowait(rb_root *root);
+
+#endif /* __REGION_H */
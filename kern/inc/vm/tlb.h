@@ -0,0 +1,32 @@
+/** @file tlb.h
+ *  @brief functions to invalidate TLB entries after page table updates
+ *
+ *  Changes to a few pages are invalidated one page at a time using 
+ *  invlpg. Once a batch grows beyond TLB_BATCH_MAX pages, it is cheaper
+ *  to reload %cr3 and throw away all the non global entries instead.
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+#ifndef __TLB_H
+#define __TLB_H
+
+#define TLB_BATCH_MAX 32
+
+/** @brief a set of pages whose TLB entries have to be invalidated */
+typedef struct tlb_batch {
+    int count;                      /* Number of pages in the batch */
+    void *pages[TLB_BATCH_MAX];     /* Pages to be invalidated */
+} tlb_batch_t;
+
+void tlb_batch_init(tlb_batch_t *batch);
+
+void tlb_batch_add(tlb_batch_t *batch, void *addr);
+
+void tlb_batch_flush(tlb_batch_t *batch);
+
+void tlb_flush_page(void *addr);
+
+void tlb_flush_all();
+
+#endif /* __TLB_H */
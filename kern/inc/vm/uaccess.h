@@ -0,0 +1,32 @@
+/** @file uaccess.h
+ *  @brief copying data between the kernel and user memory
+ *
+ *  The copies do not look at the page tables beforehand. A fault on a
+ *  bad user address is caught by the page fault handler, which finds
+ *  the faulting instruction in the fixup table and makes the copy
+ *  return ERR_INVAL instead of killing the thread.
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+#ifndef __UACCESS_H
+#define __UACCESS_H
+
+/** @brief an instruction touching user memory and where to go if it
+ *         faults for good */
+typedef struct uaccess_fixup {
+    unsigned int fault_eip;
+    unsigned int fixup_eip;
+} uaccess_fixup_t;
+
+int copy_from_user(void *dst, const void *src, int len);
+
+int copy_to_user(void *dst, const void *src, int len);
+
+int check_user_writable(void *ptr, int len);
+
+int copy_string_from_user(char *dst, const char *src, int max_size);
+
+unsigned int uaccess_fixup(unsigned int eip);
+
+#endif /* __UACCESS_H */
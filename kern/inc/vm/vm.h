@@ -8,6 +8,8 @@
 #define __VM_H
 
 #include <elf_410.h>
+#include <list/rb_tree.h>
+#include <list/list.h>
 
 #define PAGE_ENTRY_PRESENT 1
 #define READ_WRITE_ENABLE 2
@@ -17,10 +19,15 @@
 #define COW_MODE_DISABLE_MASK 0xFFFFFDFF
 #define WRITE_THROUGH_CACHING 8
 #define DISABLE_CACHING 16
+#define PAGE_ACCESSED 32
+#define PAGE_DIRTY 64
 #define GLOBAL_PAGE_ENTRY 256
-#define NEWPAGE_PAGE 1024
-#define NEWPAGE_START 2048
-#define NEWPAGE_END 3072
+#define LARGE_PAGE_ENTRY 128
+#define COMPRESSED_PAGE 2048
+#define DEMAND_ZERO_PAGE 4096
+
+#define PAGE_FAULT_WRITE 2
+#define PAGE_FAULT_USER 4
 
 /*Constants and macros*/
 
@@ -29,58 +36,169 @@
 #define PAGE_TABLE_MASK 0x003ff000
 #define PAGE_ROUND_DOWN 0xfffff000
 #define NUM_PAGE_TABLE_ENTRIES (PAGE_SIZE / PAGE_TABLE_ENTRY_SIZE)
+#define LARGE_PAGE_SIZE (PAGE_SIZE * NUM_PAGE_TABLE_ENTRIES)
+#define LARGE_PAGE_ROUND_DOWN PAGE_DIRECTORY_MASK
 #define DEFAULT_STACK_SIZE 2 * 1024 * 1024
 #define STACK_START 0xc0000000
 #define STACK_END (STACK_START - DEFAULT_STACK_SIZE)
-#define MEMORY_REGION_MAPPED 0
-#define MEMORY_REGION_UNMAPPED 1
-#define MAX_MEMORY_ADDR 0xffffffff
-#define MAX_AVAILABLE_USER_MEM (MAX_MEMORY_ADDR - USER_MEM_START)
+
+/* The top of every address space belongs to the kernel. Kernel stacks
+ * are mapped right below the last 4 MB, through which the page tables 
+ * of the current address space can be reached. */
+#define KERNEL_HIGH_START 0xf8000000
+#define PT_WINDOW_START 0xffc00000
+#define PT_WINDOW_PD_INDEX 1023
+#define USER_MEM_END KERNEL_HIGH_START  /* First byte past user memory */
+#define IS_USER_ADDR(addr) ((unsigned int)(addr) >= USER_MEM_START && \
+                            (unsigned int)(addr) < USER_MEM_END)
+#define OVERLAPS_PAGE(start, len, page) ((len) > 0 \
+                                        && (start) < (page) + PAGE_SIZE \
+                                        && (page) < (start) + (len))
 
 #define PAGE_DIR_ENTRY_DEFAULT 0x00000002
-#define PAGE_TABLE_ENTRY_DEFAULT 0x00000002
+#define PAGE_TABLE_ENTRY_DEFAULT 0x00000000 /* A zeroed frame is a page table */
 
 #define GET_ADDR_FROM_ENTRY(addr) (((unsigned int)addr)&0xFFFFF000)
 #define GET_FLAGS_FROM_ENTRY(addr) (((unsigned int)addr)&0x00000FFF)
+#define IS_LARGE_PAGE(entry) ((((unsigned int)entry) & \
+                (LARGE_PAGE_ENTRY | PAGE_ENTRY_PRESENT)) == \
+                (LARGE_PAGE_ENTRY | PAGE_ENTRY_PRESENT))
+#define IS_DEMAND_ZERO(entry) ((((unsigned int)entry) & \
+				(DEMAND_ZERO_PAGE | PAGE_ENTRY_PRESENT)) == DEMAND_ZERO_PAGE)
+
+/* A compressed page keeps its zswap handle where the frame address was,
+ * above the bit marking demand zero pages */
+#define COMPRESSED_HANDLE_SHIFT 13
+#define IS_COMPRESSED(entry) ((((unsigned int)entry) & \
+				(COMPRESSED_PAGE | PAGE_ENTRY_PRESENT)) == COMPRESSED_PAGE)
+#define GET_COMPRESSED_HANDLE(entry) \
+				((int)((unsigned int)(entry) >> COMPRESSED_HANDLE_SHIFT))
+#define MAKE_COMPRESSED_ENTRY(handle, flags) \
+				(((unsigned int)(handle) << COMPRESSED_HANDLE_SHIFT) \
+				 | ((flags) & 0xFFF & ~PAGE_ENTRY_PRESENT) | COMPRESSED_PAGE)
+/* Windows through which the idle thread maps frames */
+#define IDLE_WINDOW_ZERO 0      /* Frame being zeroed for the zero pool */
+#define IDLE_WINDOW_PT 1        /* Page table scanned for identical pages */
+#define IDLE_WINDOW_PAGE 2      /* Page looked at for merging */
+#define IDLE_WINDOW_STABLE 3    /* Merged page it is compared with */
+#define IDLE_WINDOW_REAP 4      /* Page table of a dead task being freed */
+#define NUM_IDLE_WINDOWS 5
+
+#define RECLAIM_BATCH_SIZE 16   /* Pages compressed per reclaim */
 
 #define GET_PD_INDEX(addr) ((unsigned int)((int)(addr) & PAGE_DIRECTORY_MASK) >> 22)
 #define GET_PT_INDEX(addr) ((unsigned int)((int)(addr) & PAGE_TABLE_MASK) >> 12)
 #define KERNEL_MAP_NUM_ENTRIES (sizeof(direct_map) / sizeof(direct_map[0]))
 
+/** @brief pages of a task, by how they are backed */
+typedef struct vm_task_stats {
+    int resident;       /* Pages with a frame nobody else maps */
+    int shared;         /* Pages with a frame mapped elsewhere too */
+    int cow;            /* Of those two, pages to be copied on write */
+    int compressed;     /* Pages in the compressed store */
+    int page_tables;    /* Page tables, shared ones included */
+} vm_task_stats_t;
+
+/** @brief zeroed frames set aside by exec for the program it loads */
+typedef struct frame_reserve {
+    int *pd;            /* Page directory the program is loaded into */
+    void **frames;      /* The frames, taken from the end */
+    int size;           /* Frames set aside */
+    int count;          /* Of those, frames not taken yet */
+    list_head link;     /* In the list of reservations being loaded */
+} frame_reserve_t;
+
+/** @brief page faults handled since boot, for all tasks */
+typedef struct vm_fault_stats {
+    int cow_copies;         /* COW pages copied to a frame of their own */
+    int cow_upgrades;       /* COW pages made writable, as the last user */
+    int zero_fills;         /* Pages given a new zeroed frame */
+    int page_tables_freed;  /* Page tables freed after remove_pages() */
+} vm_fault_stats_t;
+
 void vm_init();
 
+void vm_init_ap();
+
+void map_device_page(void *vaddr, void *paddr);
+
 void *create_page_directory();
 
 void free_page_directory(void *pd_addr);
 
-void *clone_paging_info(int *pd);
+void *clone_paging_info(int *pd, rb_root *regions);
+
+void free_paging_info(int *pd, rb_root *regions);
+
+int unref_page_table_nowait(int *pt);
+
+void get_task_vm_stats(rb_root *regions, vm_task_stats_t *stats);
 
-void free_paging_info(int *pd);
+void get_vm_fault_stats(vm_fault_stats_t *stats);
+
+int vm_reserve_frames(frame_reserve_t *reserve, int *pd,
+                      simple_elf_t *se_hdr, unsigned int arg_bytes);
+
+void vm_release_frames(frame_reserve_t *reserve);
+
+void *take_reserved_frame();
+
+void reset_paging_info(int *pd, rb_root *regions, simple_elf_t *se_hdr);
  
-int setup_page_table(simple_elf_t *se_hdr, void *pd_addr);
+int setup_page_table(simple_elf_t *se_hdr, void *pd_addr, rb_root *regions);
 
 void set_kernel_pd();
 
 void *get_kernel_pd();
 
+void *get_zero_frame();
+
 void *get_dead_thr_kernel_stack();
 
 void set_cur_pd(void *pd_addr);
 
+int is_addr_pt_cow(void *addr);
+
+int handle_pt_cow(void *addr);
+
 int is_addr_cow(void *addr);
 
 int handle_cow(void *addr);
 
-void enable_paging();
+void *temp_map_frame(void *frame_addr);
+
+void temp_unmap_frame(void *addr);
+
+void clear_frame(void *frame_addr);
+
+void clear_frame_idle(void *frame_addr);
+
+void *idle_map_frame(int window, void *frame_addr);
+
+void idle_unmap_frame(int window);
+
+int copy_to_user_frames(void *dst, const void *src, int len);
 
-int is_memory_range_mapped(void *base, int len);
+int map_shared_page(void *addr, void *frame_addr, int *pd_addr, int flags);
 
-int map_new_pages(void *base, int length);
+void map_kernel_page(void *addr, void *frame_addr);
 
-int unmap_new_pages(void *base);
+void *unmap_kernel_page(void *addr);
+
+int is_addr_demand_zero(void *addr);
+
+int handle_demand_zero(void *addr, int err_code);
+
+int is_addr_compressed(void *addr);
+
+int handle_compressed(void *addr);
+
+int reclaim_pages(int count, rb_root *regions);
+
+void enable_paging();
 
-int is_memory_writable(void *ptr, int bytes);
+int map_new_pages(void *base, int length, rb_root *regions);
 
-int is_memory_writable(void *ptr, int bytes);
+int unmap_new_pages(void *base, rb_root *regions);
 
 #endif /* __VM_H */
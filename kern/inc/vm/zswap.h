@@ -0,0 +1,43 @@
+/** @file zswap.h
+ *  @brief compressed store for user pages evicted under memory pressure
+ *
+ *  A compressed page is known by a handle, which the page table entry
+ *  of the evicted page holds in place of the frame address. Handles are
+ *  reference counted, since page tables shared after a fork get copied
+ *  along with the compressed entries in them.
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+#ifndef __ZSWAP_H
+#define __ZSWAP_H
+
+#define ZSWAP_MAX_ENTRIES 16384             /* Compressed pages at a time */
+#define ZSWAP_MAX_POOL_SIZE (4 * 1024 * 1024) /* Kernel memory for them */
+
+/** @brief counters describing the compressed store */
+typedef struct zswap_stats {
+    int stored_pages;       /* Pages in the store right now */
+    int pool_size;          /* Bytes of kernel memory holding them */
+    int stores;             /* Pages compressed since boot */
+    int rejects;            /* Pages which did not compress or fit */
+    int loads;              /* Faults which brought a page back */
+} zswap_stats_t;
+
+void zswap_init();
+
+int zswap_store(void *frame_addr);
+
+int zswap_load(int handle, void *frame_addr);
+
+void zswap_ref(int handle);
+
+void zswap_unref(int handle);
+
+int zswap_unref_nowait(int handle);
+
+void zswap_get_stats(zswap_stats_t *stats);
+
+void zswap_print_stats();
+
+#endif /* __ZSWAP_H */
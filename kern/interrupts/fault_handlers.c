@@ -25,6 +25,9 @@
 #include <string.h>
 #include <common/assert.h>
 #include <core/thread.h>
+#include <core/task.h>
+#include <interrupts/fault_handlers.h>
+#include <vm/uaccess.h>
 
 #define THREAD_KILL_EXIT_STATUS -2
 #define THREAD_KILL_MSG_LEN 256
@@ -34,18 +37,23 @@ static void *setup_swexn_stack(void *esp3, ureg_t *ureg, void *arg);
 static void update_fault_stack(void *esp3, swexn_handler_t eip, 
                                thread_struct_t *curr_thread);
 static void kill_current_thread(int cause);
+static int reclaim_memory();
 void handle_fault(int cause);
 int invoke_swexn_handler(int cause);
 
 /** @brief Callback function for the timer handler
  *
- *  This function invokes the context switch during every
- *  timer tick
+ *  This function invokes the context switch once the running thread
+ *  used up its quantum, or a thread of higher priority is waiting.
+ *  The work done while the system is idle is left to the idle thread,
+ *  so that the handler stays short.
  *
  *  @return void
  */
 void tickback(unsigned int ticks) {
-	context_switch();
+	if(sched_tick()) {
+		context_switch();
+	}
 }
 
 /** @brief this function handles a divide by zero error condition.
@@ -59,25 +67,62 @@ void divide_error_handler_c() {
 /** @brief This function handles the page fault
  *
  *  The page fault handler checks the address that 
- *  caused page fault. If the address is a COW page fault,
- *  then the handler invokes the COW handler using the VM
- *  module. If not, then it checks for the swexn handler
- *  installed. If the handler is not installed, then the
- *  page fault handler kills the thread.
+ *  caused page fault. If the page table for the address is
+ *  still shared with another task after a fork, the task gets
+ *  its own copy and the access is retried. If the address is
+ *  a COW page fault, then the handler invokes the COW handler
+ *  using the VM module. If the address lies in a demand zero page which
+ *  has not been touched yet, the VM module fills it in, and a page
+ *  which was compressed to free its frame is decompressed. When any of
+ *  these runs out of frames, cold pages of the task are compressed and
+ *  the access is retried, as long as that frees something. If not, and
+ *  the fault came from one of the kernel's user copy routines, the
+ *  copy is resumed at its fixup code and fails. Otherwise it checks
+ *  for the swexn handler installed. If the handler is not installed,
+ *  then the page fault handler kills the thread.
+ *
+ * @param err_code the error code pushed by the processor
+ * @param eip where the address of the faulting instruction is saved
  *
  * @return Void
  */
-void page_fault_handler_c() {
+void page_fault_handler_c(int err_code, unsigned int *eip) {
 	void *page_fault_addr = (void *)get_cr2();
+	int retval = 0, resolvable = 1;
+	unsigned int fixup;
 	
-	if(is_addr_cow(page_fault_addr)) {
-		if(handle_cow(page_fault_addr) < 0) {
-			kill_current_thread(SWEXN_CAUSE_PAGEFAULT);
-		}
+	if(is_addr_pt_cow(page_fault_addr)) {
+		retval = handle_pt_cow(page_fault_addr);
+	}
+	else if(is_addr_cow(page_fault_addr)) {
+		retval = handle_cow(page_fault_addr);
 	} 
-    else {
-        handle_fault(SWEXN_CAUSE_PAGEFAULT);
-    } 
+	else if(is_addr_demand_zero(page_fault_addr)) {
+		retval = handle_demand_zero(page_fault_addr, err_code);
+	}
+	else if(is_addr_compressed(page_fault_addr)) {
+		retval = handle_compressed(page_fault_addr);
+	}
+	else {
+		resolvable = 0;
+	}
+	if(resolvable && retval == 0) {
+		return;
+	}
+	if(retval == ERR_NOMEM && reclaim_memory() > 0) {
+		return;
+	}
+
+	if(!(err_code & PAGE_FAULT_USER) && (fixup = uaccess_fixup(*eip)) != 0) {
+		*eip = fixup;
+		return;
+	}
+	if(resolvable) {
+		kill_current_thread(SWEXN_CAUSE_PAGEFAULT);
+	}
+	else {
+		handle_fault(SWEXN_CAUSE_PAGEFAULT);
+	}
 }
 
 /** @brief this function handles a debug exception
@@ -244,9 +289,13 @@ int invoke_swexn_handler(int cause) {
 
 	ureg.cause = cause;
 	ureg.cr2 = get_cr2();
+
 	populate_ureg(&ureg, ERR_CODE_AVAIL, curr_thread);
 	void *stack_bottom = setup_swexn_stack(curr_task->swexn_esp, 
 											&ureg, curr_task->swexn_args);
+	if(stack_bottom == NULL) {
+		return ERR_FAILURE;
+	}
 	update_fault_stack(stack_bottom, curr_task->eip, curr_thread);
 	curr_task->eip = NULL;  /* Deregister the handler */
 	return 0;
@@ -257,16 +306,21 @@ int invoke_swexn_handler(int cause) {
  *  @param esp3 the stack where the swexn handler will run
  *  @param ureg the registers for the swexn handler
  *  @param arg the arguments to the swexn handler
- *  @return void* the bottom of the stack 
+ *  @return void* the bottom of the stack, NULL if the stack is not
+ *          writable
  */
 void *setup_swexn_stack(void *esp3, ureg_t *ureg, void *arg) {
-    void *stack_bottom = (char *)esp3 - sizeof(ureg_t);
-    memcpy(stack_bottom, ureg, sizeof(ureg_t));
+    swexn_frame_t frame;
+    void *stack_bottom = (char *)esp3 - sizeof(swexn_frame_t);
 
-    *((int *)(stack_bottom) - 1) = (int)stack_bottom;
-    *((int *)(stack_bottom) - 2) = (int)arg;
-    *((int *)(stack_bottom) - 3) = (int)ureg->eip;
-    return (int *)stack_bottom - 3;
+    frame.ret_addr = ureg->eip;
+    frame.arg = arg;
+    frame.ureg_ptr = (ureg_t *)((char *)esp3 - sizeof(ureg_t));
+    frame.ureg = *ureg;
+    if (copy_to_user(stack_bottom, &frame, sizeof(swexn_frame_t)) < 0) {
+        return NULL;
+    }
+    return stack_bottom;
 }
 
 /** @brief update the kernel stack to change return esp and eip
@@ -309,3 +363,18 @@ eip = %p\n";
 	get_curr_task()->exit_status = THREAD_KILL_EXIT_STATUS;
 	do_vanish();
 }
+
+/** @brief Function to free frames by compressing cold pages of the
+ *  current task
+ *
+ *  @return int the number of pages compressed
+ */
+int reclaim_memory() {
+	task_struct_t *t = get_curr_task();
+	int reclaimed;
+
+	mutex_lock(&t->region_mutex);
+	reclaimed = reclaim_pages(RECLAIM_BATCH_SIZE, &t->regions);
+	mutex_unlock(&t->region_mutex);
+	return reclaimed;
+}
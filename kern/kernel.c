@@ -14,6 +14,7 @@
 /* libc includes. */
 #include <stdio.h>
 #include <simics.h>                 /* lprintf() */
+#include <string.h>
 
 /* multiboot header file */
 #include <multiboot.h>              /* boot_info */
@@ -31,13 +32,20 @@
 #include <vm/vm.h>
 #include <simics.h>
 #include <loader/loader.h>
+#include <loader/text_cache.h>
 #include <core/thread.h>
 #include <core/task.h>
+#include <vm/merge.h>
+#include <vm/reaper.h>
 #include <exec2obj.h>
 #include <core/scheduler.h>
+#include <core/cpu.h>
 #include <syscalls/syscall_handlers.h>
 
+#define BOOT_FRAME_COLORING "frame_coloring" /* Turns on page coloring */
+
 static void set_default_color();
+static int boot_option_set(int argc, char **argv, const char *option);
 
 /** @brief Kernel entrypoint.
  *  
@@ -66,8 +74,12 @@ int kernel_main(mbinfo_t *mbinfo, int argc, char **argv, char **envp)
     /* Clear the console of crud */
     clear_console();
 
+    /* Boot the other processors, if any */
+    smp_start(mbinfo);
+
     /* Initialize user space physical frame allocator */
     init_frame_allocator();
+    set_frame_coloring(boot_option_set(argc, argv, BOOT_FRAME_COLORING));
 
     /* Initialize scheduler system */
     init_scheduler();
@@ -75,12 +87,24 @@ int kernel_main(mbinfo_t *mbinfo, int argc, char **argv, char **envp)
     /* Initialize kernel threads subsystem */
     kernel_threads_init();
 
+    /* Initialize merging of identical user pages */
+    merge_init();
+
+    /* Initialize freeing of dead address spaces in the background */
+    reaper_init();
+
+    /* Initialize the program loader */
+    loader_init();
+
+    /* Initialize sharing of program text between tasks */
+    text_cache_init();
+
     /* Load the init task into memory. This does NOT make the init task 
      * runnable. This is taken care of by the scheduler/context switcher */
 	load_init_task("init");
 
-    /* Load the idle task in user mode. This task ALWAYS has TID 1 */
-    load_bootstrap_task("idle");
+    /* Start the idle task, which runs in kernel mode */
+    run_idle_task();
 
     /* Should never come here */
     while (1) {
@@ -90,6 +114,23 @@ int kernel_main(mbinfo_t *mbinfo, int argc, char **argv, char **envp)
     return 0;
 }
 
+/** @brief check whether a word was given on the kernel command line
+ *
+ *  @param argc the number of words
+ *  @param argv the words
+ *  @param option the word looked for
+ *  @return int 1 if it was given, 0 if not
+ */
+int boot_option_set(int argc, char **argv, const char *option) {
+    int i;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], option) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 /** @brief function to set the default color of the console
  *
  *  By default the console will have a background color of black (0x00)
@@ -0,0 +1,323 @@
+/** @file rb_tree.c
+ *  @brief This file implements the red-black tree operations.
+ *
+ *  Missing children are NULL and count as black. The balancing follows
+ *  the textbook (CLRS) algorithms.
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+#include <list/rb_tree.h>
+
+#define IS_BLACK(node) ((node) == NULL || (node)->color == RB_BLACK)
+
+static void rotate_left(rb_node *node, rb_root *root);
+static void rotate_right(rb_node *node, rb_root *root);
+static void replace_child(rb_node *old, rb_node *new, rb_root *root);
+static void erase_color(rb_node *node, rb_node *parent, rb_root *root);
+
+/** @brief initialize an empty tree
+ *
+ *  @param root the root of the tree
+ *  @return void
+ */
+void rb_init_root(rb_root *root) {
+    root->node = NULL;
+}
+
+/** @brief hang a new node off the tree
+ *
+ *  The tree is left unbalanced, rb_insert_color() has to be called
+ *  right after.
+ *
+ *  @param node the node to be added
+ *  @param parent the node which becomes its parent, NULL for the root
+ *  @param link the (empty) child pointer of parent or of the root
+ *  @return void
+ */
+void rb_link_node(rb_node *node, rb_node *parent, rb_node **link) {
+    node->parent = parent;
+    node->left = NULL;
+    node->right = NULL;
+    node->color = RB_RED;
+    *link = node;
+}
+
+/** @brief rebalance the tree after rb_link_node()
+ *
+ *  @param node the node which was just linked
+ *  @param root the root of the tree
+ *  @return void
+ */
+void rb_insert_color(rb_node *node, rb_root *root) {
+    rb_node *parent, *gparent, *uncle;
+
+    while ((parent = node->parent) != NULL && parent->color == RB_RED) {
+        /* A red node is never the root, so the grandparent exists */
+        gparent = parent->parent;
+        if (parent == gparent->left) {
+            uncle = gparent->right;
+            if (!IS_BLACK(uncle)) {
+                parent->color = RB_BLACK;
+                uncle->color = RB_BLACK;
+                gparent->color = RB_RED;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->right) {
+                rotate_left(parent, root);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->color = RB_BLACK;
+            gparent->color = RB_RED;
+            rotate_right(gparent, root);
+        } else {
+            uncle = gparent->left;
+            if (!IS_BLACK(uncle)) {
+                parent->color = RB_BLACK;
+                uncle->color = RB_BLACK;
+                gparent->color = RB_RED;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->left) {
+                rotate_right(parent, root);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->color = RB_BLACK;
+            gparent->color = RB_RED;
+            rotate_left(gparent, root);
+        }
+    }
+    root->node->color = RB_BLACK;
+}
+
+/** @brief remove a node from the tree
+ *
+ *  Does not free space associated with this node
+ *
+ *  @param node the node to be removed
+ *  @param root the root of the tree
+ *  @return void
+ */
+void rb_erase(rb_node *node, rb_root *root) {
+    rb_node *child, *parent;
+    int color = node->color;
+
+    if (node->left == NULL) {
+        child = node->right;
+        parent = node->parent;
+        replace_child(node, child, root);
+    } else if (node->right == NULL) {
+        child = node->left;
+        parent = node->parent;
+        replace_child(node, child, root);
+    } else {
+        /* Put the successor, which has no left child, in its place */
+        rb_node *next = node->right;
+        while (next->left != NULL) {
+            next = next->left;
+        }
+        color = next->color;
+        child = next->right;
+        if (next->parent == node) {
+            parent = next;
+        } else {
+            parent = next->parent;
+            replace_child(next, child, root);
+            next->right = node->right;
+            next->right->parent = next;
+        }
+        replace_child(node, next, root);
+        next->left = node->left;
+        next->left->parent = next;
+        next->color = node->color;
+    }
+
+    if (color == RB_BLACK) {
+        erase_color(child, parent, root);
+    }
+}
+
+/** @brief get the smallest node of the tree
+ *
+ *  @param root the root of the tree
+ *  @return rb_node * the first node, NULL if the tree is empty
+ */
+rb_node *rb_first(rb_root *root) {
+    rb_node *node = root->node;
+    if (node == NULL) {
+        return NULL;
+    }
+    while (node->left != NULL) {
+        node = node->left;
+    }
+    return node;
+}
+
+/** @brief get the node following a node in order
+ *
+ *  @param node the node
+ *  @return rb_node * the next node, NULL if node is the last one
+ */
+rb_node *rb_next(rb_node *node) {
+    if (node->right != NULL) {
+        node = node->right;
+        while (node->left != NULL) {
+            node = node->left;
+        }
+        return node;
+    }
+    while (node->parent != NULL && node == node->parent->right) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+/** @brief get the node preceding a node in order
+ *
+ *  @param node the node
+ *  @return rb_node * the previous node, NULL if node is the first one
+ */
+rb_node *rb_prev(rb_node *node) {
+    if (node->left != NULL) {
+        node = node->left;
+        while (node->right != NULL) {
+            node = node->right;
+        }
+        return node;
+    }
+    while (node->parent != NULL && node == node->parent->left) {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+/* ---------- Static local functions ----------- */
+
+/** @brief restore the red-black properties after removing a black node
+ *
+ *  @param node the node which took the place of the removed one, which
+ *              carries an extra black. May be NULL.
+ *  @param parent the parent of node
+ *  @param root the root of the tree
+ *  @return void
+ */
+void erase_color(rb_node *node, rb_node *parent, rb_root *root) {
+    rb_node *sibling;
+
+    while (node != root->node && IS_BLACK(node)) {
+        /* The removed node was black, so node has a sibling */
+        if (node == parent->left) {
+            sibling = parent->right;
+            if (!IS_BLACK(sibling)) {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                rotate_left(parent, root);
+                sibling = parent->right;
+            }
+            if (IS_BLACK(sibling->left) && IS_BLACK(sibling->right)) {
+                sibling->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (IS_BLACK(sibling->right)) {
+                sibling->left->color = RB_BLACK;
+                sibling->color = RB_RED;
+                rotate_right(sibling, root);
+                sibling = parent->right;
+            }
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->right->color = RB_BLACK;
+            rotate_left(parent, root);
+        } else {
+            sibling = parent->left;
+            if (!IS_BLACK(sibling)) {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                rotate_right(parent, root);
+                sibling = parent->left;
+            }
+            if (IS_BLACK(sibling->left) && IS_BLACK(sibling->right)) {
+                sibling->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+            if (IS_BLACK(sibling->left)) {
+                sibling->right->color = RB_BLACK;
+                sibling->color = RB_RED;
+                rotate_left(sibling, root);
+                sibling = parent->left;
+            }
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->left->color = RB_BLACK;
+            rotate_right(parent, root);
+        }
+        node = root->node;
+    }
+    if (node != NULL) {
+        node->color = RB_BLACK;
+    }
+}
+
+/** @brief put a node in the place of another in the eyes of its parent
+ *
+ *  @param old the node being replaced
+ *  @param new the replacement, may be NULL
+ *  @param root the root of the tree
+ *  @return void
+ */
+void replace_child(rb_node *old, rb_node *new, rb_root *root) {
+    if (old->parent == NULL) {
+        root->node = new;
+    } else if (old == old->parent->left) {
+        old->parent->left = new;
+    } else {
+        old->parent->right = new;
+    }
+    if (new != NULL) {
+        new->parent = old->parent;
+    }
+}
+
+/** @brief rotate a node down to the left
+ *
+ *  @param node the node, must have a right child
+ *  @param root the root of the tree
+ *  @return void
+ */
+void rotate_left(rb_node *node, rb_root *root) {
+    rb_node *right = node->right;
+
+    node->right = right->left;
+    if (right->left != NULL) {
+        right->left->parent = node;
+    }
+    replace_child(node, right, root);
+    right->left = node;
+    node->parent = right;
+}
+
+/** @brief rotate a node down to the right
+ *
+ *  @param node the node, must have a left child
+ *  @param root the root of the tree
+ *  @return void
+ */
+void rotate_right(rb_node *node, rb_root *root) {
+    rb_node *left = node->left;
+
+    node->left = left->right;
+    if (left->right != NULL) {
+        left->right->parent = node;
+    }
+    replace_child(node, left, root);
+    left->right = node;
+    node->parent = left;
+}
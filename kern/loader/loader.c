@@ -16,16 +16,50 @@
 #include <elf_410.h>
 #include <common/assert.h>
 #include <vm/vm.h>
+#include <page.h>
 #include <common/errors.h>
+#include <vm/uaccess.h>
+#include <loader/text_cache.h>
+#include <sync/mutex.h>
 
 #define MAX_SECTION_NAME_LEN 10 /* longer than any we care about */
-static int load_segment(const char *filename, void *start, 
+
+#define ELF_CACHE_EMPTY 0       /* The program was not looked at yet */
+#define ELF_CACHE_VALID 1       /* se_hdr holds the parsed header */
+#define ELF_CACHE_INVALID 2     /* The program is not a valid ELF binary */
+
+/** @brief the parsed ELF header of a program in the RAM disk */
+typedef struct elf_cache_entry {
+    int state;
+    simple_elf_t se_hdr;
+} elf_cache_entry_t;
+
+/* One entry per file, in the same order as exec2obj_userapp_TOC */
+static elf_cache_entry_t *elf_cache;
+static mutex_t elf_cache_mutex;
+
+static int load_segment(simple_elf_t *se_hdr, void *start, 
                         int len, int offset);
+static int lookup_elf(int index, simple_elf_t *se_hdr);
+static int parse_elf(simple_elf_t *se_hdr, const char *fname);
+
+/** @brief initialize the loader
+ *
+ *  @return void
+ */
+void loader_init() {
+    elf_cache = smalloc(exec2obj_userapp_count * sizeof(elf_cache_entry_t));
+    kernel_assert(elf_cache != NULL);
+    memset(elf_cache, 0, exec2obj_userapp_count * sizeof(elf_cache_entry_t));
+    kernel_assert(mutex_init(&elf_cache_mutex) == 0);
+}
 
 /** @brief load a program into memory
  *
- *  memcpy the program regions into memory. It is assumed that paging
- *  information has been setup so copying here should not PAGE FAULT
+ *  copy the program regions into memory. It is assumed that paging
+ *  information has been setup so copying here should not PAGE FAULT.
+ *  Pages mapped from the text cache already hold their contents and 
+ *  are skipped.
  *
  *  @pre paging is enabled and page table information has been setup
  *  @param se_hdr the struct containing ELF data about program
@@ -34,46 +68,62 @@ static int load_segment(const char *filename, void *start,
 int load_program(simple_elf_t *se_hdr) {
     int retval = 0;
 
-    if ((retval = load_segment(se_hdr->e_fname, (void *)se_hdr->e_txtstart, 
+    if ((retval = load_segment(se_hdr, (void *)se_hdr->e_txtstart, 
                               se_hdr->e_txtlen, se_hdr->e_txtoff)) < 0) {
         return retval;
     }
-    if ((retval = load_segment(se_hdr->e_fname, (void *)se_hdr->e_datstart, 
+    if ((retval = load_segment(se_hdr, (void *)se_hdr->e_datstart, 
                               se_hdr->e_datlen, se_hdr->e_datoff)) < 0) {
         return retval;
     }
-    if ((retval = load_segment(se_hdr->e_fname, (void *)se_hdr->e_rodatstart, 
+    if ((retval = load_segment(se_hdr, (void *)se_hdr->e_rodatstart, 
                               se_hdr->e_rodatlen, se_hdr->e_rodatoff)) < 0) {
         return retval;
     }
 
-    /* Load bss section into memory */
-    memset((void *)se_hdr->e_bssstart, 0, se_hdr->e_bsslen);
+    /* Nothing to do for the bss section. Pages it shares with the other
+     * segments were zeroed when they were mapped, the rest are demand
+     * zero pages and get filled in on first touch. */
     return retval;
 }
 
 /** @brief load a program segment into memory
  *
+ *  The segment is copied straight from the RAM disk image into the
+ *  frames of the task.
+ *
+ *  @param se_hdr the parsed elf header of the program
  *  @param start starting address of the segment
  *  @param len length of the segment
  *  @param offset the offset of the segment in the file
  *  @return int 0 on success -ve integer on failure
  */
-int load_segment(const char *filename, void *start, int len, int offset) {
-    char *buf;
+int load_segment(simple_elf_t *se_hdr, void *start, int len, int offset) {
+    const char *bytes;
+    int size = len, done = 0, ret;
 
-	if(len > 0) {
-		buf = (char *)smalloc(len);
-        if (buf == NULL) {
-            return ERR_NOMEM;
-        }
-    	int ret = getbytes(filename, offset, len, buf);
-        if(ret < 0) {
-			sfree(buf, len);
-            return ret;
-        }
-		memcpy(start, buf, len);
-		sfree(buf, len);
+	if(len <= 0) {
+		return 0;
+	}
+	bytes = file_bytes(se_hdr->e_fname, offset, &size);
+	if(bytes == NULL || size < len) {
+		return ERR_FAILURE;
+	}
+
+	/* Text and rodata are read only, write through the frames */
+	while(done < len) {
+		char *addr = (char *)start + done;
+		int chunk = PAGE_SIZE - ((unsigned int)addr & ~PAGE_ROUND_DOWN);
+		if(chunk > len - done) {
+			chunk = len - done;
+		}
+		if(!text_cache_page_shared(se_hdr, (unsigned long)addr)) {
+			ret = copy_to_user_frames(addr, bytes + done, chunk);
+			if(ret < 0) {
+				return ret;
+			}
+		}
+		done += chunk;
 	}
     return 0;
 }
@@ -92,28 +142,47 @@ int getbytes(const char *filename, int offset, int size, char *buf) {
         || size < sizeof(buf)) {
         return ERR_FAILURE;
     }
-    int i;
-    for (i = 0; i < exec2obj_userapp_count; i++) {
-        if (!strncmp(filename, exec2obj_userapp_TOC[i].execname, 
-                    MAX_EXECNAME_LEN)) {
-            size = ((offset + size) <= exec2obj_userapp_TOC[i].execlen) ? size
-                   : (exec2obj_userapp_TOC[i].execlen - offset);
-            if (size <= 0) {
-                break;
-            }
-            memcpy(buf, exec2obj_userapp_TOC[i].execbytes + offset, size);
-            return size;
-        }
+    const char *bytes = file_bytes(filename, offset, &size);
+    if (bytes == NULL) {
+        return ERR_FAILURE;
+    }
+    memcpy(buf, bytes, size);
+    return size;
+}
+
+/**
+ * Copies data from a file into a user buffer.
+ *
+ * @param filename   the name of the file to copy data from
+ * @param offset     the location in the file to begin copying from
+ * @param size       the number of bytes to be copied
+ * @param buf        the user buffer to copy the data into
+ *
+ * @return returns the number of bytes copied on succes; -1 on failure,
+ *         ERR_INVAL if buf is not writable
+ */
+int getbytes_user(const char *filename, int offset, int size, char *buf) {
+    if (filename == NULL || size < 0 || buf == NULL || offset < 0
+        || size < sizeof(buf)) {
+        return ERR_FAILURE;
+    }
+    const char *bytes = file_bytes(filename, offset, &size);
+    if (bytes == NULL) {
+        return ERR_FAILURE;
+    }
+    if (copy_to_user(buf, bytes, size) < 0) {
+        return ERR_INVAL;
     }
-    return ERR_FAILURE;
+    return size;
 }
 
 /**
  * Checks to see if file with name fname is an elf
  * executable binary. If so, fills in se_hdr struct
  * and returns ELF_SUCCESS. If not, returns ELF_NOTELF.
- * Assumes that the magic numbers in the header have been
- * verified.
+ *
+ * The header of a program is parsed the first time it is asked for
+ * and cached, later calls copy the cached simple_elf_t.
  *
  * @param se_hdr   pointer to simple_elf_t struct to be
  *                 filled in. Memory for it has been
@@ -126,6 +195,54 @@ int getbytes(const char *filename, int offset, int size, char *buf) {
  *           we are using in 15-410.
  */
 int elf_load_helper(simple_elf_t *se_hdr, const char *fname) {
+    int index = find_program(fname);
+    if (index < 0) {
+        return ELF_NOTELF;
+    }
+    return lookup_elf(index, se_hdr);
+}
+
+/** @brief look up the parsed header of a program
+ *
+ *  @param index the index of the program in exec2obj_userapp_TOC
+ *  @param se_hdr where to copy the header to, NULL if only the
+ *                validity of the program is wanted
+ *  @return int ELF_SUCCESS if the program is a valid ELF binary,
+ *              ELF_NOTELF if not
+ */
+int lookup_elf(int index, simple_elf_t *se_hdr) {
+    elf_cache_entry_t *entry = &elf_cache[index];
+    const char *fname = exec2obj_userapp_TOC[index].execname;
+    int retval;
+
+    mutex_lock(&elf_cache_mutex);
+    if (entry->state == ELF_CACHE_EMPTY) {
+        if (elf_check_header(fname) == ELF_SUCCESS
+            && parse_elf(&entry->se_hdr, fname) == ELF_SUCCESS) {
+            entry->state = ELF_CACHE_VALID;
+        } else {
+            entry->state = ELF_CACHE_INVALID;
+        }
+    }
+    retval = entry->state == ELF_CACHE_VALID ? ELF_SUCCESS : ELF_NOTELF;
+    if (retval == ELF_SUCCESS && se_hdr != NULL) {
+        *se_hdr = entry->se_hdr;
+    }
+    mutex_unlock(&elf_cache_mutex);
+    return retval;
+}
+
+/** @brief parse the section headers of a program
+ *
+ *  Assumes that the magic numbers in the header have been
+ *  verified.
+ *
+ *  @param se_hdr the simple_elf_t to fill in
+ *  @param fname the name of the program, as found in the RAM disk
+ *  @return int ELF_SUCCESS if se_hdr was filled in, ELF_NOTELF if the
+ *              headers could not be read
+ */
+int parse_elf(simple_elf_t *se_hdr, const char *fname) {
     Elf32_Ehdr elf_hdr;           /* elf header */
     Elf32_Shdr elf_sec_hdr;       /* section header */
     int ret;                      /* various return values */
@@ -299,14 +416,48 @@ int elf_check_header(const char *fname) {
  *              exist or has invalid header
  */
 int check_program(const char *prog_name) {
+    int index = find_program(prog_name);
+    if (index >= 0 && lookup_elf(index, NULL) == ELF_SUCCESS) {
+        return PROG_PRESENT_VALID;
+    }
+    return PROG_ABSENT_INVALID;
+}
+
+/** @brief find a file in the RAM disk
+ *
+ *  @param filename the name of the file
+ *  @return int its index in exec2obj_userapp_TOC, -1 if there is none
+ */
+int find_program(const char *filename) {
     int i;
     for (i = 0; i < exec2obj_userapp_count; i++) {
-        if (!strncmp(prog_name, exec2obj_userapp_TOC[i].execname, 
+        if (!strncmp(filename, exec2obj_userapp_TOC[i].execname, 
                     MAX_EXECNAME_LEN)) {
-            if (elf_check_header(prog_name) == ELF_SUCCESS) {
-                return PROG_PRESENT_VALID;
-            }
+            return i;
         }
     }
-    return PROG_ABSENT_INVALID;
+    return -1;
+}
+
+/** @brief find the bytes of a file from an offset on
+ *
+ *  @param filename the name of the file
+ *  @param offset the location in the file
+ *  @param size the number of bytes wanted, cut down to what the file
+ *              has past offset
+ *  @return const char * the bytes, NULL if there is no such file or
+ *          nothing past offset
+ */
+const char *file_bytes(const char *filename, int offset, int *size) {
+    int i = find_program(filename);
+    if (i < 0) {
+        return NULL;
+    }
+    if (offset + *size > exec2obj_userapp_TOC[i].execlen) {
+        *size = exec2obj_userapp_TOC[i].execlen - offset;
+    }
+    if (*size <= 0) {
+        return NULL;
+    }
+    return exec2obj_userapp_TOC[i].execbytes + offset;
 }
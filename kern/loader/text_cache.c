@@ -0,0 +1,263 @@
+/** @file text_cache.c
+ *  @brief read only pages of programs shared by the tasks running them
+ *
+ *  There is an entry for every file in the RAM disk, in the same order
+ *  as exec2obj_userapp_TOC. It covers the pages from the start of the
+ *  text or rodata section, whichever comes first, to the end of the
+ *  last of the two, and holds a frame for each of them which can be
+ *  shared. Frames are loaded the first time a task needs them and the
+ *  cache keeps a reference on each, so they stay around after the last
+ *  task running the program is gone.
+ *
+ *  When the system runs low on frames, the frames no task maps anymore
+ *  are given back by text_cache_trim(). They get loaded again the next
+ *  time the program is run.
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+#include <loader/text_cache.h>
+#include <loader/loader.h>
+#include <vm/vm.h>
+#include <allocator/frame_allocator.h>
+#include <exec2obj.h>
+#include <page.h>
+#include <string.h>
+#include <stddef.h>
+#include <simics.h>
+#include <sync/mutex.h>
+#include <common/malloc_wrappers.h>
+#include <common/errors.h>
+#include <common/assert.h>
+
+#define PAGE_ROUND_UP(addr) (((addr) + PAGE_SIZE - 1) & PAGE_ROUND_DOWN)
+
+/** @brief the shared pages of one program */
+typedef struct text_cache_entry {
+    unsigned long start;    /* Address of the first page covered */
+    int npages;             /* Number of pages covered */
+    void **frames;          /* Frame of every page, NULL if not loaded */
+} text_cache_entry_t;
+
+static text_cache_entry_t *entries;
+static mutex_t text_cache_mutex;
+static int cached_frames;   /* Frames held by the cache right now */
+static int shared_maps;     /* Pages mapped from the cache since boot */
+
+static void *load_page(simple_elf_t *se_hdr, unsigned long page);
+static void copy_section(char *window, unsigned long page,
+                         const char *fname, unsigned long start,
+                         unsigned long len, unsigned long offset);
+
+/** @brief initialize the text cache
+ *
+ *  @return void
+ */
+void text_cache_init() {
+    entries = smalloc(exec2obj_userapp_count * sizeof(text_cache_entry_t));
+    kernel_assert(entries != NULL);
+    memset(entries, 0, exec2obj_userapp_count * sizeof(text_cache_entry_t));
+    cached_frames = 0;
+    shared_maps = 0;
+    kernel_assert(mutex_init(&text_cache_mutex) == 0);
+}
+
+/** @brief map the shared pages of a program
+ *
+ *  The pages are mapped read only, with frames from the cache. Pages
+ *  not loaded yet are loaded first. The loader leaves these pages
+ *  alone and setup_page_table() keeps the mappings.
+ *
+ *  @pre pd_addr is the current page directory
+ *  @param se_hdr the parsed elf header of the program
+ *  @param pd_addr the page directory of the task
+ *  @return int 0 on success, ERR_NOMEM if out of memory, ERR_FAILURE
+ *          if the program is not in the RAM disk
+ */
+int text_cache_map(simple_elf_t *se_hdr, void *pd_addr) {
+    text_cache_entry_t *entry;
+    unsigned long start = (unsigned long)-1, end = 0, page;
+    int index, i, retval = 0;
+
+    index = find_program(se_hdr->e_fname);
+    if (index < 0) {
+        return ERR_FAILURE;
+    }
+    if (se_hdr->e_txtlen > 0) {
+        start = se_hdr->e_txtstart;
+        end = se_hdr->e_txtstart + se_hdr->e_txtlen;
+    }
+    if (se_hdr->e_rodatlen > 0) {
+        if (se_hdr->e_rodatstart < start) {
+            start = se_hdr->e_rodatstart;
+        }
+        if (se_hdr->e_rodatstart + se_hdr->e_rodatlen > end) {
+            end = se_hdr->e_rodatstart + se_hdr->e_rodatlen;
+        }
+    }
+    if (end == 0) {
+        return 0;
+    }
+    start &= PAGE_ROUND_DOWN;
+    end = PAGE_ROUND_UP(end);
+
+    mutex_lock(&text_cache_mutex);
+    entry = &entries[index];
+    if (entry->frames == NULL) {
+        int npages = (end - start) / PAGE_SIZE;
+        entry->frames = smalloc(npages * sizeof(void *));
+        if (entry->frames == NULL) {
+            mutex_unlock(&text_cache_mutex);
+            return ERR_NOMEM;
+        }
+        memset(entry->frames, 0, npages * sizeof(void *));
+        entry->start = start;
+        entry->npages = npages;
+    }
+    kernel_assert(entry->start == start
+                  && entry->npages == (end - start) / PAGE_SIZE);
+
+    for (i = 0; i < entry->npages; i++) {
+        page = start + i * PAGE_SIZE;
+        if (!text_cache_page_shared(se_hdr, page)) {
+            continue;
+        }
+        if (entry->frames[i] == NULL) {
+            entry->frames[i] = load_page(se_hdr, page);
+            if (entry->frames[i] == NULL) {
+                retval = ERR_NOMEM;
+                break;
+            }
+            cached_frames++;
+        }
+        retval = map_shared_page((void *)page, entry->frames[i], pd_addr,
+                                 PAGE_ENTRY_PRESENT | USER_MODE);
+        if (retval < 0) {
+            break;
+        }
+        shared_maps++;
+    }
+    mutex_unlock(&text_cache_mutex);
+    return retval;
+}
+
+/** @brief check whether a page of a program is shared
+ *
+ *  A page is shared if it holds some text or rodata and neither data
+ *  nor bss.
+ *
+ *  @param se_hdr the parsed elf header of the program
+ *  @param addr an address in the page
+ *  @return int 1 if the page is shared, 0 if not
+ */
+int text_cache_page_shared(simple_elf_t *se_hdr, unsigned long addr) {
+    unsigned long page = addr & PAGE_ROUND_DOWN;
+
+    if (!OVERLAPS_PAGE(se_hdr->e_txtstart, se_hdr->e_txtlen, page)
+        && !OVERLAPS_PAGE(se_hdr->e_rodatstart, se_hdr->e_rodatlen, page)) {
+        return 0;
+    }
+    return !OVERLAPS_PAGE(se_hdr->e_datstart, se_hdr->e_datlen, page)
+           && !OVERLAPS_PAGE(se_hdr->e_bssstart, se_hdr->e_bsslen, page);
+}
+
+/** @brief give back frames which no task maps anymore
+ *
+ *  @param count the number of frames wanted
+ *  @return int the number of frames given back
+ */
+int text_cache_trim(int count) {
+    int index, i, freed = 0;
+
+    mutex_lock(&text_cache_mutex);
+    for (index = 0; index < exec2obj_userapp_count && freed < count;
+         index++) {
+        text_cache_entry_t *entry = &entries[index];
+        for (i = 0; i < entry->npages && freed < count; i++) {
+            void *frame = entry->frames[i];
+            if (frame == NULL || frame_ref_count(frame) != 1) {
+                continue;
+            }
+            frame_unref(frame);
+            deallocate_frame(frame);
+            entry->frames[i] = NULL;
+            cached_frames--;
+            freed++;
+        }
+    }
+    mutex_unlock(&text_cache_mutex);
+    return freed;
+}
+
+/** @brief print the counters of the text cache
+ *
+ *  Used for debugging.
+ *
+ *  @return void
+ */
+void text_cache_print_stats() {
+    lprintf("Shared text frames: %d, pages mapped from them: %d",
+            cached_frames, shared_maps);
+}
+
+/* ---------- Static local functions ----------- */
+
+/** @brief load a shared page of a program into a new frame
+ *
+ *  The parts of the page outside the text and rodata sections are
+ *  zero, just like in a private page.
+ *
+ *  @param se_hdr the parsed elf header of the program
+ *  @param page the address of the page
+ *  @return void * the frame, with a single reference for the cache,
+ *          NULL if out of frames
+ */
+void *load_page(simple_elf_t *se_hdr, unsigned long page) {
+    void *frame = take_reserved_frame();
+    char *window;
+
+    if (frame == NULL) {
+        frame = allocate_zeroed_frame();
+    }
+    if (frame == NULL) {
+        return NULL;
+    }
+    frame_ref(frame);
+
+    window = temp_map_frame(frame);
+    copy_section(window, page, se_hdr->e_fname, se_hdr->e_txtstart,
+                 se_hdr->e_txtlen, se_hdr->e_txtoff);
+    copy_section(window, page, se_hdr->e_fname, se_hdr->e_rodatstart,
+                 se_hdr->e_rodatlen, se_hdr->e_rodatoff);
+    temp_unmap_frame(window);
+    return frame;
+}
+
+/** @brief copy the part of a section falling in a page
+ *
+ *  @param window the page, mapped in kernel memory
+ *  @param page the user address of the page
+ *  @param fname the name of the program
+ *  @param start the user address of the section
+ *  @param len the length of the section
+ *  @param offset the offset of the section in the file
+ *  @return void
+ */
+void copy_section(char *window, unsigned long page, const char *fname,
+                  unsigned long start, unsigned long len,
+                  unsigned long offset) {
+    unsigned long from, to;
+    const char *bytes;
+    int size;
+
+    if (!OVERLAPS_PAGE(start, len, page)) {
+        return;
+    }
+    from = start > page ? start : page;
+    to = start + len < page + PAGE_SIZE ? start + len : page + PAGE_SIZE;
+    size = to - from;
+    bytes = file_bytes(fname, offset + (from - start), &size);
+    if (bytes != NULL) {
+        memcpy(window + (from - page), bytes, size);
+    }
+}
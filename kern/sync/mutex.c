@@ -113,6 +113,31 @@ void mutex_lock(mutex_t *mp) {
 	enable_interrupts_mutex();
 }
 
+/** @brief acquire the lock only if it is free
+ *
+ *  Never blocks. Meant for callers such as the idle thread, which must
+ *  not end up on a wait queue.
+ *
+ *  @param mp the mutex to be locked
+ *  @return 0 if the lock was acquired, ERR_BUSY if someone holds it
+ */
+int mutex_trylock(mutex_t *mp) {
+	thread_assert(mp != NULL);
+	thread_assert(mp->value != MUTEX_INVALID);
+	int int_flag = get_eflags() & EFLAGS_IF;
+	int retval = ERR_BUSY;
+
+	disable_interrupts_mutex();
+	if(mp->value != 0) {
+		mp->value = 0;
+		retval = 0;
+	}
+	if (int_flag) {
+		enable_interrupts_mutex();
+	}
+	return retval;
+}
+
 /** @brief release a lock
  *
  *  When the lock is released, the first thread
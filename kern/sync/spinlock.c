@@ -0,0 +1,221 @@
+/** @file spinlock.c
+ *  @brief Implementation of spinlocks and ticket locks
+ *
+ *  These are meant for critical sections of a few dozen instructions,
+ *  where blocking and being woken up would cost more than the wait.
+ *  They never sleep, so they can be taken from interrupt handlers and
+ *  by the idle thread.
+ *
+ *  Interrupts must stay disabled while one of them is held. Otherwise a
+ *  thread switched out with the lock would leave every other thread of
+ *  its processor spinning until the next timer tick, and an interrupt
+ *  handler taking the lock would spin forever. The irqsave variants
+ *  take care of that; the plain ones are for callers which already run
+ *  with interrupts disabled. On one processor the lock is then always
+ *  free when asked for, and only the statistics show otherwise.
+ *
+ *  A spinlock is a single word swapped with xchg, and whoever sees it
+ *  free first gets it. A ticket lock hands out tickets and serves them
+ *  in order, so nobody waits forever under contention.
+ *
+ *  The run queue, the timing wheel, the thread map, the kernel stack
+ *  cache and the frame allocator are protected by these. The blocking
+ *  mutexes and condition variables, and the fault paths which rely on
+ *  them or on disabling interrupts, still assume that kernel code only
+ *  runs on one processor at a time.
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+#include <sync/spinlock.h>
+#include <asm/asm.h>
+#include <asm.h>
+#include <eflags.h>
+#include <common/errors.h>
+#include <string.h>
+#include <simics.h>
+
+/** @brief initialize a spinlock, which starts out free
+ *
+ *  @param lock the lock
+ *  @return void
+ */
+void spin_init(spinlock_t *lock) {
+    lock->locked = 0;
+    memset(&lock->stats, 0, sizeof(lock->stats));
+}
+
+/** @brief take a spinlock, spinning until it is free
+ *
+ *  While the lock is held by someone else it is only read, so the
+ *  waiting processors do not keep taking the cache line from the holder.
+ *
+ *  @pre interrupts are disabled
+ *  @param lock the lock
+ *  @return void
+ */
+void spin_lock(spinlock_t *lock) {
+    int contended = 0;
+
+    while (atomic_xchg(&lock->locked, 1) != 0) {
+        contended = 1;
+        while (lock->locked) {
+            cpu_relax();
+        }
+    }
+    lock->stats.acquisitions++;
+    lock->stats.contended += contended;
+}
+
+/** @brief take a spinlock only if it is free
+ *
+ *  @pre interrupts are disabled
+ *  @param lock the lock
+ *  @return int 0 if the lock was taken, ERR_BUSY if it is held
+ */
+int spin_trylock(spinlock_t *lock) {
+    if (lock->locked || atomic_xchg(&lock->locked, 1) != 0) {
+        return ERR_BUSY;
+    }
+    lock->stats.acquisitions++;
+    return 0;
+}
+
+/** @brief release a spinlock
+ *
+ *  The lock is released with xchg rather than a plain store. Being a
+ *  call into assembly it keeps the compiler from moving the stores of
+ *  the critical section past it, and being locked it keeps the
+ *  processor from doing so.
+ *
+ *  @param lock the lock, held by the caller
+ *  @return void
+ */
+void spin_unlock(spinlock_t *lock) {
+    atomic_xchg(&lock->locked, 0);
+}
+
+/** @brief disable interrupts and take a spinlock
+ *
+ *  @param lock the lock
+ *  @return int whether interrupts were enabled, for
+ *          spin_unlock_irqrestore()
+ */
+int spin_lock_irqsave(spinlock_t *lock) {
+    int int_flag = get_eflags() & EFL_IF;
+
+    disable_interrupts();
+    spin_lock(lock);
+    return int_flag;
+}
+
+/** @brief release a spinlock and enable interrupts if they were before
+ *
+ *  @param lock the lock, held by the caller
+ *  @param int_flag the value spin_lock_irqsave() returned
+ *  @return void
+ */
+void spin_unlock_irqrestore(spinlock_t *lock, int int_flag) {
+    spin_unlock(lock);
+    if (int_flag) {
+        enable_interrupts();
+    }
+}
+
+/** @brief initialize a ticket lock, which starts out free
+ *
+ *  @param lock the lock
+ *  @return void
+ */
+void ticket_init(ticket_lock_t *lock) {
+    lock->next = 0;
+    lock->owner = 0;
+    memset(&lock->stats, 0, sizeof(lock->stats));
+}
+
+/** @brief take a ticket lock, waiting for the ones who came earlier
+ *
+ *  @pre interrupts are disabled
+ *  @param lock the lock
+ *  @return void
+ */
+void ticket_lock(ticket_lock_t *lock) {
+    int ticket = atomic_add(&lock->next, 1) - 1;
+
+    if (lock->owner != ticket) {
+        lock->stats.contended++;
+        while (lock->owner != ticket) {
+            cpu_relax();
+        }
+    }
+    lock->stats.acquisitions++;
+}
+
+/** @brief take a ticket lock only if nobody holds it or waits for it
+ *
+ *  @pre interrupts are disabled
+ *  @param lock the lock
+ *  @return int 0 if the lock was taken, ERR_BUSY if not
+ */
+int ticket_trylock(ticket_lock_t *lock) {
+    int owner = lock->owner;
+
+    if (lock->next != owner
+        || atomic_cmpxchg(&lock->next, owner, owner + 1) != owner) {
+        return ERR_BUSY;
+    }
+    lock->stats.acquisitions++;
+    return 0;
+}
+
+/** @brief release a ticket lock, to whoever came next
+ *
+ *  Like spin_unlock(), the release is an atomic operation so that
+ *  nothing from the critical section is moved past it.
+ *
+ *  @param lock the lock, held by the caller
+ *  @return void
+ */
+void ticket_unlock(ticket_lock_t *lock) {
+    atomic_add(&lock->owner, 1);
+}
+
+/** @brief disable interrupts and take a ticket lock
+ *
+ *  @param lock the lock
+ *  @return int whether interrupts were enabled, for
+ *          ticket_unlock_irqrestore()
+ */
+int ticket_lock_irqsave(ticket_lock_t *lock) {
+    int int_flag = get_eflags() & EFL_IF;
+
+    disable_interrupts();
+    ticket_lock(lock);
+    return int_flag;
+}
+
+/** @brief release a ticket lock and enable interrupts if they were before
+ *
+ *  @param lock the lock, held by the caller
+ *  @param int_flag the value ticket_lock_irqsave() returned
+ *  @return void
+ */
+void ticket_unlock_irqrestore(ticket_lock_t *lock, int int_flag) {
+    ticket_unlock(lock);
+    if (int_flag) {
+        enable_interrupts();
+    }
+}
+
+/** @brief print the statistics of a lock
+ *
+ *  Used for debugging.
+ *
+ *  @param name what the lock protects
+ *  @param stats the statistics of the lock
+ *  @return void
+ */
+void lock_print_stats(const char *name, lock_stats_t *stats) {
+    lprintf("Lock %s: taken %d times, %d of them contended", name,
+            stats->acquisitions, stats->contended);
+}
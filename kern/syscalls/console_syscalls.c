@@ -15,6 +15,11 @@
 #include <stdio.h>
 #include <syscalls/syscall_util.h>
 #include <vm/vm.h>
+#include <vm/uaccess.h>
+#include <drivers/keyboard/keyboard_circular_buffer.h>
+#include <common/malloc_wrappers.h>
+
+#define PRINT_CHUNK_SIZE 256
 
 /** @brief print to screen 
  *
@@ -22,12 +27,26 @@
  *  @return int 0 on success, -ve integer on failure
  */
 int print_handler_c(void *arg_packet) {
-    int len = *(int *)arg_packet;
-    char *buf = (char *)(*((int *)arg_packet + 1));
-    if (is_pointer_valid(buf, len) < 0) {
+    int args[2];
+    char kbuf[PRINT_CHUNK_SIZE];
+
+    if (copy_from_user(args, arg_packet, sizeof(args)) < 0) {
+        return ERR_INVAL;
+    }
+    int len = args[0];
+    char *buf = (char *)args[1];
+    if (len < 0) {
         return ERR_INVAL;
     }
-    putbytes(buf, len);
+    while (len > 0) {
+        int chunk = len < PRINT_CHUNK_SIZE ? len : PRINT_CHUNK_SIZE;
+        if (copy_from_user(kbuf, buf, chunk) < 0) {
+            return ERR_INVAL;
+        }
+        putbytes(kbuf, chunk);
+        buf += chunk;
+        len -= chunk;
+    }
     return 0;
 }
 
@@ -37,29 +56,34 @@ int print_handler_c(void *arg_packet) {
  *  @return int number of bytes copied into the buffer
  */
 int readline_handler_c(void *arg_packet) {
-    int len = *(int *)arg_packet;
-    if (len <= 0) {
+    int args[2];
+
+    if (copy_from_user(args, arg_packet, sizeof(args)) < 0) {
         return ERR_INVAL;
     }
-    char *buf = (char *)(*((int *)arg_packet + 1));
-    if (is_pointer_valid(buf, len) < 0
-        || is_memory_writable(buf, len) < 0) {
+    int len = args[0];
+    char *buf = (char *)args[1];
+    if (len <= 0 || len >= KEYBOARD_BUFFER_SIZE) {
         return ERR_INVAL;
     }
+    char *kbuf = (char *)smalloc(len);
+    if (kbuf == NULL) {
+        return ERR_NOMEM;
+    }
     thread_struct_t *curr_thread = get_curr_thread();
 
     mutex_lock(&readline_mutex);
-    int retval = nextline(buf, len);
-    if (retval == ERR_INVAL) {
-		mutex_unlock(&readline_mutex);
-        return ERR_INVAL;
-    }
+    int retval = nextline(kbuf, len);
     while (retval == ERR_NOTAVAIL) {
         cond_wait(&readline_cond_var, &readline_mutex, 
                   &curr_thread->cond_wait_link, WAITING);
-        retval = nextline(buf, len);
+        retval = nextline(kbuf, len);
     }
     mutex_unlock(&readline_mutex);
+    if (retval > 0 && copy_to_user(buf, kbuf, retval) < 0) {
+        retval = ERR_INVAL;
+    }
+    sfree(kbuf, len);
     return retval;
 }
 
@@ -97,9 +121,11 @@ int set_term_color_handler_c(int color) {
  *  @return int 0 on success, -ve integer on failure
  */
 int set_cursor_pos_handler_c(void *arg_packet) {
-    int row = *(int *)arg_packet;
-    int col = *((int *)arg_packet + 1);
-    return set_cursor(row, col);
+    int args[2];
+    if (copy_from_user(args, arg_packet, sizeof(args)) < 0) {
+        return ERR_INVAL;
+    }
+    return set_cursor(args[0], args[1]);
 }
 
 /** @brief get the cursor position
@@ -109,17 +135,17 @@ int set_cursor_pos_handler_c(void *arg_packet) {
  *  @return int 0 on success, -ve integer on failure
  */
 int get_cursor_pos_handler_c(void *arg_packet) {
-    int *row = (int *)(*(int *)arg_packet);
-    if (is_pointer_valid(row, sizeof(int)) < 0
-        || is_memory_writable(row, sizeof(int)) < 0) {
+    int args[2];
+    int row, col;
+
+    if (copy_from_user(args, arg_packet, sizeof(args)) < 0) {
         return ERR_INVAL;
     }
-    int *col = (int *)(*((int *)arg_packet + 1));
-    if (is_pointer_valid(col, sizeof(int)) < 0
-        || is_memory_writable(col, sizeof(int)) < 0) {
+    get_cursor(&row, &col);
+    if (copy_to_user((int *)args[0], &row, sizeof(int)) < 0
+        || copy_to_user((int *)args[1], &col, sizeof(int)) < 0) {
         return ERR_INVAL;
     }
-    get_cursor(row, col);
     return 0;
 }
 
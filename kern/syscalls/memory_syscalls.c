@@ -11,6 +11,8 @@
 #include <common/errors.h>
 #include <simics.h>
 #include <core/thread.h>
+#include <core/task.h>
+#include <core/scheduler.h>
 
 /** @brief Handler to call the new_pages handler function
  *
@@ -19,14 +21,18 @@
 int new_pages_handler_c(void *arg_packet) {
     void *base = (void *)(*(int *)arg_packet);
     int len = (int)(*((int *)arg_packet + 1));  
+    task_struct_t *t = get_curr_task();
+    int retval;
     if (len <= 0 || (len % PAGE_SIZE) != 0 || ((int)base % PAGE_SIZE) != 0) {
         return ERR_INVAL;
     }
-    if (is_memory_range_mapped(base, len) != MEMORY_REGION_UNMAPPED) {
-        return ERR_INVAL;
-    }
     
-    return map_new_pages(base, len);
+    /* The overlap check and the mapping must look atomic to other 
+     * threads of the task */
+    mutex_lock(&t->region_mutex);
+    retval = map_new_pages(base, len, &t->regions);
+    mutex_unlock(&t->region_mutex);
+    return retval;
 }
 
 /** @brief Handler to call the remove_pages handler function
@@ -34,9 +40,14 @@ int new_pages_handler_c(void *arg_packet) {
  *  @return int 0 on success, -ve integer on failure
  */
 int remove_pages_handler_c(void *base) {
+    task_struct_t *t = get_curr_task();
+    int retval;
     if (((int)base % PAGE_SIZE) != 0) {
         return ERR_INVAL;
     }
     
-    return unmap_new_pages(base);
+    mutex_lock(&t->region_mutex);
+    retval = unmap_new_pages(base, &t->regions);
+    mutex_unlock(&t->region_mutex);
+    return retval;
 }
@@ -5,8 +5,10 @@
  *  @author Rohit Upadhyaya (rjupadhy)
  *  @author Prajwal Yadapadithaya (pyadapad)
  */
+#include <syscalls/misc_syscalls.h>
 #include <vm/vm.h>
 #include <syscalls/syscall_util.h>
+#include <vm/uaccess.h>
 #include <loader/loader.h>
 #include <common/errors.h>
 #include <simics.h>
@@ -18,25 +20,38 @@
  * @return int 0 on success -ve integer on failure
  */
 int readfile_handler_c(void *arg_packet) {
-    char *filename = (char *)(*((int *)arg_packet));
-    int count;
-    for (count = 0; count < MAX_FILE_NAME; count++) {
-        if (is_pointer_valid(&filename[count], 1) < 0) {
-            return ERR_INVAL;
-        }
-        if (filename[count] == '\0') {
-            break;
-        }
+    int args[4];
+    char filename[MAX_FILE_NAME];
+    int retval;
+
+    if (copy_from_user(args, arg_packet, sizeof(args)) < 0) {
+        return ERR_INVAL;
+    }
+    retval = copy_string_from_user(filename, (char *)args[0], MAX_FILE_NAME);
+    if (retval == ERR_INVAL) {
+        return ERR_INVAL;
     }
-    if (count == 0 || count == MAX_FILE_NAME) {
+    if (retval == ERR_BIG || retval == 1) {
         return ERR_FAILURE;
     }
 
-    char *buf = (char *)(*((int *)arg_packet + 1));
-    int size = (int)(*((int *)arg_packet + 2));
-    int offset = (int)(*((int *)arg_packet + 3));
-    int bytes_read = getbytes(filename, offset, size, buf);
+    char *buf = (char *)args[1];
+    int size = args[2];
+    int offset = args[3];
+    int bytes_read = getbytes_user(filename, offset, size, buf);
 
     return bytes_read;
 }
 
+/** @brief change the behavior of the kernel, for testing
+ *
+ *  The kernel has no alternative behaviors for user programs to pick,
+ *  so every mode is ignored. Settings which change the behavior for
+ *  all tasks, like the color aware frame allocation, are made on the
+ *  kernel command line instead.
+ *
+ *  @param mode the requested mode
+ *  @return void
+ */
+void misbehave_handler_c(int mode) {
+}
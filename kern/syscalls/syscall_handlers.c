@@ -42,6 +42,10 @@ static int install_set_cursor_pos_handler();
 static int install_get_cursor_pos_handler();
 static int install_getchar_handler();
 static int install_memcheck_handler();
+static int install_misbehave_handler();
+static int install_memory_stats_handler();
+static int install_set_priority_handler();
+static int install_set_weight_handler();
 
 /** @brief The syscall handlers initialization function
  *
@@ -88,6 +92,15 @@ int install_syscall_handlers() {
     if((retval = install_memcheck_handler()) < 0) {
 		return retval;
 	}
+    if((retval = install_memory_stats_handler()) < 0) {
+		return retval;
+	}
+    if((retval = install_set_priority_handler()) < 0) {
+		return retval;
+	}
+    if((retval = install_set_weight_handler()) < 0) {
+		return retval;
+	}
     if((retval = install_gettid_handler()) < 0) {
 		return retval;
 	}
@@ -121,6 +134,9 @@ int install_syscall_handlers() {
     if((retval = install_getchar_handler()) < 0) {
 		return retval;
 	}
+    if((retval = install_misbehave_handler()) < 0) {
+		return retval;
+	}
     return retval;
 }
 
@@ -236,6 +252,42 @@ int install_memcheck_handler() {
 							INTERRUPT_GATE, USER_DPL);
 }
 
+/** @brief Function to install a handler for memory_stats syscall
+ *
+ *  @return int return value of add_idt_entry
+ */
+int install_memory_stats_handler() {
+    return add_idt_entry(memory_stats_handler, SYSCALL_RESERVED_2, 
+							TRAP_GATE, USER_DPL);
+}
+
+/** @brief Function to install a handler for set_priority syscall
+ *
+ *  @return int return value of add_idt_entry
+ */
+int install_set_priority_handler() {
+    return add_idt_entry(set_priority_handler, SYSCALL_RESERVED_3, 
+							TRAP_GATE, USER_DPL);
+}
+
+/** @brief Function to install a handler for set_weight syscall
+ *
+ *  @return int return value of add_idt_entry
+ */
+int install_set_weight_handler() {
+    return add_idt_entry(set_weight_handler, SYSCALL_RESERVED_4, 
+							TRAP_GATE, USER_DPL);
+}
+
+/** @brief Function to install a handler for misbehave syscall
+ *
+ *  @return int return value of add_idt_entry
+ */
+int install_misbehave_handler() {
+	return add_idt_entry(misbehave_handler, MISBEHAVE_INT, 
+							TRAP_GATE, USER_DPL);
+}
+
 /** @brief Function to install a handler for sleep syscall
  *
  *  @return int return value of add_idt_entry
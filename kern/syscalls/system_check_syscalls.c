@@ -7,6 +7,14 @@
  */
 #include <syscalls/system_check_syscalls.h>
 #include <vm/vm.h>
+#include <vm/uaccess.h>
+#include <core/task.h>
+#include <core/scheduler.h>
+#include <sync/mutex.h>
+#include <vm/zswap.h>
+#include <vm/merge.h>
+#include <vm/reaper.h>
+#include <loader/text_cache.h>
 #include <syscall.h>
 #include <common/errors.h>
 #include <simics.h>
@@ -22,6 +30,41 @@ void memory_check_handler_c() {
     /* Check physical frame (count, etc) */
     check_physical_memory();
 
+    /* Compressed pages and how often they are faulted back in */
+    zswap_print_stats();
+
+    /* Pages merged by the idle thread */
+    merge_print_stats();
+
+    /* Address spaces of dead tasks freed in the background */
+    reaper_print_stats();
+
+    /* Program text shared between tasks */
+    text_cache_print_stats();
+
     /* Check kernel memory */
     lmm_dump(&malloc_lmm);
 }
+
+/** @brief Handler for the memory_stats system call
+ *
+ *  Counts the pages of the calling task and copies the counts out
+ *  together with the fault counters of the whole system.
+ *
+ *  @param stats where to put the counters, in user memory
+ *  @return int 0 on success, ERR_INVAL if stats cannot be written to
+ */
+int memory_stats_handler_c(memory_stats_t *stats) {
+    task_struct_t *t = get_curr_task();
+    memory_stats_t out;
+
+    mutex_lock(&t->region_mutex);
+    get_task_vm_stats(&t->regions, &out.task);
+    mutex_unlock(&t->region_mutex);
+    get_vm_fault_stats(&out.faults);
+
+    if (copy_to_user(stats, &out, sizeof(memory_stats_t)) < 0) {
+        return ERR_INVAL;
+    }
+    return 0;
+}
@@ -17,6 +17,8 @@
 #include <syscalls/syscall_util.h>
 #include <ureg.h>
 #include <vm/vm.h>
+#include <vm/uaccess.h>
+#include <interrupts/fault_handlers.h>
 
 /** @brief implement the functionality to get the tid
  *         from the global curr_thread struct. This passes
@@ -64,12 +66,14 @@ int sleep_handler_c(int ticks) {
  *              if reject is invalid pointer.
  */
 int deschedule_handler_c(int *reject) {
-    if (is_pointer_valid(reject, sizeof(int *)) < 0) {
-        return ERR_INVAL;
-    }
     thread_struct_t *thr = get_curr_thread();
+    int reject_val;
     mutex_lock(&thr->deschedule_mutex);
-    if (*reject != 0) {
+    if (copy_from_user(&reject_val, reject, sizeof(int)) < 0) {
+        mutex_unlock(&thr->deschedule_mutex);
+        return ERR_INVAL;
+    }
+    if (reject_val != 0) {
         mutex_unlock(&thr->deschedule_mutex);
         return 0;
     }
@@ -103,6 +107,48 @@ int make_runnable_handler_c(int tid) {
     return 0;
 }
 
+/** @brief set the priority of a thread
+ *
+ *  @param arg_packet the address of the arguments, the id of the
+ *         thread and the priority, 0 being the highest
+ *  @return int 0 on success, ERR_INVAL if the arguments cannot be read,
+ *          the thread does not exist or the priority is out of range
+ */
+int set_priority_handler_c(void *arg_packet) {
+    int args[2];
+    thread_struct_t *thr;
+
+    if (copy_from_user(args, arg_packet, sizeof(args)) < 0) {
+        return ERR_INVAL;
+    }
+    thr = get_thread_from_id(args[0]);
+    if (thr == NULL) {
+        return ERR_INVAL;
+    }
+    return sched_set_priority(thr, args[1]);
+}
+
+/** @brief set the weight of a task, which decides its share of the CPU
+ *
+ *  @param arg_packet the address of the arguments, the id of a thread
+ *         of the task and the weight
+ *  @return int 0 on success, ERR_INVAL if the arguments cannot be read,
+ *          the thread does not exist or the weight is out of range
+ */
+int set_weight_handler_c(void *arg_packet) {
+    int args[2];
+    thread_struct_t *thr;
+
+    if (copy_from_user(args, arg_packet, sizeof(args)) < 0) {
+        return ERR_INVAL;
+    }
+    thr = get_thread_from_id(args[0]);
+    if (thr == NULL) {
+        return ERR_INVAL;
+    }
+    return sched_set_weight(thr->parent_task, args[1]);
+}
+
 /** @brief get the number of ticks since system boot
  *
  *  @return unsigned int number of ticks since system boot
@@ -121,21 +167,31 @@ unsigned int get_ticks_handler_c() {
  *  @return int 0 on success, -ve integer on failure
  */
 int swexn_handler_c(void *arg_packet) {
-    void *esp3 = (void *)(*((int *)arg_packet));
-    if (esp3 != NULL && (is_pointer_valid(esp3, 4) < 0
-        || is_memory_writable(esp3, 4) < 0)) {
+    int args[4];
+    char probe[4];
+    ureg_t newureg;
+
+    if (copy_from_user(args, arg_packet, sizeof(args)) < 0) {
+        return ERR_INVAL;
+    }
+    /* The exception frame is written right below esp3 */
+    void *esp3 = (void *)args[0];
+    if (esp3 != NULL
+        && check_user_writable((char *)esp3 - sizeof(swexn_frame_t),
+                               sizeof(swexn_frame_t)) < 0) {
         return ERR_INVAL;
     }
 
-    swexn_handler_t eip = (void *)(*((int *)arg_packet + 1));
-    if (eip != NULL && (is_pointer_valid(eip, 4) < 0)) {
+    swexn_handler_t eip = (swexn_handler_t)args[1];
+    if (eip != NULL && copy_from_user(probe, eip, 4) < 0) {
         return ERR_INVAL;
     }
 
-    void *arg = (void *)(*((int *)arg_packet + 2));
+    void *arg = (void *)args[2];
 
-    ureg_t *newureg = (ureg_t *)(*((int *)arg_packet + 3));
-    if (newureg != NULL && (is_pointer_valid(newureg, 4) < 0)) {
+    ureg_t *user_ureg = (ureg_t *)args[3];
+    if (user_ureg != NULL
+        && copy_from_user(&newureg, user_ureg, sizeof(ureg_t)) < 0) {
         return ERR_INVAL;
     }
 
@@ -150,13 +206,13 @@ int swexn_handler_c(void *arg_packet) {
     curr_task->swexn_args = arg;
     curr_task->swexn_esp = esp3;
 
-    if (newureg != NULL) {
-        int retval = setup_kernel_stack(newureg, 
+    if (user_ureg != NULL) {
+        int retval = setup_kernel_stack(&newureg, 
                                        (void *)curr_thread->k_stack_base);
         if (retval < 0) {
             return ERR_FAILURE;
         }
-		return newureg->eax;
+		return newureg.eax;
     }
     return 0;
 }
@@ -0,0 +1,103 @@
+/** @file kstack.c
+ *  @brief kernel stacks for threads
+ *
+ *  The kernel part above KERNEL_HIGH_START is cut into slots, each
+ *  holding a guard page followed by one kernel stack. Slots which were
+ *  never used are handed out in order, freed ones are kept on a stack
+ *  and reused first.
+ *
+ *  The slots are protected by a spinlock rather than a mutex, since a
+ *  vanishing thread frees its stack with interrupts disabled, running
+ *  on the stack shared by dead threads, where it must not block or let
+ *  another thread in.
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+#include <vm/kstack.h>
+#include <vm/vm.h>
+#include <page.h>
+#include <allocator/frame_allocator.h>
+#include <sync/spinlock.h>
+#include <stddef.h>
+
+#define KSTACK_SLOT_SIZE (KERNEL_STACK_SIZE + PAGE_SIZE)
+#define KSTACK_NUM_SLOTS ((PT_WINDOW_START - KERNEL_HIGH_START) \
+                          / KSTACK_SLOT_SIZE)
+#define SLOT_STACK(slot) ((char *)KERNEL_HIGH_START \
+                          + (slot) * KSTACK_SLOT_SIZE + PAGE_SIZE)
+#define STACK_SLOT(stack) (((char *)(stack) - PAGE_SIZE \
+                            - (char *)KERNEL_HIGH_START) / KSTACK_SLOT_SIZE)
+
+static int free_slots[KSTACK_NUM_SLOTS];
+static int num_free_slots;
+static int next_unused_slot;
+static spinlock_t kstack_lock;
+
+/** @brief initialize the kernel stack allocator
+ *
+ *  @return void
+ */
+void kstack_init() {
+    num_free_slots = 0;
+    next_unused_slot = 0;
+    spin_init(&kstack_lock);
+}
+
+/** @brief allocate a kernel stack
+ *
+ *  @return void * the lowest address of the stack, NULL if out of frames
+ *          or slots
+ */
+void *kstack_alloc() {
+    void *frames[KERNEL_STACK_PAGES];
+    int nframes, slot = -1, int_flag, i;
+
+    nframes = allocate_frames(frames, KERNEL_STACK_PAGES);
+    if (nframes < KERNEL_STACK_PAGES) {
+        free_frames(frames, nframes);
+        return NULL;
+    }
+
+    int_flag = spin_lock_irqsave(&kstack_lock);
+    if (num_free_slots > 0) {
+        slot = free_slots[--num_free_slots];
+    } else if (next_unused_slot < KSTACK_NUM_SLOTS) {
+        slot = next_unused_slot++;
+    }
+    spin_unlock_irqrestore(&kstack_lock, int_flag);
+    if (slot < 0) {
+        free_frames(frames, nframes);
+        return NULL;
+    }
+
+    for (i = 0; i < KERNEL_STACK_PAGES; i++) {
+        map_kernel_page(SLOT_STACK(slot) + i * PAGE_SIZE, frames[i]);
+    }
+    return SLOT_STACK(slot);
+}
+
+/** @brief free a kernel stack
+ *
+ *  Never blocks, and leaves interrupts disabled if they were.
+ *
+ *  @pre the stack is not the one in use
+ *  @param stack the address returned by kstack_alloc()
+ *  @return void
+ */
+void kstack_free(void *stack) {
+    void *frames[KERNEL_STACK_PAGES];
+    int int_flag, i;
+
+    if (stack == NULL) {
+        return;
+    }
+    for (i = 0; i < KERNEL_STACK_PAGES; i++) {
+        frames[i] = unmap_kernel_page((char *)stack + i * PAGE_SIZE);
+    }
+    free_frames(frames, KERNEL_STACK_PAGES);
+
+    int_flag = spin_lock_irqsave(&kstack_lock);
+    free_slots[num_free_slots++] = STACK_SLOT(stack);
+    spin_unlock_irqrestore(&kstack_lock, int_flag);
+}
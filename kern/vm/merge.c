@@ -0,0 +1,441 @@
+/** @file merge.c
+ *  @brief merging identical user pages while the system is idle
+ *
+ *  On every timer tick spent in the idle thread, a few more pages of
+ *  the tasks are looked at. A private page which was not written to
+ *  since the scan last passed it is hashed. A page of zeroes is
+ *  replaced by the shared zero frame. Otherwise the hash picks a slot
+ *  in a table of merged frames: if the frame there has the same
+ *  contents the page is mapped to it, and if the slot is empty the page
+ *  becomes the merged frame for its contents. Either way the page ends
+ *  up read only, and COW if it was writable, so the usual COW handling
+ *  gives a writer its own copy again.
+ *
+ *  The table holds a reference on each of its frames, which keeps them
+ *  from being freed or made writable behind its back. Frames nobody
+ *  maps anymore are dropped from the table a few slots per tick.
+ *
+ *  The idle thread must never block, so everything here is done with
+ *  interrupts disabled and with locks taken only if they are free. A
+ *  task whose region mutex or exec mutex is held is skipped, which
+ *  keeps page tables from changing under the scan. Frames freed by
+ *  merging wait in a small array for a free list that is not locked.
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+#include <vm/merge.h>
+#include <vm/vm.h>
+#include <vm/region.h>
+#include <allocator/frame_allocator.h>
+#include <list/list.h>
+#include <sync/mutex.h>
+#include <common_kern.h>
+#include <asm.h>
+#include <cr.h>
+#include <eflags.h>
+#include <string.h>
+#include <stddef.h>
+#include <simics.h>
+
+#define WORDS_PER_PAGE (PAGE_SIZE / sizeof(unsigned int))
+#define MERGE_PENDING_MAX (2 * MERGE_HASHES_PER_TICK + MERGE_SWEEP_PER_TICK)
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+/** @brief a frame holding contents shared by several pages */
+typedef struct merge_slot {
+    unsigned int hash;      /* Hash of the contents of the frame */
+    void *frame;            /* The frame, NULL if the slot is empty */
+} merge_slot_t;
+
+/** @brief the work left for the current tick */
+typedef struct merge_budget {
+    int visits;             /* Page table entries still to look at */
+    int hashes;             /* Pages still to hash */
+} merge_budget_t;
+
+static merge_slot_t table[MERGE_TABLE_SIZE];
+static int sweep_slot;          /* Next slot to check for a stale frame */
+
+static list_head merge_tasks;   /* Tasks whose pages are scanned */
+static mutex_t merge_tasks_mutex;
+static task_struct_t *scan_task;    /* Task being scanned, NULL for none */
+static unsigned int scan_addr;      /* Next address to look at in it */
+
+/* Frames which are no longer used, waiting to be freed */
+static void *pending[MERGE_PENDING_MAX];
+static int num_pending;
+
+static merge_stats_t stats;
+
+static void scan_tasks(merge_budget_t *budget);
+static int scan_task_pages(task_struct_t *t, merge_budget_t *budget);
+static void merge_page(unsigned int *pte, merge_budget_t *budget);
+static unsigned int hash_page(const unsigned int *page, int *is_zero);
+static unsigned int shared_flags(unsigned int entry);
+static void sweep_table();
+static void release_slot(merge_slot_t *slot);
+static void drop_frame(void *frame_addr);
+static void flush_pending();
+
+/** @brief initialize page merging
+ *
+ *  @return void
+ */
+void merge_init() {
+    init_head(&merge_tasks);
+    mutex_init(&merge_tasks_mutex);
+    scan_task = NULL;
+    sweep_slot = 0;
+    num_pending = 0;
+    memset(table, 0, sizeof(table));
+    memset(&stats, 0, sizeof(stats));
+}
+
+/** @brief have the pages of a task scanned for merging
+ *
+ *  @param t the task, whose pdbr is NULL until it has an address space
+ *  @return void
+ */
+void merge_add_task(task_struct_t *t) {
+    mutex_lock(&merge_tasks_mutex);
+    add_to_tail(&t->merge_link, &merge_tasks);
+    mutex_unlock(&merge_tasks_mutex);
+}
+
+/** @brief stop scanning the pages of a task
+ *
+ *  Once this returns, the scan is not looking at the task and never
+ *  will again, so its address space can be torn down.
+ *
+ *  @param t the task
+ *  @return void
+ */
+void merge_remove_task(task_struct_t *t) {
+    mutex_lock(&merge_tasks_mutex);
+    if (scan_task == t) {
+        scan_task = NULL;
+    }
+    del_entry(&t->merge_link);
+    mutex_unlock(&merge_tasks_mutex);
+}
+
+/** @brief look at a few more pages for merging
+ *
+ *  Called from the loop of the idle thread, once per timer tick.
+ *
+ *  @return void
+ */
+void merge_pages_idle() {
+    merge_budget_t budget = { MERGE_VISITS_PER_TICK, MERGE_HASHES_PER_TICK };
+    int int_flag = get_eflags() & EFL_IF;
+
+    disable_interrupts();
+    flush_pending();
+    if (num_pending == 0 && mutex_trylock(&merge_tasks_mutex) == 0) {
+        sweep_table();
+        scan_tasks(&budget);
+        mutex_unlock_int_save(&merge_tasks_mutex);
+        flush_pending();
+    }
+    if (int_flag) {
+        enable_interrupts();
+    }
+}
+
+/** @brief get a snapshot of the merging counters
+ *
+ *  @param out where to put the counters
+ *  @return void
+ */
+void merge_get_stats(merge_stats_t *out) {
+    int int_flag = get_eflags() & EFL_IF;
+
+    disable_interrupts();
+    *out = stats;
+    if (int_flag) {
+        enable_interrupts();
+    }
+}
+
+/** @brief print the merging counters
+ *
+ *  Used for debugging.
+ *
+ *  @return void
+ */
+void merge_print_stats() {
+    merge_stats_t s;
+
+    merge_get_stats(&s);
+    lprintf("Merged pages: %d (%d of them zero), merged frames: %d",
+            s.merged, s.zero_merged, s.stable_frames);
+}
+
+/* ---------- Static local functions ----------- */
+
+/** @brief go round the tasks until the budget runs out
+ *
+ *  Each task is visited at most once per call.
+ *
+ *  @pre merge_tasks_mutex is held
+ *  @param budget the work left for this tick
+ *  @return void
+ */
+void scan_tasks(merge_budget_t *budget) {
+    task_struct_t *first;
+    list_head *next;
+
+    if (get_first(&merge_tasks) == NULL) {
+        return;
+    }
+    if (scan_task == NULL) {
+        scan_task = get_entry(get_first(&merge_tasks), task_struct_t,
+                              merge_link);
+        scan_addr = USER_MEM_START;
+    }
+
+    first = scan_task;
+    while (scan_task_pages(scan_task, budget)) {
+        next = scan_task->merge_link.next;
+        if (next == &merge_tasks) {
+            next = merge_tasks.next;
+        }
+        scan_task = get_entry(next, task_struct_t, merge_link);
+        scan_addr = USER_MEM_START;
+        if (scan_task == first) {
+            break;
+        }
+    }
+}
+
+/** @brief scan the pages of a task from scan_addr on
+ *
+ *  Tasks without an address space, or busy changing it, are skipped,
+ *  and so is the idle task whose page directory is the current one.
+ *  Page tables still shared after a fork and large pages are skipped
+ *  as well.
+ *
+ *  @param t the task
+ *  @param budget the work left for this tick
+ *  @return int 1 if done with the task, 0 if the budget ran out first
+ */
+int scan_task_pages(task_struct_t *t, merge_budget_t *budget) {
+    int *pd = t->pdbr;
+    unsigned int *pt = NULL;
+    int pt_pd_index = -1;
+    rb_node *node;
+
+    if (pd == NULL || pd == (int *)get_cr3()) {
+        return 1;
+    }
+    if (mutex_trylock(&t->exec_mutex) < 0) {
+        return 1;
+    }
+    if (mutex_trylock(&t->region_mutex) < 0) {
+        mutex_unlock_int_save(&t->exec_mutex);
+        return 1;
+    }
+
+    for (node = rb_first(&t->regions); node != NULL; node = rb_next(node)) {
+        vm_region_t *region = get_entry(node, vm_region_t, node);
+        unsigned int addr = region->base & PAGE_ROUND_DOWN;
+        unsigned int last = region->base + region->len - 1;
+
+        if (last < scan_addr) {
+            continue;
+        }
+        if (addr < scan_addr) {
+            addr = scan_addr;
+        }
+        while (addr <= last) {
+            unsigned int pd_entry = pd[GET_PD_INDEX(addr)];
+
+            if (budget->visits == 0 || budget->hashes == 0) {
+                break;
+            }
+            budget->visits--;
+            if (!(pd_entry & PAGE_ENTRY_PRESENT) || (pd_entry & COW_MODE)
+                || IS_LARGE_PAGE(pd_entry)) {
+                addr = (addr & LARGE_PAGE_ROUND_DOWN) + LARGE_PAGE_SIZE;
+                continue;
+            }
+            if (pt_pd_index != GET_PD_INDEX(addr)) {
+                if (pt != NULL) {
+                    idle_unmap_frame(IDLE_WINDOW_PT);
+                }
+                pt = idle_map_frame(IDLE_WINDOW_PT,
+                                    (void *)GET_ADDR_FROM_ENTRY(pd_entry));
+                pt_pd_index = GET_PD_INDEX(addr);
+            }
+            merge_page(&pt[GET_PT_INDEX(addr)], budget);
+            addr += PAGE_SIZE;
+        }
+        scan_addr = addr;
+        if (addr <= last) {
+            break;
+        }
+    }
+
+    if (pt != NULL) {
+        idle_unmap_frame(IDLE_WINDOW_PT);
+    }
+    mutex_unlock_int_save(&t->region_mutex);
+    mutex_unlock_int_save(&t->exec_mutex);
+    return node == NULL;
+}
+
+/** @brief try to merge one page
+ *
+ *  The page directory of the page is not the current one, so none of
+ *  its entries are cached in the TLB and they can be changed without
+ *  any flushing.
+ *
+ *  @param pte the page table entry of the page
+ *  @param budget the work left for this tick
+ *  @return void
+ */
+void merge_page(unsigned int *pte, merge_budget_t *budget) {
+    unsigned int entry = *pte;
+    void *frame_addr = (void *)GET_ADDR_FROM_ENTRY(entry);
+    void *target;
+    unsigned int *page, hash;
+    merge_slot_t *slot;
+    int is_zero, same;
+
+    if (!(entry & PAGE_ENTRY_PRESENT) || (entry & COW_MODE)
+        || frame_addr == get_zero_frame() || frame_ref_count(frame_addr) != 1) {
+        return;
+    }
+    if (entry & PAGE_DIRTY) {
+        /* Still being written to, give it until the next pass */
+        *pte = entry & ~PAGE_DIRTY;
+        return;
+    }
+
+    budget->hashes--;
+    page = idle_map_frame(IDLE_WINDOW_PAGE, frame_addr);
+    hash = hash_page(page, &is_zero);
+    slot = &table[hash % MERGE_TABLE_SIZE];
+    if (is_zero) {
+        target = get_zero_frame();
+    } else {
+        if (slot->frame != NULL && frame_ref_count(slot->frame) == 1) {
+            release_slot(slot);
+        }
+        if (slot->frame == NULL) {
+            /* The page becomes the merged frame for its contents */
+            idle_unmap_frame(IDLE_WINDOW_PAGE);
+            *pte = (unsigned int)frame_addr | shared_flags(entry);
+            frame_ref(frame_addr);
+            slot->hash = hash;
+            slot->frame = frame_addr;
+            stats.stable_frames++;
+            return;
+        }
+        same = slot->hash == hash;
+        if (same) {
+            void *stable = idle_map_frame(IDLE_WINDOW_STABLE, slot->frame);
+            same = memcmp(page, stable, PAGE_SIZE) == 0;
+            idle_unmap_frame(IDLE_WINDOW_STABLE);
+        }
+        if (!same) {
+            idle_unmap_frame(IDLE_WINDOW_PAGE);
+            return;
+        }
+        target = slot->frame;
+        frame_ref(target);
+    }
+    idle_unmap_frame(IDLE_WINDOW_PAGE);
+
+    *pte = (unsigned int)target | shared_flags(entry);
+    drop_frame(frame_addr);
+    stats.merged++;
+    if (is_zero) {
+        stats.zero_merged++;
+    }
+}
+
+/** @brief hash the contents of a page
+ *
+ *  @param page the page
+ *  @param is_zero set to 1 if the page is all zeroes, 0 if not
+ *  @return unsigned int the FNV-1a hash of the words of the page
+ */
+unsigned int hash_page(const unsigned int *page, int *is_zero) {
+    unsigned int hash = FNV_OFFSET_BASIS, any = 0;
+    int i;
+
+    for (i = 0; i < WORDS_PER_PAGE; i++) {
+        hash = (hash ^ page[i]) * FNV_PRIME;
+        any |= page[i];
+    }
+    *is_zero = (any == 0);
+    return hash;
+}
+
+/** @brief the flags of an entry once its page is shared
+ *
+ *  @param entry the page table entry of the private page
+ *  @return unsigned int the flags, read only and COW if it was writable
+ */
+unsigned int shared_flags(unsigned int entry) {
+    unsigned int flags = GET_FLAGS_FROM_ENTRY(entry)
+                         & ~(PAGE_ACCESSED | PAGE_DIRTY);
+    if (flags & READ_WRITE_ENABLE) {
+        flags = (flags | COW_MODE) & WRITE_DISABLE_MASK;
+    }
+    return flags;
+}
+
+/** @brief drop the frames of the table which nobody maps anymore
+ *
+ *  A few slots are checked per call.
+ *
+ *  @return void
+ */
+void sweep_table() {
+    int i;
+    for (i = 0; i < MERGE_SWEEP_PER_TICK; i++) {
+        merge_slot_t *slot = &table[sweep_slot];
+        if (slot->frame != NULL && frame_ref_count(slot->frame) == 1) {
+            release_slot(slot);
+        }
+        sweep_slot = (sweep_slot + 1) % MERGE_TABLE_SIZE;
+    }
+}
+
+/** @brief empty a slot of the table
+ *
+ *  @param slot the slot
+ *  @return void
+ */
+void release_slot(merge_slot_t *slot) {
+    drop_frame(slot->frame);
+    slot->frame = NULL;
+    stats.stable_frames--;
+}
+
+/** @brief drop a reference on a frame, freeing it later if it was the
+ *         last one
+ *
+ *  @param frame_addr the frame
+ *  @return void
+ */
+void drop_frame(void *frame_addr) {
+    if (frame_unref(frame_addr) == 0) {
+        pending[num_pending++] = frame_addr;
+    }
+}
+
+/** @brief hand as many of the pending frames as possible back to the
+ *         frame allocator
+ *
+ *  @return void
+ */
+void flush_pending() {
+    int freed = free_frames_idle(pending, num_pending);
+    memmove(pending, pending + freed, (num_pending - freed) * sizeof(void *));
+    num_pending -= freed;
+}
@@ -0,0 +1,399 @@
+/** @file reaper.c
+ *  @brief freeing the address spaces of dead tasks in the background
+ *
+ *  A vanishing task only switches to the kernel page directory and
+ *  queues its own page directory and region tree here, so the time it
+ *  takes to exit does not depend on how much memory it had. The idle
+ *  thread then gives back the page tables, the frames and the compressed
+ *  pages a few hundred page table entries per tick.
+ *
+ *  Nothing needs to be flushed from the TLB: the page directory stopped
+ *  being used when the task switched away from it. Frames whose last
+ *  reference goes are collected and returned to the frame allocator a
+ *  batch at a time.
+ *
+ *  The idle thread must never block, so the work is done with
+ *  interrupts disabled and locks are only taken if they are free. When
+ *  one is held, the work stops where it is and goes on at a later tick.
+ *  A thread short of frames does the work itself through reap_drain(),
+ *  and a task exiting while too many address spaces are waiting frees
+ *  the oldest ones first, which keeps a busy system from running out of
+ *  kernel memory because the idle thread never gets to run.
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+#include <vm/reaper.h>
+#include <vm/vm.h>
+#include <vm/region.h>
+#include <vm/zswap.h>
+#include <allocator/frame_allocator.h>
+#include <list/list.h>
+#include <sync/mutex.h>
+#include <common/malloc_wrappers.h>
+#include <common/errors.h>
+#include <common_kern.h>
+#include <page.h>
+#include <asm.h>
+#include <eflags.h>
+#include <limits.h>
+#include <string.h>
+#include <stddef.h>
+#include <simics.h>
+
+#define FIRST_USER_PD_INDEX GET_PD_INDEX(USER_MEM_START)
+#define LAST_USER_PD_INDEX (GET_PD_INDEX(USER_MEM_END) - 1)
+
+/** @brief an address space waiting to be freed */
+typedef struct reap_item {
+    list_head link;         /* Link in the reap queue */
+    int *pd;                /* Page directory, NULL once freed */
+    rb_root regions;        /* Regions of the task */
+    int pd_index;           /* Next page directory entry to release */
+    unsigned int entry;     /* Entry being released, if not the default */
+    int pt_index;           /* Next page of that entry to release */
+} reap_item_t;
+
+static list_head reap_queue;
+static mutex_t reaper_mutex;    /* Protects everything here */
+
+static void *pending[REAP_PENDING_MAX];
+static int num_pending;
+
+static reaper_stats_t stats;
+
+static int drain_queue(int count, int max_waiting);
+static int reap_batch(int budget);
+static int reap_item(reap_item_t *item, int *budget);
+static int release_entry(reap_item_t *item, int *budget);
+static int make_room();
+static void flush_pending();
+
+/** @brief initialize the reaper
+ *
+ *  @return void
+ */
+void reaper_init() {
+    init_head(&reap_queue);
+    mutex_init(&reaper_mutex);
+    num_pending = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+/** @brief have the address space of a dead task freed
+ *
+ *  The regions are moved out of the tree passed in, which is left
+ *  empty.
+ *
+ *  @pre pd is not the page directory of any thread anymore
+ *  @param pd the page directory
+ *  @param regions the region tree of the task
+ *  @return int 0 on success, ERR_NOMEM if the address space could not
+ *          be queued and is still up to the caller to free
+ */
+int reap_address_space(int *pd, rb_root *regions) {
+    reap_item_t *item;
+
+    if (pd == NULL) {
+        return ERR_INVAL;
+    }
+    item = smalloc(sizeof(reap_item_t));
+    if (item == NULL) {
+        return ERR_NOMEM;
+    }
+    item->pd = pd;
+    item->regions = *regions;
+    regions->node = NULL;
+    item->pd_index = FIRST_USER_PD_INDEX;
+    item->entry = PAGE_DIR_ENTRY_DEFAULT;
+    item->pt_index = 0;
+
+    mutex_lock(&reaper_mutex);
+    add_to_tail(&item->link, &reap_queue);
+    stats.queued++;
+    stats.waiting++;
+    if (stats.waiting > REAP_QUEUE_MAX) {
+        drain_queue(0, REAP_QUEUE_MAX);
+    }
+    mutex_unlock(&reaper_mutex);
+    return 0;
+}
+
+/** @brief free a part of the address spaces waiting
+ *
+ *  Called from the loop of the idle thread, once per timer tick.
+ *
+ *  @return void
+ */
+void reap_pages_idle() {
+    int int_flag = get_eflags() & EFL_IF;
+
+    disable_interrupts();
+    if (get_first(&reap_queue) != NULL
+        && mutex_trylock(&reaper_mutex) == 0) {
+        reap_batch(REAP_ENTRIES_PER_TICK);
+        mutex_unlock_int_save(&reaper_mutex);
+    }
+    if (int_flag) {
+        enable_interrupts();
+    }
+}
+
+/** @brief free address spaces waiting, on behalf of a thread short of
+ *         frames
+ *
+ *  Stops once enough frames were given back, when nothing is left to
+ *  free, or when the rest would mean waiting for a lock.
+ *
+ *  @param count the number of frames wanted
+ *  @return int the number of frames given back
+ */
+int reap_drain(int count) {
+    int freed;
+
+    if (get_first(&reap_queue) == NULL) {
+        return 0;
+    }
+    mutex_lock(&reaper_mutex);
+    stats.drains++;
+    freed = drain_queue(count, INT_MAX);
+    mutex_unlock(&reaper_mutex);
+    return freed;
+}
+
+/** @brief get a snapshot of the reaper counters
+ *
+ *  @param out where to put the counters
+ *  @return void
+ */
+void reaper_get_stats(reaper_stats_t *out) {
+    int int_flag = get_eflags() & EFL_IF;
+
+    disable_interrupts();
+    *out = stats;
+    if (int_flag) {
+        enable_interrupts();
+    }
+}
+
+/** @brief print the reaper counters
+ *
+ *  Used for debugging.
+ *
+ *  @return void
+ */
+void reaper_print_stats() {
+    reaper_stats_t s;
+
+    reaper_get_stats(&s);
+    lprintf("Reaped address spaces: %d (%d waiting), frames freed: %d, "
+            "drains: %d", s.queued - s.waiting, s.waiting, s.frames_freed,
+            s.drains);
+}
+
+/* ---------- Static local functions ----------- */
+
+/** @brief free address spaces in batches until enough is done
+ *
+ *  Interrupts are enabled between two batches.
+ *
+ *  @pre reaper_mutex is held
+ *  @param count the number of frames wanted
+ *  @param max_waiting the number of address spaces which may be left
+ *  @return int the number of frames given back
+ */
+int drain_queue(int count, int max_waiting) {
+    int freed_before = stats.frames_freed;
+    int int_flag = get_eflags() & EFL_IF;
+    int more = 1;
+
+    while (more && (stats.frames_freed - freed_before < count
+                    || stats.waiting > max_waiting)) {
+        disable_interrupts();
+        more = reap_batch(REAP_ENTRIES_PER_TICK);
+        if (int_flag) {
+            enable_interrupts();
+        }
+    }
+    return stats.frames_freed - freed_before;
+}
+
+/** @brief release up to a budget of page table entries, oldest address
+ *         space first
+ *
+ *  @pre reaper_mutex is held and interrupts are disabled
+ *  @param budget the number of page table entries to release
+ *  @return int 1 if the budget ran out, 0 if the queue is empty or the
+ *          rest has to wait for a lock
+ */
+int reap_batch(int budget) {
+    list_head *head;
+    reap_item_t *item;
+    int retval;
+
+    flush_pending();
+    while ((head = get_first(&reap_queue)) != NULL) {
+        item = get_entry(head, reap_item_t, link);
+        retval = reap_item(item, &budget);
+        if (retval <= 0) {
+            flush_pending();
+            return retval == 0;
+        }
+        del_entry(head);
+        if (sfree_nowait(item, sizeof(reap_item_t)) < 0) {
+            add_to_head(head, &reap_queue);
+            break;
+        }
+        stats.waiting--;
+    }
+    flush_pending();
+    return 0;
+}
+
+/** @brief release what is left of an address space
+ *
+ *  Entries of the page directory are looked at in order. A page table
+ *  still used by another task only loses a reference. Empty entries
+ *  are not counted against the budget.
+ *
+ *  @pre reaper_mutex is held and interrupts are disabled
+ *  @param item the address space
+ *  @param budget the number of page table entries left to release
+ *  @return int 1 once everything is freed but the item itself, 0 if
+ *          the budget ran out, ERR_BUSY if the rest has to wait for
+ *          a lock
+ */
+int reap_item(reap_item_t *item, int *budget) {
+    int retval;
+
+    for (; item->pd_index <= LAST_USER_PD_INDEX; item->pd_index++) {
+        if (item->entry == PAGE_DIR_ENTRY_DEFAULT) {
+            unsigned int pd_entry = item->pd[item->pd_index];
+            if (pd_entry == PAGE_DIR_ENTRY_DEFAULT) {
+                continue;
+            }
+            if (!IS_LARGE_PAGE(pd_entry)) {
+                retval = unref_page_table_nowait(
+                                 (int *)GET_ADDR_FROM_ENTRY(pd_entry));
+                if (retval < 0) {
+                    return retval;
+                }
+                if (retval > 0) {
+                    continue;
+                }
+            }
+            item->entry = pd_entry;
+            item->pt_index = 0;
+        }
+        if ((retval = release_entry(item, budget)) <= 0) {
+            return retval;
+        }
+        item->entry = PAGE_DIR_ENTRY_DEFAULT;
+    }
+
+    if (item->pd != NULL) {
+        if (sfree_nowait(item->pd, PAGE_SIZE) < 0) {
+            return ERR_BUSY;
+        }
+        item->pd = NULL;
+    }
+    if (region_tree_destroy_nowait(&item->regions) < 0) {
+        return ERR_BUSY;
+    }
+    return 1;
+}
+
+/** @brief release the pages mapped by a page table or a large page
+ *
+ *  The page table itself, which nobody else uses anymore, is released
+ *  after its pages.
+ *
+ *  @pre reaper_mutex is held and interrupts are disabled
+ *  @param item the address space, with the entry being released
+ *  @param budget the number of page table entries left to release
+ *  @return int 1 once done, 0 if the budget ran out, ERR_BUSY if the
+ *          rest has to wait for a lock
+ */
+int release_entry(reap_item_t *item, int *budget) {
+    char *base = (char *)GET_ADDR_FROM_ENTRY(item->entry);
+    int large = IS_LARGE_PAGE(item->entry);
+    unsigned int *pt = NULL;
+    void *frame_addr;
+    int retval = 1;
+
+    if (!large) {
+        pt = idle_map_frame(IDLE_WINDOW_REAP, base);
+    }
+    for (; item->pt_index < NUM_PAGE_TABLE_ENTRIES; item->pt_index++) {
+        if (*budget <= 0) {
+            retval = 0;
+            break;
+        }
+        if (large) {
+            frame_addr = base + item->pt_index * PAGE_SIZE;
+        } else {
+            unsigned int entry = pt[item->pt_index];
+            if (IS_COMPRESSED(entry)) {
+                if (zswap_unref_nowait(GET_COMPRESSED_HANDLE(entry)) < 0) {
+                    retval = ERR_BUSY;
+                    break;
+                }
+                (*budget)--;
+                continue;
+            }
+            if (!(entry & PAGE_ENTRY_PRESENT)) {
+                continue;
+            }
+            frame_addr = (void *)GET_ADDR_FROM_ENTRY(entry);
+            if (frame_addr == get_zero_frame()) {
+                continue;
+            }
+        }
+        if (make_room() < 0) {
+            retval = ERR_BUSY;
+            break;
+        }
+        (*budget)--;
+        if (frame_unref(frame_addr) == 0) {
+            pending[num_pending++] = frame_addr;
+        }
+    }
+    if (!large) {
+        idle_unmap_frame(IDLE_WINDOW_REAP);
+        if (retval == 1) {
+            if (make_room() < 0) {
+                retval = ERR_BUSY;
+            } else {
+                pending[num_pending++] = base;
+            }
+        }
+    }
+    return retval;
+}
+
+/** @brief make sure a frame can be added to the pending frames
+ *
+ *  Checked before dropping the last reference on a frame, so that a
+ *  frame with no references is never left out of the array.
+ *
+ *  @return int 0 if there is room, ERR_BUSY if the free lists are
+ *          locked and the array is full
+ */
+int make_room() {
+    if (num_pending == REAP_PENDING_MAX) {
+        flush_pending();
+    }
+    return num_pending < REAP_PENDING_MAX ? 0 : ERR_BUSY;
+}
+
+/** @brief hand as many of the pending frames as possible back to the
+ *         frame allocator
+ *
+ *  @return void
+ */
+void flush_pending() {
+    int freed = free_frames_idle(pending, num_pending);
+    memmove(pending, pending + freed, (num_pending - freed) * sizeof(void *));
+    num_pending -= freed;
+    stats.frames_freed += freed;
+}
@@ -0,0 +1,253 @@
+/** @file region.c
+ *  @brief bookkeeping for the regions of a user address space
+ *
+ *  Every task keeps its regions (program segments, the stack and the
+ *  new_pages() allocations) in a red-black tree ordered by base
+ *  address. Regions never share a byte, although two program segments
+ *  can share a page. The tree is protected by the region mutex of the
+ *  task owning it.
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+#include <vm/region.h>
+#include <vm/vm.h>
+#include <page.h>
+#include <list/list.h>
+#include <common/malloc_wrappers.h>
+#include <common/errors.h>
+#include <stddef.h>
+
+#define REGION_LAST(r) ((r)->base + (r)->len - 1)
+#define REGION_OF(n) get_entry(n, vm_region_t, node)
+
+static vm_region_t *region_floor(rb_root *root, unsigned int addr);
+
+/** @brief initialize an empty region tree
+ *
+ *  @param root the root of the tree
+ *  @return void
+ */
+void region_tree_init(rb_root *root) {
+    rb_init_root(root);
+}
+
+/** @brief add a region to a tree
+ *
+ *  @param root the root of the tree
+ *  @param base the first byte of the region
+ *  @param len the length of the region in bytes
+ *  @param flags REGION_* flags
+ *  @return int 0 on success, ERR_INVAL if the region overlaps one in
+ *          the tree, ERR_NOMEM if out of kernel memory
+ */
+int region_insert(rb_root *root, void *base, unsigned int len, int flags) {
+    unsigned int start = (unsigned int)base;
+    vm_region_t *prev, *region;
+    rb_node **link = &root->node;
+    rb_node *parent = NULL;
+
+    if (len == 0 || start + len - 1 < start) {
+        return ERR_INVAL;
+    }
+    prev = region_floor(root, start + len - 1);
+    if (prev != NULL && REGION_LAST(prev) >= start) {
+        return ERR_INVAL;
+    }
+
+    region = (vm_region_t *)smalloc(sizeof(vm_region_t));
+    if (region == NULL) {
+        return ERR_NOMEM;
+    }
+    region->base = start;
+    region->len = len;
+    region->flags = flags;
+
+    while (*link != NULL) {
+        parent = *link;
+        if (start < REGION_OF(parent)->base) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+        }
+    }
+    rb_link_node(&region->node, parent, link);
+    rb_insert_color(&region->node, root);
+    return 0;
+}
+
+/** @brief find the region containing an address
+ *
+ *  @param root the root of the tree
+ *  @param addr the address
+ *  @return vm_region_t * the region, NULL if addr is in none
+ */
+vm_region_t *region_find(rb_root *root, void *addr) {
+    vm_region_t *region = region_floor(root, (unsigned int)addr);
+    if (region == NULL || REGION_LAST(region) < (unsigned int)addr) {
+        return NULL;
+    }
+    return region;
+}
+
+/** @brief check if any page of a range belongs to a region
+ *
+ *  Works at page granularity: a page partly covered by a region counts
+ *  as part of it, the same way it is mapped in the page tables.
+ *
+ *  @param root the root of the tree
+ *  @param base the first byte of the range
+ *  @param len the length of the range in bytes
+ *  @return int 1 if some page of the range is in a region, 0 otherwise
+ */
+int region_overlaps(rb_root *root, void *base, unsigned int len) {
+    unsigned int first_page = (unsigned int)base & PAGE_ROUND_DOWN;
+    unsigned int last_page = ((unsigned int)base + len - 1) & PAGE_ROUND_DOWN;
+
+    /* Regions do not overlap, so the one starting last before the end of
+     * the range is also the one reaching furthest */
+    vm_region_t *region = region_floor(root, last_page + PAGE_SIZE - 1);
+    if (region == NULL) {
+        return 0;
+    }
+    return (REGION_LAST(region) & PAGE_ROUND_DOWN) >= first_page;
+}
+
+/** @brief check that every byte of a range is in regions with some flags
+ *
+ *  @param root the root of the tree
+ *  @param base the first byte of the range
+ *  @param len the length of the range in bytes, more than 0
+ *  @param flags the flags each of the regions must have
+ *  @return int 1 if the whole range is covered by such regions, 0 if
+ *          not
+ */
+int region_range_allows(rb_root *root, void *base, unsigned int len,
+                        int flags) {
+    unsigned int addr = (unsigned int)base;
+    unsigned int last = addr + len - 1;
+    vm_region_t *region;
+
+    while (1) {
+        region = region_find(root, (void *)addr);
+        if (region == NULL || (region->flags & flags) != flags) {
+            return 0;
+        }
+        if (REGION_LAST(region) >= last) {
+            return 1;
+        }
+        addr = REGION_LAST(region) + 1;
+    }
+}
+
+/** @brief remove the region starting at an address
+ *
+ *  @param root the root of the tree
+ *  @param base the first byte of the region
+ *  @param flags flags the region must have for it to be removed
+ *  @return int the length of the removed region, ERR_INVAL if no region
+ *          with these flags starts at base
+ */
+int region_remove(rb_root *root, void *base, int flags) {
+    vm_region_t *region = region_find(root, base);
+    int len;
+
+    if (region == NULL || region->base != (unsigned int)base
+        || (region->flags & flags) != flags) {
+        return ERR_INVAL;
+    }
+    len = region->len;
+    rb_erase(&region->node, root);
+    sfree(region, sizeof(vm_region_t));
+    return len;
+}
+
+/** @brief copy all the regions of a tree into an empty one
+ *
+ *  @param dst the root of the empty tree
+ *  @param src the root of the tree to be copied
+ *  @return int 0 on success, ERR_NOMEM if out of kernel memory. dst
+ *          is left empty on failure.
+ */
+int region_tree_clone(rb_root *dst, rb_root *src) {
+    rb_node *node;
+    for (node = rb_first(src); node != NULL; node = rb_next(node)) {
+        vm_region_t *region = REGION_OF(node);
+        if (region_insert(dst, (void *)region->base, region->len,
+                          region->flags) < 0) {
+            region_tree_destroy(dst);
+            return ERR_NOMEM;
+        }
+    }
+    return 0;
+}
+
+/** @brief remove and free every region of a tree
+ *
+ *  @param root the root of the tree
+ *  @return void
+ */
+void region_tree_destroy(rb_root *root) {
+    rb_node *node;
+    while ((node = root->node) != NULL) {
+        rb_erase(node, root);
+        sfree(REGION_OF(node), sizeof(vm_region_t));
+    }
+}
+
+/** @brief region_tree_destroy() for callers which must not block
+ *
+ *  The tree must not be used for anything else anymore: regions are
+ *  taken off from the leaves without rebalancing it. When the lock of
+ *  the kernel heap is held by someone, the regions left stay in the
+ *  tree and the call can be repeated later.
+ *
+ *  @param root the root of the tree
+ *  @return int 0 once the tree is empty, ERR_BUSY if some regions are
+ *          left
+ */
+int region_tree_destroy_nowait(rb_root *root) {
+    rb_node *node, *parent;
+    while ((node = root->node) != NULL) {
+        while (node->left != NULL || node->right != NULL) {
+            node = node->left != NULL ? node->left : node->right;
+        }
+        parent = node->parent;
+        if (sfree_nowait(REGION_OF(node), sizeof(vm_region_t)) < 0) {
+            return ERR_BUSY;
+        }
+        if (parent == NULL) {
+            root->node = NULL;
+        } else if (parent->left == node) {
+            parent->left = NULL;
+        } else {
+            parent->right = NULL;
+        }
+    }
+    return 0;
+}
+
+/* ---------- Static local functions ----------- */
+
+/** @brief find the region with the largest base not above an address
+ *
+ *  @param root the root of the tree
+ *  @param addr the address
+ *  @return vm_region_t * the region, NULL if every region starts above
+ *          addr
+ */
+vm_region_t *region_floor(rb_root *root, unsigned int addr) {
+    rb_node *node = root->node;
+    vm_region_t *floor = NULL;
+
+    while (node != NULL) {
+        vm_region_t *region = REGION_OF(node);
+        if (region->base <= addr) {
+            floor = region;
+            node = node->right;
+        } else {
+            node = node->left;
+        }
+    }
+    return floor;
+}
@@ -0,0 +1,75 @@
+/** @file tlb.c
+ *  @brief implement the TLB invalidation functions
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+#include <vm/tlb.h>
+#include <asm/asm.h>
+#include <cr.h>
+#include <stddef.h>
+
+/** @brief initialize an empty batch
+ *
+ *  @param batch the batch to be initialized
+ *
+ *  @return void
+ */
+void tlb_batch_init(tlb_batch_t *batch) {
+    batch->count = 0;
+}
+
+/** @brief add a page to a batch
+ *
+ *  Once the batch is full, the remaining pages are only counted since
+ *  the whole TLB will be flushed anyway.
+ *
+ *  @param batch the batch
+ *  @param addr any address in the page whose entry has to go
+ *
+ *  @return void
+ */
+void tlb_batch_add(tlb_batch_t *batch, void *addr) {
+    if (batch->count < TLB_BATCH_MAX) {
+        batch->pages[batch->count] = addr;
+    }
+    batch->count++;
+}
+
+/** @brief invalidate the TLB entries for all the pages in a batch
+ *
+ *  The batch is empty afterwards and can be reused.
+ *
+ *  @param batch the batch
+ *
+ *  @return void
+ */
+void tlb_batch_flush(tlb_batch_t *batch) {
+    int i;
+    if (batch->count > TLB_BATCH_MAX) {
+        tlb_flush_all();
+    } else {
+        for (i = 0; i < batch->count; i++) {
+            invalidate_tlb_page(batch->pages[i]);
+        }
+    }
+    batch->count = 0;
+}
+
+/** @brief invalidate the TLB entry for a single page
+ *
+ *  @param addr any address in the page
+ *
+ *  @return void
+ */
+void tlb_flush_page(void *addr) {
+    invalidate_tlb_page(addr);
+}
+
+/** @brief invalidate all the non global TLB entries
+ *
+ *  @return void
+ */
+void tlb_flush_all() {
+    set_cr3(get_cr3());
+}
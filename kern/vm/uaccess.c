@@ -0,0 +1,143 @@
+/** @file uaccess.c
+ *  @brief copying data between the kernel and user memory
+ *
+ *  Only the range is checked here: it has to lie in user memory, between
+ *  USER_MEM_START and USER_MEM_END. Whether it is mapped is left to the
+ *  MMU, see uaccess_asm.S for the copies and their fixup table.
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+#include <vm/uaccess.h>
+#include <vm/vm.h>
+#include <vm/region.h>
+#include <core/scheduler.h>
+#include <sync/mutex.h>
+#include <common_kern.h>
+#include <common/errors.h>
+#include <stddef.h>
+
+int copy_user_asm(void *dst, const void *src, int len);
+int copy_string_user_asm(char *dst, const char *src, int len);
+
+extern uaccess_fixup_t uaccess_fixup_table[];
+extern uaccess_fixup_t uaccess_fixup_table_end[];
+
+static int is_user_range(const void *ptr, int len);
+
+/** @brief copy data from user memory into the kernel
+ *
+ *  @param dst kernel buffer of at least len bytes
+ *  @param src user address to copy from
+ *  @param len the number of bytes to copy
+ *  @return int 0 on success, ERR_INVAL if some of src is not readable
+ */
+int copy_from_user(void *dst, const void *src, int len) {
+    if (!is_user_range(src, len)) {
+        return ERR_INVAL;
+    }
+    return copy_user_asm(dst, src, len);
+}
+
+/** @brief copy data from the kernel into user memory
+ *
+ *  Copy-on-write and demand zero pages in the way are filled in by the
+ *  page fault handler as for a write from user mode.
+ *
+ *  @param dst user address to copy to
+ *  @param src kernel buffer of at least len bytes
+ *  @param len the number of bytes to copy
+ *  @return int 0 on success, ERR_INVAL if some of dst is not writable
+ */
+int copy_to_user(void *dst, const void *src, int len) {
+    if (!is_user_range(dst, len)) {
+        return ERR_INVAL;
+    }
+    return copy_user_asm(dst, src, len);
+}
+
+/** @brief check that the calling task may write to user memory
+ *
+ *  Nothing is written. The range has to lie in regions of the task
+ *  which allow writing; pages in it not backed by a frame of their own
+ *  yet are filled in by the page fault handler once written to.
+ *
+ *  @param ptr user address of the first byte
+ *  @param len the number of bytes
+ *  @return int 0 if the range is writable, ERR_INVAL if not
+ */
+int check_user_writable(void *ptr, int len) {
+    task_struct_t *t = get_curr_task();
+    int writable;
+
+    if (!is_user_range(ptr, len)) {
+        return ERR_INVAL;
+    }
+    mutex_lock(&t->region_mutex);
+    writable = region_range_allows(&t->regions, ptr, len, REGION_WRITE);
+    mutex_unlock(&t->region_mutex);
+    return writable ? 0 : ERR_INVAL;
+}
+
+/** @brief copy a '\0' terminated string from user memory
+ *
+ *  It is expected that the caller allocates at least max_size bytes
+ *  for dst.
+ *
+ *  @param dst kernel buffer to copy into
+ *  @param src user string to copy from
+ *  @param max_size the maximum amount of data in bytes to copy
+ *  @return int bytes copied including the '\0' on success, ERR_BIG if
+ *          the string does not fit in max_size bytes, ERR_INVAL if
+ *          some of it is not readable
+ */
+int copy_string_from_user(char *dst, const char *src, int max_size) {
+    int len = max_size, retval;
+
+    if (dst == NULL || src == NULL || max_size <= 0
+        || !IS_USER_ADDR(src)) {
+        return ERR_INVAL;
+    }
+    /* Stop at the end of user memory rather than run into the kernel */
+    if ((unsigned int)len > USER_MEM_END - (unsigned int)src) {
+        len = USER_MEM_END - (unsigned int)src;
+    }
+    retval = copy_string_user_asm(dst, src, len);
+    if (retval < 0 || (retval > 0 && dst[retval - 1] == '\0')) {
+        return retval;
+    }
+    /* No '\0' in the first len bytes */
+    return len == max_size ? ERR_BIG : ERR_INVAL;
+}
+
+/** @brief look up the fixup for a faulting kernel instruction
+ *
+ *  @param eip the address of the faulting instruction
+ *  @return unsigned int the address to resume at, 0 if eip is not
+ *          allowed to fault
+ */
+unsigned int uaccess_fixup(unsigned int eip) {
+    uaccess_fixup_t *entry;
+    for (entry = uaccess_fixup_table; entry < uaccess_fixup_table_end;
+         entry++) {
+        if (entry->fault_eip == eip) {
+            return entry->fixup_eip;
+        }
+    }
+    return 0;
+}
+
+/* ---------- Static local functions ----------- */
+
+/** @brief check that a range lies in user memory
+ *
+ *  @param ptr the first byte of the range
+ *  @param len the length of the range in bytes
+ *  @return int 1 if it does, 0 if not
+ */
+int is_user_range(const void *ptr, int len) {
+    if (len <= 0 || !IS_USER_ADDR(ptr)) {
+        return 0;
+    }
+    return (unsigned int)len <= USER_MEM_END - (unsigned int)ptr;
+}
@@ -16,43 +16,117 @@
 #include <page.h>
 #include <simics.h>
 #include <seg.h>
+#include <asm.h>
 #include <asm/asm.h>
+#include <eflags.h>
 #include <sync/mutex.h>
+#include <sync/spinlock.h>
 #include <common/errors.h>
 #include <common/assert.h>
 #include <allocator/frame_allocator.h>
+#include <vm/tlb.h>
+#include <vm/region.h>
+#include <vm/zswap.h>
+#include <vm/reaper.h>
+#include <loader/text_cache.h>
+#include <list/list.h>
 
 #define USER_PD_ENTRY_FLAGS PAGE_ENTRY_PRESENT | READ_WRITE_ENABLE | USER_MODE
-#define SET_NEWPAGE_START(x) (((unsigned int)(x) & 0xfffff3ff) | NEWPAGE_START)
-#define SET_NEWPAGE_END(x) (((unsigned int)(x) & 0xfffff3ff) | NEWPAGE_END)
-#define GET_NEWPAGE_FLAGS(x) (((unsigned int)(x) & 0x00000c00))
-#define IS_NEWPAGE_START(x) ((unsigned int)(x) & NEWPAGE_START)
-#define IS_NEWPAGE_PAGE(x) ((unsigned int)(x) & NEWPAGE_PAGE)
-#define IS_NEWPAGE_END(x) ((unsigned int)(x) & NEWPAGE_END)
-
-static int *frame_ref_count;
+#define KERNEL_HIGH_NUM_ENTRIES ((PT_WINDOW_START - KERNEL_HIGH_START) \
+                                 / LARGE_PAGE_SIZE)
+
+/* Page tables of the current page directory show up in the last 4 MB,
+ * since its last entry points back at the page directory itself */
+#define PT_WINDOW(pd_index) \
+        ((int *)(PT_WINDOW_START + ((unsigned int)(pd_index) << 12)))
+#define FRAME_BATCH_SIZE 16  /* Frames allocated or freed at once */
+
 static void *kernel_pd;
 static void *dead_thr_kernel_stack;
+static void *zero_frame;    /* Shared frame backing untouched anonymous pages */
+
+/* Kernel virtual page through which any physical frame can be reached.
+ * There is a single one for the whole kernel, used under temp_map_mutex. */
+static void *temp_map_window;
+static mutex_t temp_map_mutex;
+
+/* More windows, used only by the idle thread to fill the pre-zeroed
+ * frame pool and to merge identical pages, and by the reaper. They have
+ * no mutex so the idle thread never blocks on them. */
+static void *idle_map_windows[NUM_IDLE_WINDOWS];
+
+/* Page tables are user frames and can be shared between tasks after a
+ * fork. The reference count of the frame is the number of page
+ * directories using it, and is only changed under this mutex. */
+static mutex_t pt_ref_mutex;
+
+/* Where the last sweep for cold pages stopped. There is only one for
+ * all tasks, which is good enough as a place to start from. */
+static unsigned int reclaim_hand = USER_MEM_START;
+
+/* Faults handled and page tables freed since boot. Updated with
+ * atomic_add() since the fault handlers run with interrupts on. */
+static vm_fault_stats_t fault_stats;
+
+/* Frames set aside by the execs loading a program right now. The lock
+ * is only held to add, remove or take from a reservation. */
+static list_head reserves;
+static spinlock_t reserve_lock;
 
-static void init_frame_ref_count();
-static void zero_fill(void *addr, int size);
+#define NUM_PROGRAM_SEGMENTS 5  /* Text, data, rodata, bss and stack */
+#define NUM_FILE_SEGMENTS 3     /* The first ones, loaded from the file */
+
+/** @brief a segment of a program in the address space of a task */
+typedef struct program_segment {
+    unsigned long start;
+    unsigned long len;
+    int flags;              /* REGION_* flags of its region */
+} program_segment_t;
+
+static void setup_zero_frame();
+static void ref_frame(void *frame_addr);
+static void unref_frame(void *frame_addr);
+static void setup_temp_map_window();
 static void direct_map_kernel_pages(void *pd_addr);
 static void setup_direct_map();
+static void setup_high_map();
+static int *create_kernel_page_table();
+static void set_pd_entry(int *pd, int pd_index, unsigned int entry);
 static void setup_kernel_pd();
 static int map_text_segment(simple_elf_t *se_hdr, void *pd_addr);
 static int map_data_segment(simple_elf_t *se_hdr, void *pd_addr);
 static int map_rodata_segment(simple_elf_t *se_hdr, void *pd_addr);
 static int map_bss_segment(simple_elf_t *se_hdr, void *pd_addr);
 static int map_stack_segment(void *pd_addr);
+static int add_program_regions(simple_elf_t *se_hdr, rb_root *regions);
+static int get_program_segments(simple_elf_t *se_hdr,
+                                program_segment_t *segments);
+static int program_frames_needed(simple_elf_t *se_hdr,
+                                 unsigned int arg_bytes);
+static int program_covers_pd_index(simple_elf_t *se_hdr, int pd_index);
+static int reused_frame_flags(simple_elf_t *se_hdr, unsigned int addr);
+static void reset_page_table(int *pt, int pd_index, simple_elf_t *se_hdr);
 static int map_segment(void *start_addr, unsigned int length, int *pd_addr, int flags);
 static void *direct_map[USER_MEM_START / (PAGE_SIZE * NUM_PAGE_TABLE_ENTRIES)];
+static int *high_map[KERNEL_HIGH_NUM_ENTRIES];
 
 static void *create_page_table();
 static void free_page_table(int *pt);
-static void make_pages_cow(int *pd);
+static int unshare_page_table(int *pd, int pd_index);
+static int unshare_large_page(int *pd, int pd_index);
 static void make_pt_cow(int *pt);
 static void increment_ref_count(int *pd);
 static void enable_page_pinning();
+static int map_large_pages(void *base, int length, int *pd);
+static void ref_large_page(unsigned int pd_entry);
+static void free_large_page(unsigned int pd_entry);
+static int is_large_page_shared(unsigned int pd_entry);
+static void clear_range(int *pd, void *base, unsigned int length,
+                        rb_root *regions);
+static int page_table_empty(int *pt);
+static void count_page(int *pd, unsigned int addr, vm_task_stats_t *stats);
+static int reclaim_scan(rb_root *regions, unsigned int from, int count);
+static int reclaim_page(void *addr, tlb_batch_t *batch);
 
 /** @brief initialize the virtual memory system
  *
@@ -63,11 +137,50 @@ static void enable_page_pinning();
  */
 void vm_init() {
     setup_direct_map();
+    setup_high_map();
     setup_kernel_pd();
     set_kernel_pd();
     enable_paging();
-	init_frame_ref_count();
+    mutex_init(&pt_ref_mutex);
+    init_head(&reserves);
+    spin_init(&reserve_lock);
+    setup_temp_map_window();
+    setup_zero_frame();
+    enable_page_pinning();
+    zswap_init();
+}
+
+/** @brief turn on paging on an application processor
+ *
+ *  The processor starts out on the kernel page directory, with the same
+ *  paging features as the bootstrap processor.
+ *
+ *  @pre vm_init() was run on the bootstrap processor
+ *  @return void
+ */
+void vm_init_ap() {
+    set_kernel_pd();
     enable_page_pinning();
+    enable_paging();
+}
+
+/** @brief map a page of device registers in kernel memory
+ *
+ *  The page takes the place of the direct map page at the same
+ *  address. Every page directory shares the direct map page tables, so
+ *  the mapping shows up in all of them. The page is not cached.
+ *
+ *  @param vaddr the kernel address, below USER_MEM_START
+ *  @param paddr the physical address of the registers
+ *  @return void
+ */
+void map_device_page(void *vaddr, void *paddr) {
+    int *pt = direct_map[GET_PD_INDEX(vaddr)];
+
+    pt[GET_PT_INDEX(vaddr)] = GET_ADDR_FROM_ENTRY(paddr) | PAGE_ENTRY_PRESENT
+                              | READ_WRITE_ENABLE | WRITE_THROUGH_CACHING
+                              | DISABLE_CACHING | GLOBAL_PAGE_ENTRY;
+    invalidate_tlb_page(vaddr);
 }
 
 /** @brief Function to set the the special kernel page
@@ -82,15 +195,48 @@ void setup_kernel_pd() {
 	kernel_assert(dead_thr_kernel_stack != NULL);
 }
 
-/** @brief Initializes the array which stored the 
- * 		   reference count for physical frames
+/** @brief Allocates the frame shared by all demand zero pages
+ *         which have only been read
+ *
+ *  The frame comes from kernel memory so that it can be zeroed through
+ *  the direct map. It is never handed back and its reference count is
+ *  never tracked.
+ *
+ *  @return void
+ */
+void setup_zero_frame() {
+    zero_frame = smemalign(PAGE_SIZE, PAGE_SIZE);
+    kernel_assert(zero_frame != NULL);
+    memset(zero_frame, 0, PAGE_SIZE);
+}
+
+/** @brief Takes a reference on a physical frame
+ *
+ *  @param frame_addr The physical frame
+ *
+ *  @return void
+ */
+void ref_frame(void *frame_addr) {
+	if(frame_addr == zero_frame) {
+		return;
+	}
+	frame_ref(frame_addr);
+}
+
+/** @brief Drops a reference on a physical frame, returning the
+ *  frame to the frame allocator when the last reference goes away
+ *
+ *  @param frame_addr The physical frame
+ *
  *  @return void
  */
-void init_frame_ref_count() {
-	int size = FREE_FRAMES_COUNT*sizeof(int);
-    frame_ref_count = (int *)smalloc(size);
-	kernel_assert(frame_ref_count != NULL);
-	memset(frame_ref_count, 0, size);
+void unref_frame(void *frame_addr) {
+	if(frame_addr == zero_frame) {
+		return;
+	}
+	if(frame_unref(frame_addr) == 0) {
+		deallocate_frame(frame_addr);
+	}
 }
 
 /** @brief Set the current page directory to kernel page
@@ -110,6 +256,15 @@ void *get_kernel_pd() {
 	return kernel_pd;
 }
 
+/** @brief Gets the frame shared by demand zero pages which have only
+ *  been read
+ *
+ *  @return void* Address of the zero frame
+ */
+void *get_zero_frame() {
+	return zero_frame;
+}
+
 /** @brief Gets the address of the dead thread kernel stack
  *
  *  @return void* Address of the special kernel stack for dead
@@ -133,24 +288,26 @@ void set_cur_pd(void *pd_addr) {
 
 /** @brief enable VM 
  *
- *  Set bit 31 of cr0
+ *  Set bit 31 of cr0. Write protection is turned on as well, so that 
+ *  writes from the kernel to read only and COW user pages fault like
+ *  the ones from user mode do.
  *
  *  @return void
  */
 void enable_paging() {
     unsigned int cr0 = get_cr0();
-    cr0 = cr0 | CR0_PG;
+    cr0 = cr0 | CR0_PG | CR0_WP;
     set_cr0(cr0);
 }
 
 /** @brief Function to enable setting of 
- *  global flag.
+ *  global flag and the use of 4 MB pages.
  * 
  *  @return void
  */
 void enable_page_pinning() {
     unsigned int cr4 = get_cr4();
-    cr4 = cr4 | CR4_PGE;
+    cr4 = cr4 | CR4_PGE | CR4_PSE;
     set_cr4(cr4);
 }
 
@@ -169,11 +326,11 @@ void *create_page_directory() {
     if(frame_addr == NULL) {
         return NULL;
     }
-    direct_map_kernel_pages(frame_addr);
 	int i;
-	for(i=KERNEL_MAP_NUM_ENTRIES; i<NUM_PAGE_TABLE_ENTRIES; i++) {
+	for(i=0; i<NUM_PAGE_TABLE_ENTRIES; i++) {
 		frame_addr[i] = PAGE_DIR_ENTRY_DEFAULT;
 	}
+    direct_map_kernel_pages(frame_addr);
     return (void *)frame_addr;
 }
  
@@ -192,47 +349,33 @@ void free_page_directory(void *pd_addr) {
 
 /** @brief create a new page table
  *
- *  This function will allocate a new kernel physical frame for 
- *  a page table and return the address of this physical frame.
- *  The frame will be initialized with default flags. If there are 
- *  no more physical frames available this function will return null.
+ *  The page table is a zeroed frame from the user frame pool, with a
+ *  single reference for the page directory it goes into. It is not
+ *  mapped in kernel memory: the page tables of the current page
+ *  directory are reached through PT_WINDOW(), others through 
+ *  temp_map_frame().
  *  
- *  @return address of the frame containing the page table. NULL on failure
+ *  @return physical address of the page table. NULL on failure
  */
 void *create_page_table() {
-	int *frame_addr = (int *) smemalign(PAGE_SIZE, PAGE_SIZE);
+	void *frame_addr = take_reserved_frame();
+	if(frame_addr == NULL) {
+		frame_addr = allocate_zeroed_frame();
+	}
     if(frame_addr == NULL) {
         return NULL;
     }
-	int i;
-	for(i=0; i<NUM_PAGE_TABLE_ENTRIES; i++) {
-		frame_addr[i] = PAGE_TABLE_ENTRY_DEFAULT;
-	}
-    return (void *)frame_addr;
-}
-
-/** @brief Creates a clone of the page table
- * 
- * 	@param pt Address of the page table to be cloned
- *  
- *  @return Address of the new page table
- */
-void *clone_page_table(void *pt) {
-	if(pt == NULL) {
-		return NULL;
-	}
-	void *new_pt = create_page_table();
-	if(new_pt == NULL) {
-		return NULL;
-	}
-	memcpy(new_pt, pt, PAGE_SIZE);
-	increment_ref_count(new_pt);
-	return new_pt;
+	frame_ref(frame_addr);
+    return frame_addr;
 }
 
 /** @brief free a page table
  *
- *  frees the specified page table using sfree
+ *  Drops a reference on the specified page table. Once no page
+ *  directory uses it anymore, the frames and compressed pages it maps
+ *  are released and the page table goes back to the frame allocator.
+ *
+ *  @param pt physical address of the page table
  *  
  *  @return void
  */
@@ -240,31 +383,74 @@ void free_page_table(int *pt) {
     if (pt == NULL) {
         return;
     }
-	int i;
+	mutex_lock(&pt_ref_mutex);
+	int refs = frame_unref(pt);
+	mutex_unlock(&pt_ref_mutex);
+	if(refs > 0) {
+		return;
+	}
+	int i, nframes = 0;
+	void *frames[FRAME_BATCH_SIZE];
+	int *entries = temp_map_frame(pt);
 	for(i=0; i<NUM_PAGE_TABLE_ENTRIES; i++) {
-		if(pt[i] == PAGE_TABLE_ENTRY_DEFAULT) {
+		if(IS_COMPRESSED(entries[i])) {
+			zswap_unref(GET_COMPRESSED_HANDLE(entries[i]));
+		}
+		if(!(entries[i] & PAGE_ENTRY_PRESENT)) {
 			continue;
 		}
-		void *frame_addr = (void *)GET_ADDR_FROM_ENTRY(pt[i]);
-		lock_frame(frame_addr);
-		frame_ref_count[FRAME_INDEX(frame_addr)]--;
-		kernel_assert(frame_ref_count[FRAME_INDEX(frame_addr)] >= 0);
-		if(frame_ref_count[FRAME_INDEX(frame_addr)] == 0) {
-			deallocate_frame(frame_addr);
+		void *frame_addr = (void *)GET_ADDR_FROM_ENTRY(entries[i]);
+		if(frame_addr == zero_frame || frame_unref(frame_addr) > 0) {
+			continue;
+		}
+		frames[nframes++] = frame_addr;
+		if(nframes == FRAME_BATCH_SIZE) {
+			free_frames(frames, nframes);
+			nframes = 0;
 		}
-		unlock_frame(frame_addr);
 	}
-	sfree(pt, PAGE_SIZE);
+	temp_unmap_frame(entries);
+	free_frames(frames, nframes);
+	deallocate_frame(pt);
+}
+
+/** @brief drop a reference on a page table without blocking
+ *
+ *  Unlike free_page_table(), nothing is freed when the last reference
+ *  goes: the page table then belongs to the caller, which has to
+ *  release what it maps and the page table itself.
+ *
+ *  @param pt physical address of the page table
+ *
+ *  @return int the references left, ERR_BUSY if pt_ref_mutex is held
+ */
+int unref_page_table_nowait(int *pt) {
+	int refs;
+	if(mutex_trylock(&pt_ref_mutex) < 0) {
+		return ERR_BUSY;
+	}
+	refs = frame_unref(pt);
+	mutex_unlock_int_save(&pt_ref_mutex);
+	return refs;
 }
 
-/** @brief Creates a copy of the given page directory and
- * 	the corresponding valid page tables.
+/** @brief Creates a copy of the given page directory
+ *
+ *  The page tables are not copied. Both page directories point to
+ *  the same page tables, which are marked read only and COW at the
+ *  page directory level. A page table is copied only when one of the
+ *  tasks first faults inside the 4 MB region it maps (see
+ *  handle_pt_cow()), so a fork followed by an exec never copies any.
+ *
+ *  Only the page directory entries covering a region of the task are
+ *  looked at.
  *
  *  @param pd Address of the page directory
+ *  @param regions The region tree of the task owning pd
  *
  *  @return Address of the clone of the given page directory
  */
-void *clone_paging_info(int *pd) {
+void *clone_paging_info(int *pd, rb_root *regions) {
 	if(pd == NULL) {
 		return NULL;
 	}
@@ -273,42 +459,195 @@ void *clone_paging_info(int *pd) {
 		return NULL;
 	}
 	int i;
-	for(i=KERNEL_MAP_NUM_ENTRIES; i<NUM_PAGE_TABLE_ENTRIES; i++) {
-        if(pd[i] != PAGE_DIR_ENTRY_DEFAULT) {
-			void *new_pt = clone_page_table((void *)GET_ADDR_FROM_ENTRY(pd[i]));
-			if(new_pt == NULL) {
-				free_paging_info(new_pd);
-				return NULL;
+	rb_node *node;
+	mutex_lock(&pt_ref_mutex);
+	for(node = rb_first(regions); node != NULL; node = rb_next(node)) {
+		vm_region_t *region = get_entry(node, vm_region_t, node);
+		int last = GET_PD_INDEX(region->base + region->len - 1);
+		for(i = GET_PD_INDEX(region->base); i <= last; i++) {
+			/* Regions sharing a page table show up more than once */
+			if(pd[i] == PAGE_DIR_ENTRY_DEFAULT || new_pd[i] == pd[i]) {
+				continue;
+			}
+			if(IS_LARGE_PAGE(pd[i])) {
+				/* There is no page table to share, both sides map the
+				 * frames */
+				ref_large_page(pd[i]);
+			} else {
+				frame_ref((void *)GET_ADDR_FROM_ENTRY(pd[i]));
 			}
-			new_pd[i] = (unsigned int)new_pt | GET_FLAGS_FROM_ENTRY(pd[i]);
+			pd[i] = (pd[i] | COW_MODE) & WRITE_DISABLE_MASK;
+			new_pd[i] = pd[i];
 		}
-    }
-	make_pages_cow(pd);
-	make_pages_cow(new_pd);
+	}
+	mutex_unlock(&pt_ref_mutex);
+
+	/* Get rid of stale writable TLB entries */
+	if((int *)get_cr3() == pd) {
+		tlb_flush_all();
+	}
 	return new_pd;
 }
       
 /** @brief Frees the paging frames of a given page directory
+ *
+ *  Page tables only exist for the parts of the address space covered
+ *  by a region, so only those entries are looked at.
  *
  *  @param pd Address of the page directory
+ *  @param regions The region tree of the task which owned pd
  *
  *  @return Void
  */
-void free_paging_info(int *pd) {
+void free_paging_info(int *pd, rb_root *regions) {
 	if(pd == NULL) {
 		return;
 	}
 	int i;
-	for(i=KERNEL_MAP_NUM_ENTRIES; i<NUM_PAGE_TABLE_ENTRIES; i++) {
-        if(pd[i] != PAGE_DIR_ENTRY_DEFAULT) {
-			free_page_table((void *)GET_ADDR_FROM_ENTRY(pd[i]));	
+	rb_node *node;
+	for(node = rb_first(regions); node != NULL; node = rb_next(node)) {
+		vm_region_t *region = get_entry(node, vm_region_t, node);
+		int last = GET_PD_INDEX(region->base + region->len - 1);
+		for(i = GET_PD_INDEX(region->base); i <= last; i++) {
+			if(IS_LARGE_PAGE(pd[i])) {
+				free_large_page(pd[i]);
+			} else if(pd[i] != PAGE_DIR_ENTRY_DEFAULT) {
+				free_page_table((void *)GET_ADDR_FROM_ENTRY(pd[i]));	
+			}
+			pd[i] = PAGE_DIR_ENTRY_DEFAULT;
 		}
-    }
+	}
 	free_page_directory(pd);
 }
 
+/** @brief Sets aside the frames a new program will need, before the
+ *  address space it goes into is emptied
+ *
+ *  Until vm_release_frames() is called, page tables and pages pd gets
+ *  are taken from the frames set aside first, so loading the program
+ *  cannot run out of frames. Execs in other tasks go on meanwhile with
+ *  reservations of their own.
+ *
+ *  @pre pd is the current page directory
+ *  @param reserve Where to keep track of the frames
+ *  @param pd Address of the page directory
+ *  @param se_hdr The parsed elf header of the new program
+ *  @param arg_bytes Bytes the arguments take on the user stack
+ *
+ *  @return 0 on success, ERR_NOMEM if there are not enough free frames
+ */
+int vm_reserve_frames(frame_reserve_t *reserve, int *pd,
+                      simple_elf_t *se_hdr, unsigned int arg_bytes) {
+	int count = program_frames_needed(se_hdr, arg_bytes);
+	void **frames = smalloc(count * sizeof(void *));
+	int allocated, int_flag;
+
+	if(frames == NULL) {
+		return ERR_NOMEM;
+	}
+	allocated = allocate_zeroed_frames(frames, count);
+	if(allocated < count) {
+		free_frames(frames, allocated);
+		sfree(frames, count * sizeof(void *));
+		return ERR_NOMEM;
+	}
+
+	reserve->pd = pd;
+	reserve->frames = frames;
+	reserve->size = count;
+	reserve->count = count;
+	int_flag = spin_lock_irqsave(&reserve_lock);
+	add_to_tail(&reserve->link, &reserves);
+	spin_unlock_irqrestore(&reserve_lock, int_flag);
+	return 0;
+}
+
+/** @brief Gives back the frames vm_reserve_frames() set aside which
+ *  were not used
+ *
+ *  @param reserve The reservation
+ *  @return void
+ */
+void vm_release_frames(frame_reserve_t *reserve) {
+	int int_flag = spin_lock_irqsave(&reserve_lock);
+
+	del_entry(&reserve->link);
+	spin_unlock_irqrestore(&reserve_lock, int_flag);
+	free_frames(reserve->frames, reserve->count);
+	sfree(reserve->frames, reserve->size * sizeof(void *));
+	reserve->frames = NULL;
+}
+
+/** @brief Takes one of the frames set aside for the current page
+ *  directory, if any
+ *
+ *  @return void * a zeroed frame, NULL if none is set aside
+ */
+void *take_reserved_frame() {
+	void *frame_addr = NULL;
+	int *pd = (int *)get_cr3();
+	list_head *node;
+	int int_flag = spin_lock_irqsave(&reserve_lock);
+
+	for(node = reserves.next; node != &reserves; node = node->next) {
+		frame_reserve_t *reserve = get_entry(node, frame_reserve_t, link);
+		if(reserve->pd == pd && reserve->count > 0) {
+			frame_addr = reserve->frames[--reserve->count];
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&reserve_lock, int_flag);
+	return frame_addr;
+}
+
+/** @brief Empties an address space so that a new program can be
+ *  loaded into it
+ *
+ *  Used by exec in place of building a new page directory. Page tables
+ *  private to the task which cover a segment of the new program are
+ *  kept, the others are freed. In the page tables kept, a private frame
+ *  at a page the loader would give a new frame to is zeroed and stays
+ *  mapped, with the protection the new program wants there. Everything
+ *  else is unmapped.
+ *
+ *  @pre pd is the current page directory
+ *  @param pd Address of the page directory
+ *  @param regions The region tree of the program being replaced
+ *  @param se_hdr The parsed elf header of the new program
+ *
+ *  @return Void
+ */
+void reset_paging_info(int *pd, rb_root *regions, simple_elf_t *se_hdr) {
+	int i;
+	rb_node *node;
+	for(node = rb_first(regions); node != NULL; node = rb_next(node)) {
+		vm_region_t *region = get_entry(node, vm_region_t, node);
+		int last = GET_PD_INDEX(region->base + region->len - 1);
+		for(i = GET_PD_INDEX(region->base); i <= last; i++) {
+			unsigned int pd_entry = pd[i];
+			if(pd_entry == PAGE_DIR_ENTRY_DEFAULT) {
+				continue;
+			}
+			if(!IS_LARGE_PAGE(pd_entry) && !(pd_entry & COW_MODE)
+			   && program_covers_pd_index(se_hdr, i)) {
+				reset_page_table(PT_WINDOW(i), i, se_hdr);
+				continue;
+			}
+			set_pd_entry(pd, i, PAGE_DIR_ENTRY_DEFAULT);
+			if(IS_LARGE_PAGE(pd_entry)) {
+				free_large_page(pd_entry);
+			} else {
+				free_page_table((void *)GET_ADDR_FROM_ENTRY(pd_entry));
+			}
+		}
+	}
+	tlb_flush_all();
+}
+
 /** @brief Increments the reference count for all the physical frames
- *  allocated for a given page table
+ *  allocated for a given page table, and for its compressed pages
+ *
+ *  @param pt the page table, mapped in kernel memory
  *
  *  @return void
  */
@@ -318,39 +657,289 @@ void increment_ref_count(int *pt) {
 	}
 	int i;
 	for(i=0; i<NUM_PAGE_TABLE_ENTRIES; i++) {
-		if(pt[i] != PAGE_TABLE_ENTRY_DEFAULT) {
-			void *frame_addr = (void *)GET_ADDR_FROM_ENTRY(pt[i]);
-			lock_frame(frame_addr);
-			frame_ref_count[FRAME_INDEX(frame_addr)]++;
-			unlock_frame(frame_addr);
+		if(pt[i] & PAGE_ENTRY_PRESENT) {
+			ref_frame((void *)GET_ADDR_FROM_ENTRY(pt[i]));
+		} else if(IS_COMPRESSED(pt[i])) {
+			zswap_ref(GET_COMPRESSED_HANDLE(pt[i]));
+		}
+	}
+}
+
+/** @brief Checks whether a segment of a program falls in the 4 MB
+ *  covered by a page directory entry
+ *
+ *  @param se_hdr The parsed elf header of the program
+ *  @param pd_index Index of the page directory entry
+ *
+ *  @return 1 if some segment does, 0 if not
+ */
+int program_covers_pd_index(simple_elf_t *se_hdr, int pd_index) {
+	program_segment_t segments[NUM_PROGRAM_SEGMENTS];
+	unsigned long base = (unsigned long)pd_index << 22;
+	int i, count = get_program_segments(se_hdr, segments);
+
+	for(i = 0; i < count; i++) {
+		if(segments[i].len > 0 && segments[i].start < base + LARGE_PAGE_SIZE
+		   && base <= segments[i].start + segments[i].len - 1) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/** @brief Gets the flags the page table entry of a page would get if
+ *  the loader gave the page a frame of its own
+ *
+ *  Segments are mapped text first, then data, then rodata, and a page
+ *  shared by two segments keeps the flags of the first.
+ *
+ *  @param se_hdr The parsed elf header of the program
+ *  @param addr The address of the page
+ *
+ *  @return int the flags, 0 if the page gets no frame of its own
+ */
+int reused_frame_flags(simple_elf_t *se_hdr, unsigned int addr) {
+	if(text_cache_page_shared(se_hdr, addr)) {
+		return 0;
+	}
+	if(OVERLAPS_PAGE(se_hdr->e_txtstart, se_hdr->e_txtlen, addr)) {
+		return PAGE_ENTRY_PRESENT | USER_MODE;
+	}
+	if(OVERLAPS_PAGE(se_hdr->e_datstart, se_hdr->e_datlen, addr)) {
+		return PAGE_ENTRY_PRESENT | READ_WRITE_ENABLE | USER_MODE;
+	}
+	if(OVERLAPS_PAGE(se_hdr->e_rodatstart, se_hdr->e_rodatlen, addr)) {
+		return PAGE_ENTRY_PRESENT | USER_MODE;
+	}
+	return 0;
+}
+
+/** @brief Empties a page table for a new program, keeping the private
+ *  frames the loader would otherwise have to allocate
+ *
+ *  @param pt The page table, mapped in kernel memory
+ *  @param pd_index Index of its page directory entry
+ *  @param se_hdr The parsed elf header of the new program
+ *
+ *  @return void
+ */
+void reset_page_table(int *pt, int pd_index, simple_elf_t *se_hdr) {
+	int i;
+	for(i = 0; i < NUM_PAGE_TABLE_ENTRIES; i++) {
+		unsigned int entry = pt[i];
+		unsigned int addr = ((unsigned int)pd_index << 22) | (i << 12);
+		if(entry == PAGE_TABLE_ENTRY_DEFAULT) {
+			continue;
+		}
+		if(entry & PAGE_ENTRY_PRESENT) {
+			void *frame_addr = (void *)GET_ADDR_FROM_ENTRY(entry);
+			int flags = reused_frame_flags(se_hdr, addr);
+			if(flags != 0 && frame_addr != zero_frame
+			   && frame_ref_count(frame_addr) == 1) {
+				clear_frame(frame_addr);
+				pt[i] = (unsigned int)frame_addr | flags;
+				continue;
+			}
+			unref_frame(frame_addr);
+		} else if(IS_COMPRESSED(entry)) {
+			zswap_unref(GET_COMPRESSED_HANDLE(entry));
 		}
+		pt[i] = PAGE_TABLE_ENTRY_DEFAULT;
 	}
 }
 
 /*********************COPY-ON-WRITE FUNCTIONS***************************/
 
-/** @brief Function to make the pages for a task copy-on-write
- * 
- *  @param pd Page directory
+/** @brief Function to check if a particular address lies in a region
+ *  whose page table is still shared copy-on-write with another task
  *
- *  @return Void
+ *  @param addr Virtual address to be checked.
+ *
+ *  @return 1 if the page table is COW, 0 if not
  */
-void make_pages_cow(int *pd) {
-	if(pd == NULL) {
-		return;
+int is_addr_pt_cow(void *addr) {
+	if(!IS_USER_ADDR(addr)) {
+		return 0;
+	}
+	int *pd = (void *)get_cr3();
+	int pd_index = GET_PD_INDEX(addr);
+	if((pd[pd_index] & PAGE_ENTRY_PRESENT) && (pd[pd_index] & COW_MODE)) {
+		return 1;
+	}
+	return 0;
+}
+
+/** @brief Function to handle a fault in a region whose page table
+ *  is shared copy-on-write
+ *
+ *  The current task gets its own page table for the region. The 
+ *  faulting instruction is retried afterwards and page level COW and
+ *  demand zero faults are handled then.
+ *
+ *  @param addr The faulting virtual address
+ *
+ *  @return int 0 on success. Negative number on failure
+ */
+int handle_pt_cow(void *addr) {
+	return unshare_page_table((int *)get_cr3(), GET_PD_INDEX(addr));
+}
+
+/** @brief Gives the page directory a private page table for a region
+ *
+ *  If the page table is used by other page directories too, a copy 
+ *  is made. The writable pages in both copies are then made COW, since
+ *  the frames are now mapped by two page tables. The last user of a
+ *  shared page table simply takes it over.
+ *
+ *  Nobody modifies the entries of a shared page table other than to
+ *  make them COW here, so the copy can be made and its frames 
+ *  referenced before taking pt_ref_mutex. If the page directory entry
+ *  changed in the mean time, the copy is thrown away.
+ *
+ *  COW large pages are handed to unshare_large_page().
+ *
+ *  @param pd Page directory, must be the current one
+ *  @param pd_index Index of the page directory entry
+ *
+ *  @return int 0 on success. Negative number on failure
+ */
+int unshare_page_table(int *pd, int pd_index) {
+	unsigned int pd_entry = pd[pd_index];
+	if(!(pd_entry & PAGE_ENTRY_PRESENT) || !(pd_entry & COW_MODE)) {
+		return 0;
+	}
+	if(IS_LARGE_PAGE(pd_entry)) {
+		return unshare_large_page(pd, pd_index);
+	}
+	void *pt = (void *)GET_ADDR_FROM_ENTRY(pd_entry);
+	void *new_pt = NULL;
+	int *window, *entries;
+	tlb_batch_t batch;
+	int i;
+
+	mutex_lock(&pt_ref_mutex);
+	if(frame_ref_count(pt) > 1) {
+		mutex_unlock(&pt_ref_mutex);
+		new_pt = create_page_table();
+		if(new_pt == NULL) {
+			return ERR_NOMEM;
+		}
+		window = temp_map_frame(new_pt);
+		memcpy(window, PT_WINDOW(pd_index), PAGE_SIZE);
+		increment_ref_count(window);
+		temp_unmap_frame(window);
+		mutex_lock(&pt_ref_mutex);
+	}
+
+	if(pd[pd_index] != pd_entry) {
+		/* Someone else unshared it already */
+		mutex_unlock(&pt_ref_mutex);
+		free_page_table(new_pt);
+		return 0;
+	}
+	if(frame_ref_count(pt) == 1) {
+		/* Last user, take the page table over */
+		set_pd_entry(pd, pd_index,
+		             (pd_entry | READ_WRITE_ENABLE) & COW_MODE_DISABLE_MASK);
+		mutex_unlock(&pt_ref_mutex);
+		free_page_table(new_pt);
+	} else {
+		/* The shared page table is read only through PT_WINDOW() */
+		window = temp_map_frame(pt);
+		make_pt_cow(window);
+		temp_unmap_frame(window);
+		window = temp_map_frame(new_pt);
+		make_pt_cow(window);
+		temp_unmap_frame(window);
+		frame_unref(pt);
+		set_pd_entry(pd, pd_index, ((unsigned int)new_pt 
+		             | GET_FLAGS_FROM_ENTRY(pd_entry) | READ_WRITE_ENABLE)
+		             & COW_MODE_DISABLE_MASK);
+		mutex_unlock(&pt_ref_mutex);
+	}
+
+	/* Every page in the region changed protection */
+	tlb_batch_init(&batch);
+	entries = PT_WINDOW(pd_index);
+	for(i=0; i<NUM_PAGE_TABLE_ENTRIES; i++) {
+		if(entries[i] & PAGE_ENTRY_PRESENT) {
+			tlb_batch_add(&batch,
+			              (void *)(((unsigned int)pd_index << 22) | (i << 12)));
+		}
 	}
+	tlb_batch_flush(&batch);
+	return 0;
+}
+
+/** @brief Handles a COW large page
+ *
+ *  If no other task maps the frames anymore, the large page is simply
+ *  made writable again. Otherwise it is split into a page table with 
+ *  COW entries for the same frames, and page level COW takes it from
+ *  there. The page table takes over the references held by the large
+ *  page.
+ *
+ *  fork() references the frames under pt_ref_mutex without changing an
+ *  entry which is COW already, so whether the frames are shared is only
+ *  decided under it. The page table is made beforehand in case they
+ *  are, and given back if they are not.
+ *
+ *  @param pd Page directory, must be the current one
+ *  @param pd_index Index of the page directory entry
+ *
+ *  @return int 0 on success. Negative number on failure
+ */
+int unshare_large_page(int *pd, int pd_index) {
+	unsigned int pd_entry = pd[pd_index];
+	void *page_addr = (void *)((unsigned int)pd_index << 22);
+	unsigned int block = GET_ADDR_FROM_ENTRY(pd_entry);
+	void *pt = create_page_table();
+	int *window;
 	int i;
-	for(i=KERNEL_MAP_NUM_ENTRIES; i<NUM_PAGE_TABLE_ENTRIES; i++) {
-		if(pd[i] != PAGE_DIR_ENTRY_DEFAULT) {
-			make_pt_cow((int *)GET_ADDR_FROM_ENTRY(pd[i]));	
+
+	if(pt != NULL) {
+		window = temp_map_frame(pt);
+		for(i=0; i<NUM_PAGE_TABLE_ENTRIES; i++) {
+			window[i] = (block + i * PAGE_SIZE) | PAGE_ENTRY_PRESENT 
+						| USER_MODE | COW_MODE;
 		}
+		temp_unmap_frame(window);
+	}
+
+	mutex_lock(&pt_ref_mutex);
+	if(pd[pd_index] != pd_entry) {
+		/* Someone else got here first */
+		mutex_unlock(&pt_ref_mutex);
+	} else if(!is_large_page_shared(pd_entry)) {
+		set_pd_entry(pd, pd_index,
+		             (pd_entry | READ_WRITE_ENABLE) & COW_MODE_DISABLE_MASK);
+		mutex_unlock(&pt_ref_mutex);
+	} else if(pt == NULL) {
+		mutex_unlock(&pt_ref_mutex);
+		return ERR_NOMEM;
+	} else {
+		set_pd_entry(pd, pd_index, (unsigned int)pt | USER_PD_ENTRY_FLAGS);
+		mutex_unlock(&pt_ref_mutex);
+		pt = NULL;
+	}
+
+	if(pt != NULL) {
+		/* The entries of the page table hold no references, so only
+		 * the frame is given back */
+		frame_unref(pt);
+		deallocate_frame(pt);
 	}
+	/* A single TLB entry covers the whole large page */
+	tlb_flush_page(page_addr);
+	return 0;
 }
 
 /** @brief Functions to make a page table COW
  *
  *  This function iterates through each page table entry and makes
  *  the writable entries read only along with adding the COW flag.
+ *  Demand zero entries are left alone since each task will fill
+ *  them in on its own.
  *
  *  @return void
  */
@@ -360,7 +949,7 @@ void make_pt_cow(int *pt) {
 	}
 	int i;
 	for(i=0; i<NUM_PAGE_TABLE_ENTRIES; i++) {
-		if(pt[i] == PAGE_TABLE_ENTRY_DEFAULT) {
+		if(!(pt[i] & PAGE_ENTRY_PRESENT)) {
 			continue;
 		}
 		if(GET_FLAGS_FROM_ENTRY(pt[i]) & READ_WRITE_ENABLE) {
@@ -376,14 +965,17 @@ void make_pt_cow(int *pt) {
  *  @return 1 if COW, 0 if not
  */
 int is_addr_cow(void *addr) {
-	if((unsigned int)addr < USER_MEM_START) {
+	if(!IS_USER_ADDR(addr)) {
 		return 0;
 	}
 	int *pd = (void *)get_cr3();
 	int pd_index = GET_PD_INDEX(addr);
 	int pt_index = GET_PT_INDEX(addr);
-	int *pt = (int *)GET_ADDR_FROM_ENTRY(pd[pd_index]);
-	if((pt[pt_index] | COW_MODE) && !(pt[pt_index] & READ_WRITE_ENABLE)
+	if(!(pd[pd_index] & PAGE_ENTRY_PRESENT) || IS_LARGE_PAGE(pd[pd_index])) {
+		return 0;
+	}
+	int *pt = PT_WINDOW(pd_index);
+	if((pt[pt_index] & COW_MODE) && !(pt[pt_index] & READ_WRITE_ENABLE)
 		&& (pt[pt_index]&PAGE_ENTRY_PRESENT)) {
 		return 1;
 	}
@@ -398,71 +990,350 @@ int is_addr_cow(void *addr) {
  *  @return int 0 on success. Negative number on failure
  */
 int handle_cow(void *addr) {
-	int *pd = (void *)get_cr3();
     int pd_index = GET_PD_INDEX(addr);
     int pt_index = GET_PT_INDEX(addr);
-    int *pt = (int *)GET_ADDR_FROM_ENTRY(pd[pd_index]);
-	void *frame_addr = (void *)GET_ADDR_FROM_ENTRY(pt[pt_index]);
+    int *pt = PT_WINDOW(pd_index);
+	unsigned int old_entry = pt[pt_index];
+	void *frame_addr = (void *)GET_ADDR_FROM_ENTRY(old_entry);
     void *page_addr = (void *)((int)addr & PAGE_ROUND_DOWN);
-	lock_frame(frame_addr);
-	if(frame_ref_count[FRAME_INDEX(frame_addr)] == 1) {
-		pt[pt_index] &= COW_MODE_DISABLE_MASK;
-	} else {
-        /* Copy the data from the old frame to a kernel frame */
-		char frame_contents[PAGE_SIZE];
-		memcpy(frame_contents, page_addr, PAGE_SIZE);
-
-		void *new_frame = allocate_frame();
+	if(frame_addr == zero_frame) {
+		/* Nothing to copy, just hand out a fresh zeroed frame */
+		void *new_frame = allocate_colored_zeroed_frame(page_addr);
 		if(new_frame == NULL) {
-			unlock_frame(frame_addr);
-			return ERR_FAILURE;
+			return ERR_NOMEM;
 		}
+		ref_frame(new_frame);
 
-		int flags = GET_FLAGS_FROM_ENTRY(pt[pt_index]);
-		pt[pt_index] = (unsigned int)new_frame | flags;
-		pt[pt_index] &= COW_MODE_DISABLE_MASK;
-        set_cur_pd(pd);
+		/* The allocator may block, recheck the entry once we are back */
+		disable_interrupts();
+		if(GET_ADDR_FROM_ENTRY(pt[pt_index]) != (unsigned int)zero_frame) {
+			enable_interrupts();
+			unref_frame(new_frame);
+			return 0;
+		}
+		int flags = GET_FLAGS_FROM_ENTRY(pt[pt_index]) | READ_WRITE_ENABLE;
+		pt[pt_index] = ((unsigned int)new_frame | flags)
+		               & COW_MODE_DISABLE_MASK;
+		tlb_flush_page(page_addr);
+		enable_interrupts();
+		atomic_add(&fault_stats.zero_fills, 1);
+		return 0;
+	}
+	if(frame_ref_count(frame_addr) == 1) {
+		/* Nobody else maps the frame anymore */
+		pt[pt_index] = (pt[pt_index] | READ_WRITE_ENABLE)
+		               & COW_MODE_DISABLE_MASK;
+		tlb_flush_page(page_addr);
+		atomic_add(&fault_stats.cow_upgrades, 1);
+		return 0;
+	}
 
-        /* Copy data from kernel frame into the new allocated frame and free 
-         * the kernel scratch space */
-        memcpy(page_addr, frame_contents, PAGE_SIZE);
+	/* The copy overwrites the whole frame, a dirty one will do */
+	void *new_frame = allocate_colored_frame(page_addr);
+	if(new_frame == NULL) {
+		return ERR_NOMEM;
+	}
 
-		/* Adjust reference counts */
-		frame_ref_count[FRAME_INDEX(frame_addr)]--;
+    /* Copy the data from the old frame, which is still mapped at 
+     * page_addr, straight into the new frame */
+	void *window = temp_map_frame(new_frame);
+	memcpy(window, page_addr, PAGE_SIZE);
+	temp_unmap_frame(window);
+	ref_frame(new_frame);
 
-		lock_frame(new_frame);
-		frame_ref_count[FRAME_INDEX(new_frame)]++;
-		unlock_frame(new_frame);
+	/* Another thread of this task may have broken the sharing while we
+	 * were copying */
+	disable_interrupts();
+	if(pt[pt_index] != old_entry) {
+		enable_interrupts();
+		unref_frame(new_frame);
+		return 0;
 	}
-	unlock_frame(frame_addr);
-	pt[pt_index] |= READ_WRITE_ENABLE;
-
-	/* INVLPG is not working for some reason :( */
-	set_cur_pd(pd);
+	int flags = GET_FLAGS_FROM_ENTRY(old_entry) | READ_WRITE_ENABLE;
+	pt[pt_index] = ((unsigned int)new_frame | flags) & COW_MODE_DISABLE_MASK;
+	tlb_flush_page(page_addr);
+	enable_interrupts();
 
+	unref_frame(frame_addr);
+	atomic_add(&fault_stats.cow_copies, 1);
 	return 0;
 }
 
 /******************COPY-ON-WRITE FUNCTIONS END*************************/
 
-/** @brief setup paging for a program
- *
- *  this function reads a simple_elf_t and creates mappings in the 
- *  page directory/page table for the regions found in the elf header.
- *  This function DOES NOT copy the data from the binary to these
- *  regions. That is the responsisbility of the loader. 
+/*********************DEMAND ZERO FUNCTIONS***************************/
+
+/** @brief Function to check if a particular address lies in a page
+ *  reserved for demand zero paging which has not been touched yet
  *
- *  @param se_hdr pointer to a simple_elf_t containing info about the 
- *                program to be loaded
- *  @param pd_addr the address of the page directory obtained through
- *                 a previous call to create_page_directory
+ *  @param addr Virtual address to be checked.
  *
- *  @return 0 on success. Negative number on failure
+ *  @return 1 if demand zero, 0 if not
  */
-int setup_page_table(simple_elf_t *se_hdr, void *pd_addr) {
-    if(se_hdr == NULL || pd_addr == NULL) {
-        return ERR_FAILURE;
-    }
+int is_addr_demand_zero(void *addr) {
+	if(!IS_USER_ADDR(addr)) {
+		return 0;
+	}
+	int *pd = (void *)get_cr3();
+	int pd_index = GET_PD_INDEX(addr);
+	int pt_index = GET_PT_INDEX(addr);
+	if(!(pd[pd_index] & PAGE_ENTRY_PRESENT) || IS_LARGE_PAGE(pd[pd_index])) {
+		return 0;
+	}
+	int *pt = PT_WINDOW(pd_index);
+	return IS_DEMAND_ZERO(pt[pt_index]);
+}
+
+/** @brief Function to fill in a demand zero page on first touch
+ *
+ *  A read maps the shared zero frame read only and COW, so that the
+ *  first write goes through handle_cow(). Writes get a private zeroed
+ *  frame right away.
+ *
+ *  @param addr The faulting virtual address
+ *  @param err_code The error code pushed by the page fault
+ *
+ *  @return int 0 on success. Negative number on failure
+ */
+int handle_demand_zero(void *addr, int err_code) {
+    int pd_index = GET_PD_INDEX(addr);
+    int pt_index = GET_PT_INDEX(addr);
+    int *pt = PT_WINDOW(pd_index);
+	int flags = GET_FLAGS_FROM_ENTRY(pt[pt_index]) | PAGE_ENTRY_PRESENT;
+
+	if(!(err_code & PAGE_FAULT_WRITE)) {
+		pt[pt_index] = ((unsigned int)zero_frame | flags | COW_MODE) 
+							& WRITE_DISABLE_MASK;
+		return 0;
+	}
+
+	void *new_frame = take_reserved_frame();
+	if(new_frame == NULL) {
+		new_frame = allocate_colored_zeroed_frame(addr);
+	}
+	if(new_frame == NULL) {
+		return ERR_NOMEM;
+	}
+	ref_frame(new_frame);
+
+	/* Another thread of this task may have filled the page in while we
+	 * were blocked in the allocator */
+	disable_interrupts();
+	if(!IS_DEMAND_ZERO(pt[pt_index])) {
+		enable_interrupts();
+		unref_frame(new_frame);
+		return 0;
+	}
+	pt[pt_index] = (unsigned int)new_frame | flags;
+	enable_interrupts();
+
+	atomic_add(&fault_stats.zero_fills, 1);
+	return 0;
+}
+
+/*******************DEMAND ZERO FUNCTIONS END*************************/
+
+/*********************COMPRESSED PAGE FUNCTIONS***************************/
+
+/** @brief Function to check if a particular address lies in a page
+ *  which was compressed to free its frame
+ *
+ *  @param addr Virtual address to be checked.
+ *
+ *  @return 1 if compressed, 0 if not
+ */
+int is_addr_compressed(void *addr) {
+	if(!IS_USER_ADDR(addr)) {
+		return 0;
+	}
+	int *pd = (void *)get_cr3();
+	int pd_index = GET_PD_INDEX(addr);
+	int pt_index = GET_PT_INDEX(addr);
+	if(!(pd[pd_index] & PAGE_ENTRY_PRESENT) || IS_LARGE_PAGE(pd[pd_index])) {
+		return 0;
+	}
+	int *pt = PT_WINDOW(pd_index);
+	return IS_COMPRESSED(pt[pt_index]);
+}
+
+/** @brief Function to bring a compressed page back on access
+ *
+ *  The page is decompressed into a new frame and mapped with the
+ *  protection it had before. The handle is referenced while this goes
+ *  on, since another thread of the task may bring the same page back 
+ *  and drop the reference of the page table entry in the mean time.
+ *
+ *  @param addr The faulting virtual address
+ *
+ *  @return int 0 on success. Negative number on failure
+ */
+int handle_compressed(void *addr) {
+    int pd_index = GET_PD_INDEX(addr);
+    int pt_index = GET_PT_INDEX(addr);
+    int *pt = PT_WINDOW(pd_index);
+	unsigned int entry;
+	int handle, retval;
+
+	disable_interrupts();
+	entry = pt[pt_index];
+	if(!IS_COMPRESSED(entry)) {
+		enable_interrupts();
+		return 0;
+	}
+	handle = GET_COMPRESSED_HANDLE(entry);
+	zswap_ref(handle);
+	enable_interrupts();
+
+	void *new_frame = allocate_colored_frame(addr);
+	if(new_frame == NULL) {
+		zswap_unref(handle);
+		return ERR_NOMEM;
+	}
+	retval = zswap_load(handle, new_frame);
+	ref_frame(new_frame);
+
+	disable_interrupts();
+	if(pt[pt_index] != entry) {
+		enable_interrupts();
+		unref_frame(new_frame);
+		zswap_unref(handle);
+		return 0;
+	}
+	if(retval < 0) {
+		enable_interrupts();
+		unref_frame(new_frame);
+		zswap_unref(handle);
+		return retval;
+	}
+	pt[pt_index] = (unsigned int)new_frame | PAGE_ENTRY_PRESENT
+	               | (GET_FLAGS_FROM_ENTRY(entry) & ~COMPRESSED_PAGE);
+	enable_interrupts();
+
+	/* Ours, and the one the page table entry held */
+	zswap_unref(handle);
+	zswap_unref(handle);
+	return 0;
+}
+
+/** @brief Compress cold pages of the current task to free their frames
+ *
+ *  A clock sweep goes over the regions of the task, starting where 
+ *  the last one stopped. A page accessed since the sweep last passed
+ *  it has its accessed bit cleared and is left alone, one that was not
+ *  is compressed. Only private pages are taken: pages in a page table
+ *  still shared after a fork, COW pages and large pages are skipped.
+ *  Frames of the text cache no task maps anymore, and frames of dead
+ *  tasks the reaper has not got to yet, are cheaper to get back, so
+ *  they go first.
+ *
+ *  @pre the region mutex of the current task is held
+ *  @param count the number of pages wanted
+ *  @param regions the region tree of the current task
+ *
+ *  @return int the number of frames freed
+ */
+int reclaim_pages(int count, rb_root *regions) {
+	int reclaimed, trip;
+
+	reclaimed = text_cache_trim(count);
+	if(reclaimed < count) {
+		reclaimed += reap_drain(count - reclaimed);
+	}
+	if(reclaimed >= count) {
+		return reclaimed;
+	}
+	reclaimed += reclaim_scan(regions, reclaim_hand, count - reclaimed);
+
+	/* Once around from the start, and once more for the pages whose
+	 * accessed bit that cleared */
+	for(trip = 0; trip < 2 && reclaimed < count; trip++) {
+		reclaimed += reclaim_scan(regions, USER_MEM_START, count - reclaimed);
+	}
+	return reclaimed;
+}
+
+/*******************COMPRESSED PAGE FUNCTIONS END*************************/
+
+/** @brief count the pages of the current task by how they are backed
+ *
+ *  The counts are taken from the page tables when asked for, rather
+ *  than kept up to date on every change: whether a frame is shared also
+ *  changes when another task drops it.
+ *
+ *  @pre the region mutex of the current task is held
+ *  @param regions the region tree of the current task
+ *  @param stats where to put the counts
+ *
+ *  @return void
+ */
+void get_task_vm_stats(rb_root *regions, vm_task_stats_t *stats) {
+	int *pd = (int *)get_cr3();
+	int i, last_pd_index = -1;
+	unsigned int addr, next_page = 0;
+	rb_node *node;
+
+	memset(stats, 0, sizeof(vm_task_stats_t));
+	for(node = rb_first(regions); node != NULL; node = rb_next(node)) {
+		vm_region_t *region = get_entry(node, vm_region_t, node);
+		unsigned int last = region->base + region->len - 1;
+
+		/* Two program segments can share a page */
+		addr = region->base & PAGE_ROUND_DOWN;
+		if(addr < next_page) {
+			addr = next_page;
+		}
+		for(; addr <= last; addr += PAGE_SIZE) {
+			count_page(pd, addr, stats);
+		}
+		next_page = addr;
+
+		for(i = GET_PD_INDEX(region->base); i <= (int)GET_PD_INDEX(last);
+		    i++) {
+			if(i > last_pd_index && pd[i] != PAGE_DIR_ENTRY_DEFAULT
+			   && !IS_LARGE_PAGE(pd[i])) {
+				stats->page_tables++;
+			}
+		}
+		last_pd_index = GET_PD_INDEX(last);
+	}
+}
+
+/** @brief get a snapshot of the fault counters
+ *
+ *  @param stats where to put the counters
+ *
+ *  @return void
+ */
+void get_vm_fault_stats(vm_fault_stats_t *stats) {
+	int int_flag = get_eflags() & EFL_IF;
+
+	disable_interrupts();
+	*stats = fault_stats;
+	if(int_flag) {
+		enable_interrupts();
+	}
+}
+
+/** @brief setup paging for a program
+ *
+ *  this function reads a simple_elf_t and creates mappings in the 
+ *  page directory/page table for the regions found in the elf header.
+ *  This function DOES NOT copy the data from the binary to these
+ *  regions. That is the responsisbility of the loader. The regions are
+ *  also added to the region tree of the task.
+ *
+ *  @param se_hdr pointer to a simple_elf_t containing info about the 
+ *                program to be loaded
+ *  @param pd_addr the address of the page directory obtained through
+ *                 a previous call to create_page_directory
+ *  @param regions the (empty) region tree of the task
+ *
+ *  @return 0 on success. Negative number on failure
+ */
+int setup_page_table(simple_elf_t *se_hdr, void *pd_addr, rb_root *regions) {
+    if(se_hdr == NULL || pd_addr == NULL || regions == NULL) {
+        return ERR_FAILURE;
+    }
     int retval;
     if((retval = map_text_segment(se_hdr, pd_addr)) < 0) {
         return retval;
@@ -479,24 +1350,254 @@ int setup_page_table(simple_elf_t *se_hdr, void *pd_addr) {
     if((retval = map_stack_segment(pd_addr)) < 0) {
         return retval;
     }
+    return add_program_regions(se_hdr, regions);
+}
+
+/** @brief map a physical frame into the kernel address space
+ *
+ *  The frame shows up at the temporary mapping window, in every address
+ *  space, until temp_unmap_frame() is called. Only one frame can be 
+ *  mapped at a time, others wanting the window block until then.
+ *
+ *  @param frame_addr the physical frame to be mapped
+ *
+ *  @return the kernel virtual address of the frame
+ */
+void *temp_map_frame(void *frame_addr) {
+    int *pt = direct_map[GET_PD_INDEX(temp_map_window)];
+
+    mutex_lock(&temp_map_mutex);
+    pt[GET_PT_INDEX(temp_map_window)] = (unsigned int)frame_addr 
+                                | PAGE_ENTRY_PRESENT | READ_WRITE_ENABLE;
+    tlb_flush_page(temp_map_window);
+    return temp_map_window;
+}
+
+/** @brief undo a temp_map_frame()
+ *
+ *  @param addr the address returned by temp_map_frame()
+ *
+ *  @return void
+ */
+void temp_unmap_frame(void *addr) {
+    int *pt = direct_map[GET_PD_INDEX(temp_map_window)];
+
+    kernel_assert(addr == temp_map_window);
+    pt[GET_PT_INDEX(temp_map_window)] = (unsigned int)temp_map_window 
+                | PAGE_ENTRY_PRESENT | READ_WRITE_ENABLE | GLOBAL_PAGE_ENTRY;
+    tlb_flush_page(temp_map_window);
+    mutex_unlock(&temp_map_mutex);
+}
+
+/** @brief zero fill a physical frame
+ *
+ * @param frame_addr the physical frame to be zeroed
+ *
+ * @return void
+ */
+void clear_frame(void *frame_addr) {
+    void *window = temp_map_frame(frame_addr);
+    memset(window, 0, PAGE_SIZE);
+    temp_unmap_frame(window);
+}
+
+/** @brief zero fill a physical frame on behalf of the idle thread
+ *
+ *  Same as clear_frame() but goes through an idle thread window, so it
+ *  never waits for another thread to release the temporary mapping
+ *  window.
+ *
+ *  @pre Called only by the idle thread, never reentered
+ *  @param frame_addr the physical frame to be zeroed
+ *
+ *  @return void
+ */
+void clear_frame_idle(void *frame_addr) {
+    void *window = idle_map_frame(IDLE_WINDOW_ZERO, frame_addr);
+    memset(window, 0, PAGE_SIZE);
+    idle_unmap_frame(IDLE_WINDOW_ZERO);
+}
+
+/** @brief map a physical frame on behalf of the idle thread
+ *
+ *  Same as temp_map_frame(), but through one of the windows set aside
+ *  for the idle thread.
+ *
+ *  @pre Called only by the idle thread, the window is not in use
+ *  @param window one of the IDLE_WINDOW_* windows
+ *  @param frame_addr the physical frame to be mapped
+ *
+ *  @return the kernel virtual address of the frame
+ */
+void *idle_map_frame(int window, void *frame_addr) {
+    void *addr = idle_map_windows[window];
+    int *pt = direct_map[GET_PD_INDEX(addr)];
+
+    pt[GET_PT_INDEX(addr)] = (unsigned int)frame_addr 
+                             | PAGE_ENTRY_PRESENT | READ_WRITE_ENABLE;
+    tlb_flush_page(addr);
+    return addr;
+}
+
+/** @brief undo an idle_map_frame()
+ *
+ *  @param window the window passed to idle_map_frame()
+ *
+ *  @return void
+ */
+void idle_unmap_frame(int window) {
+    void *addr = idle_map_windows[window];
+    int *pt = direct_map[GET_PD_INDEX(addr)];
+
+    pt[GET_PT_INDEX(addr)] = (unsigned int)addr 
+                | PAGE_ENTRY_PRESENT | READ_WRITE_ENABLE | GLOBAL_PAGE_ENTRY;
+    tlb_flush_page(addr);
+}
+
+/** @brief copy into pages of the current address space regardless of
+ *         their protection
+ *
+ *  The loader fills in the read only segments of a program, which the
+ *  kernel cannot write to directly with write protection on. The data
+ *  goes in through the frames backing the pages instead.
+ *
+ *  @pre the pages are present, private and not large pages
+ *  @param dst the user address to copy to
+ *  @param src the kernel buffer to copy from
+ *  @param len the number of bytes to copy
+ *
+ *  @return int 0 on success, ERR_INVAL if some page is not mapped,
+ *          ERR_NOMEM if a compressed page could not be brought back
+ */
+int copy_to_user_frames(void *dst, const void *src, int len) {
+    int *pd = (int *)get_cr3();
+    char *addr = dst;
+    const char *from = src;
+
+    while (len > 0) {
+        int offset = (unsigned int)addr & ~PAGE_ROUND_DOWN;
+        int chunk = PAGE_SIZE - offset < len ? PAGE_SIZE - offset : len;
+        unsigned int pd_entry = pd[GET_PD_INDEX(addr)];
+        int *pt;
+
+        if (!(pd_entry & PAGE_ENTRY_PRESENT) || IS_LARGE_PAGE(pd_entry)) {
+            return ERR_INVAL;
+        }
+        pt = PT_WINDOW(GET_PD_INDEX(addr));
+        if (IS_COMPRESSED(pt[GET_PT_INDEX(addr)])
+            && handle_compressed(addr) < 0) {
+            return ERR_NOMEM;
+        }
+        if (!(pt[GET_PT_INDEX(addr)] & PAGE_ENTRY_PRESENT)) {
+            return ERR_INVAL;
+        }
+        char *window = temp_map_frame(
+                        (void *)GET_ADDR_FROM_ENTRY(pt[GET_PT_INDEX(addr)]));
+        memcpy(window + offset, from, chunk);
+        temp_unmap_frame(window);
+        addr += chunk;
+        from += chunk;
+        len -= chunk;
+    }
     return 0;
 }
 
+/** @brief map a frame which other tasks map as well into a task
+ *
+ *  The page table is created or unshared as needed. The mapping takes
+ *  a reference on the frame.
+ *
+ *  @pre pd_addr is the current page directory
+ *  @param addr the page aligned user address
+ *  @param frame_addr the physical frame
+ *  @param pd_addr the page directory
+ *  @param flags the flags of the page table entry
+ *
+ *  @return int 0 on success, ERR_NOMEM if out of frames, ERR_INVAL if
+ *          the page is mapped already
+ */
+int map_shared_page(void *addr, void *frame_addr, int *pd_addr, int flags) {
+    int pd_index = GET_PD_INDEX(addr);
+    int pt_index = GET_PT_INDEX(addr);
+    int *pt;
+
+    if (pd_addr[pd_index] == PAGE_DIR_ENTRY_DEFAULT) {
+        void *new_pt = create_page_table();
+        if (new_pt == NULL) {
+            return ERR_NOMEM;
+        }
+        set_pd_entry(pd_addr, pd_index,
+                     (unsigned int)new_pt | USER_PD_ENTRY_FLAGS);
+    }
+    if (IS_LARGE_PAGE(pd_addr[pd_index])) {
+        return ERR_INVAL;
+    }
+    if (unshare_page_table(pd_addr, pd_index) < 0) {
+        return ERR_NOMEM;
+    }
+    pt = PT_WINDOW(pd_index);
+    if (pt[pt_index] != PAGE_TABLE_ENTRY_DEFAULT) {
+        return ERR_INVAL;
+    }
+    ref_frame(frame_addr);
+    pt[pt_index] = (unsigned int)frame_addr | flags;
+    return 0;
+}
+
+/** @brief map a frame at a kernel address above KERNEL_HIGH_START
+ *
+ *  The mapping is global and shows up in every address space.
+ *
+ *  @param addr the page aligned kernel address
+ *  @param frame_addr the physical frame
+ *
+ *  @return void
+ */
+void map_kernel_page(void *addr, void *frame_addr) {
+    int *pt = high_map[GET_PD_INDEX(addr) - GET_PD_INDEX(KERNEL_HIGH_START)];
+
+    kernel_assert((unsigned int)addr >= KERNEL_HIGH_START
+                  && (unsigned int)addr < PT_WINDOW_START);
+    pt[GET_PT_INDEX(addr)] = (unsigned int)frame_addr | PAGE_ENTRY_PRESENT
+                             | READ_WRITE_ENABLE | GLOBAL_PAGE_ENTRY;
+}
+
+/** @brief undo a map_kernel_page()
+ *
+ *  @param addr the kernel address
+ *
+ *  @return void * the frame which was mapped there
+ */
+void *unmap_kernel_page(void *addr) {
+    int *pt = high_map[GET_PD_INDEX(addr) - GET_PD_INDEX(KERNEL_HIGH_START)];
+    void *frame_addr = (void *)GET_ADDR_FROM_ENTRY(pt[GET_PT_INDEX(addr)]);
+
+    pt[GET_PT_INDEX(addr)] = PAGE_TABLE_ENTRY_DEFAULT;
+    tlb_flush_page(addr);
+    return frame_addr;
+}
+
 /* ---------- Static local functions ----------- */
 
-/** @brief zero fill a memory location
+/** @brief set up the temporary mapping window
  *
- * @param addr the starting address of the memory location to be zeroed
- * @param size the number of bytes to be zeroed
+ *  A page of kernel memory is taken out of the direct map and its
+ *  page table entry is pointed at other frames on demand. Nobody else
+ *  uses the physical frame behind it, so nothing is lost while the
+ *  window points elsewhere.
  *
- * @return void
+ *  @return void
  */
-void zero_fill(void *addr, int size) {
-    if (addr == NULL) {
-        return;
+void setup_temp_map_window() {
+    int i;
+
+    temp_map_window = smemalign(PAGE_SIZE, PAGE_SIZE);
+    kernel_assert(temp_map_window != NULL);
+    mutex_init(&temp_map_mutex);
+    for (i = 0; i < NUM_IDLE_WINDOWS; i++) {
+        idle_map_windows[i] = smemalign(PAGE_SIZE, PAGE_SIZE);
+        kernel_assert(idle_map_windows[i] != NULL);
     }
-    memset(addr, 0, size);
-    return;
 }
 
 /** @brief direct map the kernel memory space
@@ -507,7 +1608,9 @@ void zero_fill(void *addr, int size) {
  *  the page directory for all processes point to the same page tables for
  *  kernel memory). Therefore this function should be called once the mapping
  *  has been setup (setup_direct_map) and this simply copies the value in the
- *  direct_map array to the page directory.
+ *  direct_map array to the page directory. The page tables for the kernel
+ *  part above KERNEL_HIGH_START are shared the same way, and the last
+ *  entry points at the page directory itself.
  *
  * @param pd_addr the page directory where the direct mapping has to be 
  * 			performed
@@ -516,10 +1619,15 @@ void zero_fill(void *addr, int size) {
  */
 void direct_map_kernel_pages(void *pd_addr) {
     int flags = PAGE_ENTRY_PRESENT | READ_WRITE_ENABLE;
+    int *pd = pd_addr;
     int i;
     for (i = 0; i < KERNEL_MAP_NUM_ENTRIES; i++) {
-        ((int *)pd_addr)[i] = (int)direct_map[i] | flags;
+        pd[i] = (int)direct_map[i] | flags;
     }
+    for (i = 0; i < KERNEL_HIGH_NUM_ENTRIES; i++) {
+        pd[GET_PD_INDEX(KERNEL_HIGH_START) + i] = (int)high_map[i] | flags;
+    }
+    pd[PT_WINDOW_PD_INDEX] = (int)pd | flags;
 }
 
 /** @brief set up the direct map for kernel memory
@@ -537,9 +1645,7 @@ void setup_direct_map() {
     int i = 0, j = 0, mem_start = 0, page_table_entry;
 
     for (i = 0; i < KERNEL_MAP_NUM_ENTRIES; i++) {
-        int *frame_addr = (int *)create_page_table();
-
-        kernel_assert(frame_addr != NULL);
+        int *frame_addr = create_kernel_page_table();
 
         for (j = 0; j < NUM_PAGE_TABLE_ENTRIES; j++) {
             page_table_entry = mem_start | flags;
@@ -550,6 +1656,55 @@ void setup_direct_map() {
     }
 }
 
+/** @brief set up the page tables for the kernel part above
+ *         KERNEL_HIGH_START
+ *
+ *  They start out empty and are shared by all page directories, like
+ *  the ones of the direct map.
+ *
+ *  @return void
+ */
+void setup_high_map() {
+    int i, j;
+    for (i = 0; i < KERNEL_HIGH_NUM_ENTRIES; i++) {
+        high_map[i] = create_kernel_page_table();
+        for (j = 0; j < NUM_PAGE_TABLE_ENTRIES; j++) {
+            high_map[i][j] = PAGE_TABLE_ENTRY_DEFAULT;
+        }
+    }
+}
+
+/** @brief allocate a page table for kernel memory
+ *
+ *  These page tables are never freed and come from the kernel heap, 
+ *  since the frame allocator is not up yet when they are set up.
+ *
+ *  @return int * the page table
+ */
+int *create_kernel_page_table() {
+    int *pt = (int *)smemalign(PAGE_SIZE, PAGE_SIZE);
+    kernel_assert(pt != NULL);
+    return pt;
+}
+
+/** @brief change an entry of a page directory
+ *
+ *  If pd is the current page directory, the page table the entry used
+ *  to point to is still cached in the TLB at PT_WINDOW(), and is thrown
+ *  out.
+ *
+ *  @param pd the page directory
+ *  @param pd_index the index of the entry
+ *  @param entry the new value of the entry
+ *  @return void
+ */
+void set_pd_entry(int *pd, int pd_index, unsigned int entry) {
+    pd[pd_index] = entry;
+    if ((int *)get_cr3() == pd) {
+        tlb_flush_page(PT_WINDOW(pd_index));
+    }
+}
+
 /** @brief map the text segment into virtual memory
  *
  *  This function checks the address of the start of the text
@@ -603,117 +1758,545 @@ int map_rodata_segment(simple_elf_t *se_hdr, void *pd_addr) {
 
 /** @brief map the bss segment into virtual memory
  *
- *  This function checks the address of the start of the bss
- *  segment and length to define the number of physical frames
- *  required for the bss segment. Then call a function which allocates
- *  free frames from the frame pool, sets up the mapping in the page directory.
+ *  The bss segment is anonymous memory, so its pages are only reserved
+ *  here and get filled in by the page fault handler on first touch. A
+ *  page shared with the data segment has already been mapped and is
+ *  left as it is.
  *
  *  @param se_hdr the parsed elf header
  *  @param pd_addr the address of the page directory frame
  *  @return int error code, 0 on success negative integer on failure
  */
 int map_bss_segment(simple_elf_t *se_hdr, void *pd_addr) {
-    int flags = PAGE_ENTRY_PRESENT | READ_WRITE_ENABLE | USER_MODE;
+    int flags = READ_WRITE_ENABLE | USER_MODE;
     return map_segment((void *)se_hdr->e_bssstart, se_hdr->e_bsslen, 
 						pd_addr, flags);
 }
 
 /** @brief map the stack segment into virtual memory
+ *
+ *  The stack pages are only reserved, they are filled in on first touch.
  *
  *  @param pd_addr the address of the page directory frame
  *  @return int error code, 0 on success negative integer on failure
  */
 int map_stack_segment(void *pd_addr) {
-    int flags = PAGE_ENTRY_PRESENT | READ_WRITE_ENABLE | USER_MODE;
+    int flags = READ_WRITE_ENABLE | USER_MODE;
     return map_segment((char *)STACK_START - DEFAULT_STACK_SIZE + 1, 
 						DEFAULT_STACK_SIZE, pd_addr, flags); 
 }
 
+/** @brief record the segments of a program in a region tree
+ *
+ *  Empty segments get no region.
+ *
+ *  @param se_hdr the parsed elf header
+ *  @param regions the region tree
+ *  @return int error code, 0 on success negative integer on failure
+ */
+int add_program_regions(simple_elf_t *se_hdr, rb_root *regions) {
+    program_segment_t segments[NUM_PROGRAM_SEGMENTS];
+    int i, count, retval;
+
+    count = get_program_segments(se_hdr, segments);
+    for (i = 0; i < count; i++) {
+        if (segments[i].len == 0) {
+            continue;
+        }
+        retval = region_insert(regions, (void *)segments[i].start,
+                               segments[i].len, segments[i].flags);
+        if (retval < 0) {
+            return retval;
+        }
+    }
+    return 0;
+}
+
+/** @brief list the segments of a program, the stack included
+ *
+ *  @param se_hdr the parsed elf header
+ *  @param segments array of NUM_PROGRAM_SEGMENTS to fill in
+ *  @return int the number of segments, some of which may be empty
+ */
+int get_program_segments(simple_elf_t *se_hdr, program_segment_t *segments) {
+    program_segment_t list[NUM_PROGRAM_SEGMENTS] = {
+        { se_hdr->e_txtstart, se_hdr->e_txtlen, REGION_READ | REGION_EXEC },
+        { se_hdr->e_datstart, se_hdr->e_datlen, REGION_READ | REGION_WRITE },
+        { se_hdr->e_rodatstart, se_hdr->e_rodatlen, REGION_READ },
+        { se_hdr->e_bssstart, se_hdr->e_bsslen, REGION_READ | REGION_WRITE },
+        { STACK_START - DEFAULT_STACK_SIZE + 1, DEFAULT_STACK_SIZE,
+          REGION_READ | REGION_WRITE }
+    };
+    memcpy(segments, list, sizeof(list));
+    return NUM_PROGRAM_SEGMENTS;
+}
+
+/** @brief count the frames loading a program may take at most
+ *
+ *  Every page of the text, data and rodata segments may need a frame,
+ *  every 4 MB a segment reaches into a page table, and so do the stack
+ *  pages the arguments are copied to. The bss and the rest of the stack
+ *  are filled in on first touch, once the program runs.
+ *
+ *  @param se_hdr the parsed elf header
+ *  @param arg_bytes bytes the arguments take on the user stack
+ *  @return int the number of frames
+ */
+int program_frames_needed(simple_elf_t *se_hdr, unsigned int arg_bytes) {
+    program_segment_t segments[NUM_PROGRAM_SEGMENTS];
+    unsigned int pt_seen[NUM_PAGE_TABLE_ENTRIES / 32];
+    unsigned long first, last;
+    int i, pd_index, count, frames = 0;
+
+    memset(pt_seen, 0, sizeof(pt_seen));
+    count = get_program_segments(se_hdr, segments);
+    for (i = 0; i < count; i++) {
+        if (segments[i].len == 0) {
+            continue;
+        }
+        first = segments[i].start & PAGE_ROUND_DOWN;
+        last = (segments[i].start + segments[i].len - 1) & PAGE_ROUND_DOWN;
+        if (i < NUM_FILE_SEGMENTS) {
+            frames += (last - first) / PAGE_SIZE + 1;
+        }
+        for (pd_index = GET_PD_INDEX(first); pd_index <= GET_PD_INDEX(last);
+             pd_index++) {
+            if (!(pt_seen[pd_index / 32] & (1u << (pd_index % 32)))) {
+                pt_seen[pd_index / 32] |= 1u << (pd_index % 32);
+                frames++;
+            }
+        }
+    }
+    first = (STACK_START - arg_bytes) & PAGE_ROUND_DOWN;
+    frames += (STACK_START - 1 - first) / PAGE_SIZE + 1;
+    return frames;
+}
+
 /** @brief map new_pages into virtual memory
  *
+ *  Every 4 MB aligned, 4 MB sized piece of the region is backed by a
+ *  large page if a contiguous run of frames is free. The rest of the 
+ *  pages are only reserved, they are filled in on first touch. The
+ *  region is added to the region tree of the task.
+ *
+ *  @pre the region mutex of the current task is held
  *  @param base the base of the new_pages region
  *  @param len the length of the new pages region
+ *  @param regions the region tree of the current task
  *  @return int error code, 0 on success negative integer on failure
  */
-int map_new_pages(void *base, int length) {
-    int retval, pd_index, pt_index;
+int map_new_pages(void *base, int length, rb_root *regions) {
+    int retval;
     int *pd_addr = (int *)get_cr3();
-    int *pt_addr;
-    int *end_addr = (int *)((char *)base + length - 1);
-    int *end_frame = (int *)((int)end_addr & PAGE_ROUND_DOWN);
-    int flags = PAGE_ENTRY_PRESENT | READ_WRITE_ENABLE | USER_MODE
-                | NEWPAGE_PAGE;
-    retval = map_segment((char *)base, length, pd_addr, flags); 
-    if (retval < 0) {
-        return retval;
+    int flags = READ_WRITE_ENABLE | USER_MODE;
+
+    if (!IS_USER_ADDR(base) || length <= 0
+        || (unsigned int)length > USER_MEM_END - (unsigned int)base
+        || region_overlaps(regions, base, length)) {
+        return ERR_INVAL;
     }
 
-    pd_index = GET_PD_INDEX(end_frame);
-    pt_index = GET_PT_INDEX(end_frame);
-    pt_addr = (int *)GET_ADDR_FROM_ENTRY(pd_addr[pd_index]);
-    pt_addr[pt_index] = SET_NEWPAGE_END(pt_addr[pt_index]);
+    retval = map_large_pages(base, length, pd_addr);
+    if (retval == 0) {
+        retval = map_segment((char *)base, length, pd_addr, flags); 
+    }
 
-    pd_index = GET_PD_INDEX(base);
-    pt_index = GET_PT_INDEX(base);
-    pt_addr = (int *)GET_ADDR_FROM_ENTRY(pd_addr[pd_index]);
-    pt_addr[pt_index] = SET_NEWPAGE_START(pt_addr[pt_index]);
+    /* Page tables come from the user frame pool, so compressing cold
+     * pages makes room for them. Entries set up already are kept. */
+    while (retval == ERR_NOMEM
+           && reclaim_pages(RECLAIM_BATCH_SIZE, regions) > 0) {
+        retval = map_segment((char *)base, length, pd_addr, flags);
+    }
+    if (retval == 0) {
+        retval = region_insert(regions, base, length,
+                               REGION_READ | REGION_WRITE | REGION_NEW_PAGES);
+    }
+    if (retval < 0) {
+        /* Nothing maps into the range yet, which makes it safe to 
+         * throw away whatever got set up */
+        clear_range(pd_addr, base, length, regions);
+        return retval;
+    }
 
-	/* INVLPG is not working for some reason :( */
-	set_cur_pd(pd_addr);
+	/* Only entries which were not present changed, and those are never
+	 * cached in the TLB, so there is nothing to invalidate */
 
     return 0;
 }
 
 /** @brief unmap new_pages from virtual memory
  *
+ *  @pre the region mutex of the current task is held
  *  @param base the base of the new_pages region
+ *  @param regions the region tree of the current task
  *  @return int error code, 0 on success negative integer on failure
  */
-int unmap_new_pages(void *base) {
-    int pd_index, pt_index;
+int unmap_new_pages(void *base, rb_root *regions) {
     int *pd_addr = (int *)get_cr3();
-    int *pt_addr;
-    void *frame_addr;
+    vm_region_t *region = region_find(regions, base);
+    unsigned int length;
+    int pd_index, last;
 
-    pd_index = GET_PD_INDEX(base);
-    pt_index = GET_PT_INDEX(base);
-    pt_addr = (int *)GET_ADDR_FROM_ENTRY(pd_addr[pd_index]);
-    if (GET_NEWPAGE_FLAGS(pt_addr[pt_index]) != NEWPAGE_START) {
+    if (region == NULL || region->base != (unsigned int)base
+        || !(region->flags & REGION_NEW_PAGES)) {
         return ERR_INVAL;
     }
+    length = region->len;
 
-    frame_addr = (void *)GET_ADDR_FROM_ENTRY(pt_addr[pt_index]);
-	lock_frame(frame_addr);
-	frame_ref_count[FRAME_INDEX(frame_addr)]--;
-	if(frame_ref_count[FRAME_INDEX(frame_addr)] == 0) {
-    	deallocate_frame(frame_addr); 
-	}
-	unlock_frame(frame_addr);
-	pt_addr[pt_index] = PAGE_TABLE_ENTRY_DEFAULT;
-    
-    base = (char *)base + PAGE_SIZE;
-    pd_index = GET_PD_INDEX(base);
-    pt_index = GET_PT_INDEX(base);
-    pt_addr = (int *)GET_ADDR_FROM_ENTRY(pd_addr[pd_index]);
-    while((GET_NEWPAGE_FLAGS(pt_addr[pt_index]) == NEWPAGE_PAGE) 
-          || (GET_NEWPAGE_FLAGS(pt_addr[pt_index]) == NEWPAGE_END)) { 
-        frame_addr = (void *)GET_ADDR_FROM_ENTRY(pt_addr[pt_index]);
-		lock_frame(frame_addr);
-		frame_ref_count[FRAME_INDEX(frame_addr)]--;
-		if(frame_ref_count[FRAME_INDEX(frame_addr)] == 0) {
-			deallocate_frame(frame_addr); 
-		}
-		unlock_frame(frame_addr);
-        pt_addr[pt_index] = PAGE_TABLE_ENTRY_DEFAULT;
-        base = (char *)base + PAGE_SIZE;
-        pd_index = GET_PD_INDEX(base);
-        pt_index = GET_PT_INDEX(base);
-        pt_addr = (int *)GET_ADDR_FROM_ENTRY(pd_addr[pd_index]);
+    /* Get private copies of page tables still shared after a fork
+     * before any entry is touched. Large pages are released as a
+     * whole, so they are left alone. */
+    last = GET_PD_INDEX((char *)base + length - 1);
+    for (pd_index = GET_PD_INDEX(base); pd_index <= last; pd_index++) {
+        if (IS_LARGE_PAGE(pd_addr[pd_index])) {
+            continue;
+        }
+        if (unshare_page_table(pd_addr, pd_index) < 0) {
+            return ERR_NOMEM;
+        }
     }
 
-	/* INVLPG is not working for some reason :( */
-	set_cur_pd(pd_addr);
+    region_remove(regions, base, REGION_NEW_PAGES);
+    clear_range(pd_addr, base, length, regions);
+    return 0;
+}
 
+/** @brief unmap every page of a range
+ *
+ *  The frames are released, and so are the page tables which no 
+ *  longer cover any region. A frame is only released once the TLB
+ *  entries for the pages unmapped so far are flushed, so that it is
+ *  never handed out again while a stale entry still points at it.
+ *
+ *  @pre page tables in the range are not shared with another task
+ *  @param pd the current page directory
+ *  @param base the first byte of the range, page aligned
+ *  @param length the length of the range
+ *  @param regions the region tree, which no longer has the range in it
+ *  @return void
+ */
+void clear_range(int *pd, void *base, unsigned int length, 
+                 rb_root *regions) {
+    unsigned int addr = (unsigned int)base;
+    unsigned int last = addr + length - 1;
+    void *frames[TLB_BATCH_MAX];
+    int num_frames = 0, pd_index, i;
+    tlb_batch_t batch;
+
+    tlb_batch_init(&batch);
+    while (addr >= (unsigned int)base && addr <= last) {
+        pd_index = GET_PD_INDEX(addr);
+        if (pd[pd_index] == PAGE_DIR_ENTRY_DEFAULT) {
+            addr = (addr & LARGE_PAGE_ROUND_DOWN) + LARGE_PAGE_SIZE;
+        } else if (IS_LARGE_PAGE(pd[pd_index])) {
+            unsigned int pd_entry = pd[pd_index];
+            set_pd_entry(pd, pd_index, PAGE_DIR_ENTRY_DEFAULT);
+            tlb_flush_page((void *)addr);
+            free_large_page(pd_entry);
+            addr = (addr & LARGE_PAGE_ROUND_DOWN) + LARGE_PAGE_SIZE;
+        } else {
+            int *pt = PT_WINDOW(pd_index);
+            int pt_index = GET_PT_INDEX(addr);
+            if (pt[pt_index] & PAGE_ENTRY_PRESENT) {
+                if (num_frames == TLB_BATCH_MAX) {
+                    tlb_batch_flush(&batch);
+                    for (i = 0; i < num_frames; i++) {
+                        unref_frame(frames[i]);
+                    }
+                    num_frames = 0;
+                }
+                frames[num_frames++] =
+                    (void *)GET_ADDR_FROM_ENTRY(pt[pt_index]);
+                tlb_batch_add(&batch, (void *)addr);
+            } else if (IS_COMPRESSED(pt[pt_index])) {
+                zswap_unref(GET_COMPRESSED_HANDLE(pt[pt_index]));
+            }
+            pt[pt_index] = PAGE_TABLE_ENTRY_DEFAULT;
+            addr += PAGE_SIZE;
+        }
+    }
+    tlb_batch_flush(&batch);
+    for (i = 0; i < num_frames; i++) {
+        unref_frame(frames[i]);
+    }
+
+    /* Page tables at either end may still be in use by a neighbour,
+     * unless the neighbour has nothing mapped in them */
+    for (pd_index = GET_PD_INDEX(base); pd_index <= GET_PD_INDEX(last);
+         pd_index++) {
+        void *pt_base = (void *)((unsigned int)pd_index << 22);
+        if (pd[pd_index] == PAGE_DIR_ENTRY_DEFAULT
+            || IS_LARGE_PAGE(pd[pd_index])
+            || (region_overlaps(regions, pt_base, LARGE_PAGE_SIZE)
+                && !page_table_empty(PT_WINDOW(pd_index)))) {
+            continue;
+        }
+        int *pt = (int *)GET_ADDR_FROM_ENTRY(pd[pd_index]);
+        set_pd_entry(pd, pd_index, PAGE_DIR_ENTRY_DEFAULT);
+        tlb_flush_page(pt_base);
+        free_page_table(pt);
+        atomic_add(&fault_stats.page_tables_freed, 1);
+    }
+}
+
+/** @brief check whether a page table maps nothing at all
+ *
+ *  An entry for a demand zero or compressed page counts as mapping
+ *  something.
+ *
+ *  @param pt the page table, mapped in kernel memory
+ *  @return int 1 if every entry is the default one, 0 if not
+ */
+int page_table_empty(int *pt) {
+    int i;
+    for (i = 0; i < NUM_PAGE_TABLE_ENTRIES; i++) {
+        if (pt[i] != PAGE_TABLE_ENTRY_DEFAULT) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/** @brief add a page of the current address space to the counters of
+ *         its task
+ *
+ *  A page is shared if its frame is mapped somewhere else too, which
+ *  includes the zero frame and every page of a page table or large page
+ *  still shared after a fork.
+ *
+ *  @param pd the current page directory
+ *  @param addr the address of the page
+ *  @param stats the counters
+ *  @return void
+ */
+void count_page(int *pd, unsigned int addr, vm_task_stats_t *stats) {
+    int pd_index = GET_PD_INDEX(addr);
+    unsigned int pd_entry = pd[pd_index];
+    unsigned int entry;
+    void *frame_addr;
+
+    if (pd_entry == PAGE_DIR_ENTRY_DEFAULT) {
+        return;
+    }
+    if (IS_LARGE_PAGE(pd_entry)) {
+        entry = pd_entry;
+        frame_addr = (char *)GET_ADDR_FROM_ENTRY(pd_entry)
+                     + GET_PT_INDEX(addr) * PAGE_SIZE;
+    } else {
+        entry = PT_WINDOW(pd_index)[GET_PT_INDEX(addr)];
+        if (IS_COMPRESSED(entry)) {
+            stats->compressed++;
+            return;
+        }
+        if (!(entry & PAGE_ENTRY_PRESENT)) {
+            return;
+        }
+        frame_addr = (void *)GET_ADDR_FROM_ENTRY(entry);
+    }
+    if (frame_addr == zero_frame || (pd_entry & COW_MODE)
+        || frame_ref_count(frame_addr) > 1) {
+        stats->shared++;
+    } else {
+        stats->resident++;
+    }
+    if ((entry | pd_entry) & COW_MODE) {
+        stats->cow++;
+    }
+}
+
+/** @brief sweep the regions of the current task for cold pages
+ *
+ *  @param regions the region tree of the current task
+ *  @param from the address to start at
+ *  @param count the number of pages wanted
+ *  @return int the number of pages compressed
+ */
+int reclaim_scan(rb_root *regions, unsigned int from, int count) {
+    int *pd = (int *)get_cr3();
+    int reclaimed = 0;
+    tlb_batch_t batch;
+    rb_node *node;
+
+    tlb_batch_init(&batch);
+    for (node = rb_first(regions); node != NULL; node = rb_next(node)) {
+        vm_region_t *region = get_entry(node, vm_region_t, node);
+        unsigned int addr = region->base & PAGE_ROUND_DOWN;
+        unsigned int last = region->base + region->len - 1;
+
+        if (last < from) {
+            continue;
+        }
+        if (addr < from) {
+            addr = from & PAGE_ROUND_DOWN;
+        }
+        while (addr <= last) {
+            unsigned int pd_entry = pd[GET_PD_INDEX(addr)];
+            if (!(pd_entry & PAGE_ENTRY_PRESENT) || (pd_entry & COW_MODE)
+                || IS_LARGE_PAGE(pd_entry)) {
+                addr = (addr & LARGE_PAGE_ROUND_DOWN) + LARGE_PAGE_SIZE;
+                continue;
+            }
+            reclaimed += reclaim_page((void *)addr, &batch);
+            addr += PAGE_SIZE;
+            if (reclaimed == count) {
+                tlb_batch_flush(&batch);
+                reclaim_hand = addr;
+                return reclaimed;
+            }
+        }
+    }
+    tlb_batch_flush(&batch);
+    reclaim_hand = USER_MEM_START;
+    return reclaimed;
+}
+
+/** @brief age or compress a page of the current address space
+ *
+ *  Nothing but the MMU changes a private, present entry while the 
+ *  region mutex is held. The dirty bit is cleared before the page is
+ *  compressed and looked at again before the entry is switched over:
+ *  if it got set, the page was written to in the mean time and the
+ *  compressed copy is thrown away.
+ *
+ *  @pre the page table covering addr is present and private
+ *  @param addr the page
+ *  @param batch where to add the page if its TLB entry goes stale
+ *  @return int 1 if the page was compressed, 0 if not
+ */
+int reclaim_page(void *addr, tlb_batch_t *batch) {
+    int *pt = PT_WINDOW(GET_PD_INDEX(addr));
+    int pt_index = GET_PT_INDEX(addr);
+    unsigned int entry = pt[pt_index];
+    void *frame_addr = (void *)GET_ADDR_FROM_ENTRY(entry);
+    int handle;
+
+    if (!(entry & PAGE_ENTRY_PRESENT) || (entry & COW_MODE)
+        || frame_addr == zero_frame || frame_ref_count(frame_addr) != 1) {
+        return 0;
+    }
+
+    disable_interrupts();
+    entry = pt[pt_index];
+    if (entry & PAGE_ACCESSED) {
+        /* Recently used, give it another round */
+        pt[pt_index] = entry & ~PAGE_ACCESSED;
+        enable_interrupts();
+        tlb_batch_add(batch, addr);
+        return 0;
+    }
+    entry &= ~PAGE_DIRTY;
+    pt[pt_index] = entry;
+    tlb_flush_page(addr);
+    enable_interrupts();
+
+    handle = zswap_store(frame_addr);
+    if (handle < 0) {
+        return 0;
+    }
+
+    disable_interrupts();
+    if ((pt[pt_index] & ~PAGE_ACCESSED) != entry) {
+        enable_interrupts();
+        zswap_unref(handle);
+        return 0;
+    }
+    pt[pt_index] = MAKE_COMPRESSED_ENTRY(handle, entry & ~PAGE_DIRTY
+                                         & ~PAGE_ACCESSED);
+    tlb_flush_page(addr);
+    enable_interrupts();
+
+    unref_frame(frame_addr);
+    return 1;
+}
+
+/** @brief back the 4 MB aligned parts of a region with large pages
+ *
+ *  Stops at the first part for which no contiguous run of frames is
+ *  free, map_segment() maps the rest with small pages. Parts whose page
+ *  table exists already are left to map_segment() as well.
+ *
+ *  @param base the base of the region
+ *  @param length the length of the region
+ *  @param pd the page directory
+ *  @return int error code, 0 on success negative integer on failure
+ */
+int map_large_pages(void *base, int length, int *pd) {
+    unsigned int end_addr = (unsigned int)base + length - 1;
+    unsigned int chunk = ((unsigned int)base + LARGE_PAGE_SIZE - 1) 
+                         & LARGE_PAGE_ROUND_DOWN;
+    int i;
+
+    while (chunk >= (unsigned int)base
+           && chunk + LARGE_PAGE_SIZE - 1 <= end_addr
+           && chunk + LARGE_PAGE_SIZE - 1 > chunk) {
+        int pd_index = GET_PD_INDEX(chunk);
+        if (pd[pd_index] == PAGE_DIR_ENTRY_DEFAULT) {
+            void *block = allocate_frame_block(MAX_FRAME_ORDER);
+            if (block == NULL) {
+                break;
+            }
+            for (i = 0; i < NUM_PAGE_TABLE_ENTRIES; i++) {
+                void *frame_addr = (char *)block + i * PAGE_SIZE;
+                clear_frame(frame_addr);
+                ref_frame(frame_addr);
+            }
+            set_pd_entry(pd, pd_index, (unsigned int)block 
+                         | PAGE_ENTRY_PRESENT | READ_WRITE_ENABLE | USER_MODE
+                         | LARGE_PAGE_ENTRY);
+        }
+        chunk += LARGE_PAGE_SIZE;
+    }
+    return 0;
+}
+
+/** @brief take a reference on every frame of a large page
+ *
+ *  @param pd_entry the page directory entry of the large page
+ *  @return void
+ */
+void ref_large_page(unsigned int pd_entry) {
+    char *block = (char *)GET_ADDR_FROM_ENTRY(pd_entry);
+    int i;
+    for (i = 0; i < NUM_PAGE_TABLE_ENTRIES; i++) {
+        frame_ref(block + i * PAGE_SIZE);
+    }
+}
+
+/** @brief drop the references a large page holds on its frames
+ *
+ *  @param pd_entry the page directory entry of the large page
+ *  @return void
+ */
+void free_large_page(unsigned int pd_entry) {
+    char *block = (char *)GET_ADDR_FROM_ENTRY(pd_entry);
+    void *frames[FRAME_BATCH_SIZE];
+    int i, nframes = 0;
+    for (i = 0; i < NUM_PAGE_TABLE_ENTRIES; i++) {
+        if (frame_unref(block + i * PAGE_SIZE) > 0) {
+            continue;
+        }
+        frames[nframes++] = block + i * PAGE_SIZE;
+        if (nframes == FRAME_BATCH_SIZE) {
+            free_frames(frames, nframes);
+            nframes = 0;
+        }
+    }
+    free_frames(frames, nframes);
+}
+
+/** @brief check if any frame of a large page is mapped elsewhere too
+ *
+ *  @param pd_entry the page directory entry of the large page
+ *  @return int 1 if shared, 0 if not
+ */
+int is_large_page_shared(unsigned int pd_entry) {
+    char *block = (char *)GET_ADDR_FROM_ENTRY(pd_entry);
+    int i;
+    for (i = 0; i < NUM_PAGE_TABLE_ENTRIES; i++) {
+        if (frame_ref_count(block + i * PAGE_SIZE) > 1) {
+            return 1;
+        }
+    }
     return 0;
 }
 
@@ -722,120 +2305,91 @@ int unmap_new_pages(void *base) {
  *  This function takes the starting virtual address and the length. Then
  *  calculate the total number of frames required for this range of memory 
  *  allocate those many frames and set up the mapping in the page directory.
+ *  If flags does not have PAGE_ENTRY_PRESENT set, no frames are allocated
+ *  and the entries are reserved for demand zero paging instead.
  *
+ *  @pre pd_addr is the current page directory
  *  @param start_addr the start of the virtual address
  *  @param length the length of this memory segment
  *  @param pd_addr the address of the page directory
+ *  @param flags the flags for the page table entries
  *
  *  @return int error code, 0 on success negative integer on failure
  */
 int map_segment(void *start_addr, unsigned int length, int *pd_addr, int flags) {
-    set_cur_pd(pd_addr);
     void *end_addr = (char *)start_addr + length;
     int pd_index, pt_index;
     int *pt_addr;
+    void *frames[FRAME_BATCH_SIZE];
+    int nframes = 0, next_frame = 0, retval = 0;
 
     start_addr = (void *)((int)start_addr & PAGE_ROUND_DOWN);
     while (start_addr < end_addr) {
         pd_index = GET_PD_INDEX(start_addr);
         pt_index = GET_PT_INDEX(start_addr);
+        if (IS_LARGE_PAGE(pd_addr[pd_index])) { /* Mapped by map_large_pages */
+            start_addr = (void *)(((unsigned int)start_addr
+                                   & LARGE_PAGE_ROUND_DOWN)
+                                  + LARGE_PAGE_SIZE);
+            if (start_addr == NULL) {
+                break;
+            }
+            continue;
+        }
         if (pd_addr[pd_index] == PAGE_DIR_ENTRY_DEFAULT) { /* Page directory entry absent */
             void *new_pt = create_page_table();
             if (new_pt != NULL) {
-                pd_addr[pd_index] = (unsigned int)new_pt | USER_PD_ENTRY_FLAGS;
+                set_pd_entry(pd_addr, pd_index,
+                             (unsigned int)new_pt | USER_PD_ENTRY_FLAGS);
             }
             else {
-                return ERR_NOMEM;
+                retval = ERR_NOMEM;
+                break;
             }
         }
-        pt_addr = (int *)GET_ADDR_FROM_ENTRY(pd_addr[pd_index]);
+        if (unshare_page_table(pd_addr, pd_index) < 0) {
+            retval = ERR_NOMEM;
+            break;
+        }
+        pt_addr = PT_WINDOW(pd_index);
         if (pt_addr[pt_index] == PAGE_TABLE_ENTRY_DEFAULT) { /* Page table entry absent */
-            /* Need to allocate frame from user free frame pool */
-            void *new_frame = allocate_frame();
-            if (new_frame != NULL) {
-				lock_frame(new_frame);
-                frame_ref_count[FRAME_INDEX(new_frame)]++;
-				unlock_frame(new_frame);
-                pt_addr[pt_index] = (unsigned int)new_frame | flags;
-                zero_fill(start_addr, PAGE_SIZE);
+            if (!(flags & PAGE_ENTRY_PRESENT)) {
+                /* Filled in by the page fault handler on first touch */
+                pt_addr[pt_index] = flags | DEMAND_ZERO_PAGE;
+                start_addr = (char *)start_addr + PAGE_SIZE;
+                continue;
             }
-            else {
-                return ERR_NOMEM;
+            /* Need to allocate frame from user free frame pool, grab
+             * a batch of them at a time. Frames of the right color
+             * have to be picked one page at a time. */
+            if (next_frame == nframes) {
+                int pages_left = ((char *)end_addr - (char *)start_addr 
+                                  + PAGE_SIZE - 1) / PAGE_SIZE;
+                frames[0] = take_reserved_frame();
+                if (frames[0] != NULL) {
+                    nframes = 1;
+                } else if (frame_coloring_enabled()) {
+                    frames[0] = allocate_colored_zeroed_frame(start_addr);
+                    nframes = frames[0] != NULL;
+                } else {
+                    nframes = allocate_zeroed_frames(frames,
+                                          pages_left < FRAME_BATCH_SIZE
+                                          ? pages_left : FRAME_BATCH_SIZE);
+                }
+                next_frame = 0;
+                if (nframes == 0) {
+                    retval = ERR_NOMEM;
+                    break;
+                }
             }
+            void *new_frame = frames[next_frame++];
+            ref_frame(new_frame);
+            pt_addr[pt_index] = (unsigned int)new_frame | flags;
         }
         start_addr = (char *)start_addr + PAGE_SIZE;
     }
-    return 0;
-}
 
-/** @brief check if a memory region is mapped in the current 
- *         process's usable address space
- *
- *  This function makes use of the paging info of the current process
- *  to determine if any part of the memory range passed in has already
- *  been mapped.
- *
- *  @param base the base of the memory range to be checked
- *  @param len the length of the memory range to be checked
- *
- *  @return MEMORY_REGION_MAPPED if any portion of the range passed in is 
- *          already mapped or is in kernel address space. 
- *          MEMORY_REGION_UNMAPPED if the entire range is not mapped in the
- *          process address space and is not in the kernel address space. 
- *          ERR_INVAL if illegal arguments are passed in.
- */
-int is_memory_range_mapped(void *base, int len) {
-    if (base == NULL || base > (void *)MAX_MEMORY_ADDR ||
-        len <= 0 || len > (MAX_AVAILABLE_USER_MEM)) {
-        return ERR_INVAL;
-    } 
-    if (base < (void *)USER_MEM_START) {
-        return MEMORY_REGION_MAPPED;
-    }
-    void *end_addr = (char *)base + len;
-    int *pd_addr = (int *)get_cr3();
-    int *pt_addr;
-    int pd_index, pt_index;
-
-    base = (void *)((int)base & PAGE_ROUND_DOWN);
-    while (base <= end_addr) {
-        pd_index = GET_PD_INDEX(base);
-        pt_index = GET_PT_INDEX(base);
-        if (pd_addr[pd_index] != PAGE_DIR_ENTRY_DEFAULT) {
-            pt_addr = (int *)GET_ADDR_FROM_ENTRY(pd_addr[pd_index]);
-            if (pt_addr[pt_index] != PAGE_TABLE_ENTRY_DEFAULT) {
-                return MEMORY_REGION_MAPPED;
-            }
-        }
-        base = (char *)base + PAGE_SIZE;
-    }
-
-    return MEMORY_REGION_UNMAPPED;
+    /* Pages which were mapped already did not need their frames */
+    free_frames(frames + next_frame, nframes - next_frame);
+    return retval;
 }
-
-/** @brief check if memory location is user writable
- *
- *  Check if memory location pointed to by ptr can be written to by user
- *
- *  @param ptr memory address
- *  @param bytes number of bytes that have to be written
- *  @return 0 on success, -ve integer if cannot be written to
- */
-int is_memory_writable(void *ptr, int bytes) {
-    int *pd_addr = (int *)get_cr3();
-    int *pt_addr;
-    int pd_index, pt_index;
-        
-    pd_index = GET_PD_INDEX(ptr);
-    pt_index = GET_PT_INDEX(ptr);
-    if (pd_addr[pd_index] != PAGE_DIR_ENTRY_DEFAULT) {
-        pt_addr = (int *)GET_ADDR_FROM_ENTRY(pd_addr[pd_index]);
-        if (pt_addr[pt_index] != PAGE_TABLE_ENTRY_DEFAULT) {
-            if (pt_addr[pt_index] & READ_WRITE_ENABLE) {
-                return 0;
-            }
-        }
-    }
-    return ERR_INVAL;
-}
-
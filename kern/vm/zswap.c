@@ -0,0 +1,393 @@
+/** @file zswap.c
+ *  @brief compressed store for user pages evicted under memory pressure
+ *
+ *  Pages are compressed one 32 bit word at a time. The output is a
+ *  sequence of blocks, each starting with a header word. A run block
+ *  stands for a word repeated a number of times and holds that word
+ *  only, a literal block is followed by the words copied as they are.
+ *  This is cheap, and works well on the pages user programs leave
+ *  behind: mostly zero, or filled with the same few values. Pages which
+ *  do not shrink to ZSWAP_MAX_COMPRESSED bytes are not worth keeping
+ *  and are turned down.
+ *
+ *  The compressed data lives in the kernel heap, up to
+ *  ZSWAP_MAX_POOL_SIZE bytes of it. The handle table and the counters
+ *  are only touched with interrupts disabled, since handles are
+ *  dropped while the temporary mapping window is held.
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+#include <vm/zswap.h>
+#include <vm/vm.h>
+#include <page.h>
+#include <asm.h>
+#include <asm/asm.h>
+#include <eflags.h>
+#include <string.h>
+#include <stddef.h>
+#include <simics.h>
+#include <sync/mutex.h>
+#include <common/malloc_wrappers.h>
+#include <common/errors.h>
+#include <common/assert.h>
+#include <drivers/timer/timer.h>
+
+#define WORDS_PER_PAGE (PAGE_SIZE / sizeof(unsigned int))
+#define ZSWAP_MAX_COMPRESSED (PAGE_SIZE * 3 / 4)
+#define MIN_RUN 3   /* Shorter runs are cheaper to keep as literals */
+
+#define RUN_HEADER(count) (((count) << 1) | 1)
+#define LITERAL_HEADER(count) ((count) << 1)
+#define IS_RUN_HEADER(header) ((header) & 1)
+#define HEADER_COUNT(header) ((header) >> 1)
+
+/** @brief a compressed page */
+typedef struct zswap_entry {
+    unsigned int *data;     /* Compressed data, NULL if the entry is free */
+    int len;                /* Length of the data in bytes */
+    volatile int refs;      /* Page table entries holding the handle */
+} zswap_entry_t;
+
+static zswap_entry_t entries[ZSWAP_MAX_ENTRIES];
+static int free_handles[ZSWAP_MAX_ENTRIES];
+static int num_free_handles;
+static int next_unused_handle;
+static zswap_stats_t stats;
+
+/* Protects the buffer pages are compressed into */
+static mutex_t compress_mutex;
+static unsigned int compress_buf[WORDS_PER_PAGE];
+
+static int compress_page(const unsigned int *src, unsigned int *dst,
+                         int max_words);
+static int decompress_page(const unsigned int *src, int nwords,
+                           unsigned int *dst);
+static int run_length(const unsigned int *src, int start, int limit);
+static int get_handle(int len);
+static void put_handle(int handle);
+static void release_handle(int handle);
+
+/** @brief initialize the compressed store
+ *
+ *  @return void
+ */
+void zswap_init() {
+    num_free_handles = 0;
+    next_unused_handle = 0;
+    memset(&stats, 0, sizeof(stats));
+    mutex_init(&compress_mutex);
+}
+
+/** @brief compress a frame into the store
+ *
+ *  The frame is left as it is, it is up to the caller to unmap and
+ *  release it once the handle is in the page table entry.
+ *
+ *  @param frame_addr the physical frame
+ *  @return int the handle with a single reference, ERR_BIG if the page
+ *          does not compress well enough, ERR_NOMEM if the store is full
+ */
+int zswap_store(void *frame_addr) {
+    unsigned int *window, *data;
+    int len, handle;
+
+    mutex_lock(&compress_mutex);
+    window = temp_map_frame(frame_addr);
+    len = compress_page(window, compress_buf,
+                        ZSWAP_MAX_COMPRESSED / sizeof(unsigned int));
+    temp_unmap_frame(window);
+    if (len < 0) {
+        mutex_unlock(&compress_mutex);
+        disable_interrupts();
+        stats.rejects++;
+        enable_interrupts();
+        return len;
+    }
+
+    data = smalloc(len);
+    if (data != NULL) {
+        memcpy(data, compress_buf, len);
+    }
+    mutex_unlock(&compress_mutex);
+
+    handle = data == NULL ? ERR_NOMEM : get_handle(len);
+    if (handle < 0) {
+        if (data != NULL) {
+            sfree(data, len);
+        }
+        disable_interrupts();
+        stats.rejects++;
+        enable_interrupts();
+        return handle;
+    }
+    entries[handle].data = data;
+    entries[handle].refs = 1;
+    return handle;
+}
+
+/** @brief decompress a page from the store into a frame
+ *
+ *  @pre the caller holds a reference on the handle
+ *  @param handle the handle of the page
+ *  @param frame_addr the physical frame to fill in
+ *  @return int 0 on success, ERR_INVAL if the data is corrupt
+ */
+int zswap_load(int handle, void *frame_addr) {
+    zswap_entry_t *entry = &entries[handle];
+    unsigned int *window;
+    int retval;
+
+    kernel_assert(handle >= 0 && handle < next_unused_handle);
+    kernel_assert(entry->data != NULL);
+
+    window = temp_map_frame(frame_addr);
+    retval = decompress_page(entry->data, entry->len / sizeof(unsigned int),
+                             window);
+    temp_unmap_frame(window);
+
+    disable_interrupts();
+    stats.loads++;
+    enable_interrupts();
+    return retval;
+}
+
+/** @brief take a reference on a compressed page
+ *
+ *  @param handle the handle of the page
+ *  @return void
+ */
+void zswap_ref(int handle) {
+    kernel_assert(handle >= 0 && handle < next_unused_handle);
+    atomic_add(&entries[handle].refs, 1);
+}
+
+/** @brief drop a reference on a compressed page, throwing the page
+ *         away when the last one goes
+ *
+ *  @param handle the handle of the page
+ *  @return void
+ */
+void zswap_unref(int handle) {
+    int refs;
+
+    kernel_assert(handle >= 0 && handle < next_unused_handle);
+    refs = atomic_add(&entries[handle].refs, -1);
+    kernel_assert(refs >= 0);
+    if (refs == 0) {
+        put_handle(handle);
+    }
+}
+
+/** @brief zswap_unref() for callers which must not block
+ *
+ *  The last reference is only dropped if the compressed data can be
+ *  freed right away.
+ *
+ *  @param handle the handle of the page
+ *  @return int 0 if the reference was dropped, ERR_BUSY if it was kept
+ */
+int zswap_unref_nowait(int handle) {
+    int int_flag = get_eflags() & EFL_IF;
+    int retval = 0;
+
+    kernel_assert(handle >= 0 && handle < next_unused_handle);
+    disable_interrupts();
+    kernel_assert(entries[handle].refs > 0);
+    if (entries[handle].refs > 1) {
+        entries[handle].refs--;
+    } else {
+        retval = sfree_nowait(entries[handle].data, entries[handle].len);
+        if (retval == 0) {
+            entries[handle].refs = 0;
+            release_handle(handle);
+        }
+    }
+    if (int_flag) {
+        enable_interrupts();
+    }
+    return retval;
+}
+
+/** @brief get a snapshot of the counters of the store
+ *
+ *  @param out where to put the counters
+ *  @return void
+ */
+void zswap_get_stats(zswap_stats_t *out) {
+    disable_interrupts();
+    *out = stats;
+    enable_interrupts();
+}
+
+/** @brief print the counters of the store
+ *
+ *  Used for debugging. The compression ratio is the memory the stored
+ *  pages would take uncompressed over the memory they do take, and the
+ *  fault rate is counted per thousand timer ticks since boot.
+ *
+ *  @return void
+ */
+void zswap_print_stats() {
+    zswap_stats_t s;
+    unsigned int ticks = total_ticks();
+
+    zswap_get_stats(&s);
+    lprintf("Compressed pages: %d in %d bytes (ratio %d.%02d)",
+            s.stored_pages, s.pool_size,
+            s.pool_size ? s.stored_pages * PAGE_SIZE / s.pool_size : 0,
+            s.pool_size ? (s.stored_pages * PAGE_SIZE % s.pool_size) * 100
+                          / s.pool_size : 0);
+    lprintf("Pages compressed: %d, turned down: %d", s.stores, s.rejects);
+    lprintf("Compressed page faults: %d (%d per 1000 ticks)", s.loads,
+            ticks >= 1000 ? s.loads / (int)(ticks / 1000) : s.loads);
+}
+
+/* ---------- Static local functions ----------- */
+
+/** @brief compress a page
+ *
+ *  @param src the page
+ *  @param dst where to put the compressed data
+ *  @param max_words the room in dst, in words
+ *  @return int the length of the compressed data in bytes, ERR_BIG if
+ *          it does not fit in max_words
+ */
+int compress_page(const unsigned int *src, unsigned int *dst,
+                  int max_words) {
+    int i = 0, out = 0;
+
+    while (i < WORDS_PER_PAGE) {
+        int run = run_length(src, i, WORDS_PER_PAGE);
+        int start = i;
+
+        if (run >= MIN_RUN) {
+            if (out + 2 > max_words) {
+                return ERR_BIG;
+            }
+            dst[out++] = RUN_HEADER(run);
+            dst[out++] = src[i];
+            i += run;
+            continue;
+        }
+
+        /* Gather words up to the next run worth encoding */
+        while (i < WORDS_PER_PAGE && run_length(src, i, MIN_RUN) < MIN_RUN) {
+            i++;
+        }
+        if (out + 1 + (i - start) > max_words) {
+            return ERR_BIG;
+        }
+        dst[out++] = LITERAL_HEADER(i - start);
+        memcpy(&dst[out], &src[start], (i - start) * sizeof(unsigned int));
+        out += i - start;
+    }
+    return out * sizeof(unsigned int);
+}
+
+/** @brief decompress a page
+ *
+ *  @param src the compressed data
+ *  @param nwords the length of the compressed data in words
+ *  @param dst the page to fill in
+ *  @return int 0 on success, ERR_INVAL if the data does not make up
+ *          exactly one page
+ */
+int decompress_page(const unsigned int *src, int nwords, unsigned int *dst) {
+    int in = 0, out = 0, i;
+
+    while (in < nwords) {
+        unsigned int header = src[in++];
+        int count = HEADER_COUNT(header);
+
+        if (count > WORDS_PER_PAGE - out) {
+            return ERR_INVAL;
+        }
+        if (IS_RUN_HEADER(header)) {
+            if (in == nwords) {
+                return ERR_INVAL;
+            }
+            for (i = 0; i < count; i++) {
+                dst[out++] = src[in];
+            }
+            in++;
+        } else {
+            if (count > nwords - in) {
+                return ERR_INVAL;
+            }
+            memcpy(&dst[out], &src[in], count * sizeof(unsigned int));
+            out += count;
+            in += count;
+        }
+    }
+    return out == WORDS_PER_PAGE ? 0 : ERR_INVAL;
+}
+
+/** @brief count how many times a word repeats
+ *
+ *  @param src the page
+ *  @param start the index of the word
+ *  @param limit stop counting at this many
+ *  @return int the length of the run starting at start, at most limit
+ */
+int run_length(const unsigned int *src, int start, int limit) {
+    int i = start + 1;
+    while (i < WORDS_PER_PAGE && i - start < limit && src[i] == src[start]) {
+        i++;
+    }
+    return i - start;
+}
+
+/** @brief reserve a handle and room in the pool for a compressed page
+ *
+ *  @param len the length of the compressed data in bytes
+ *  @return int the handle, ERR_NOMEM if out of handles or pool space
+ */
+int get_handle(int len) {
+    int handle = ERR_NOMEM;
+
+    disable_interrupts();
+    if (stats.pool_size + len <= ZSWAP_MAX_POOL_SIZE) {
+        if (num_free_handles > 0) {
+            handle = free_handles[--num_free_handles];
+        } else if (next_unused_handle < ZSWAP_MAX_ENTRIES) {
+            handle = next_unused_handle++;
+        }
+    }
+    if (handle >= 0) {
+        entries[handle].len = len;
+        stats.stored_pages++;
+        stats.pool_size += len;
+        stats.stores++;
+    }
+    enable_interrupts();
+    return handle;
+}
+
+/** @brief free a compressed page and its handle
+ *
+ *  @param handle the handle of the page
+ *  @return void
+ */
+void put_handle(int handle) {
+    unsigned int *data = entries[handle].data;
+    int len = entries[handle].len;
+
+    sfree(data, len);
+    disable_interrupts();
+    release_handle(handle);
+    enable_interrupts();
+}
+
+/** @brief put the handle of a freed compressed page back in the pool
+ *
+ *  @pre interrupts are disabled and the data of the page is freed
+ *  @param handle the handle of the page
+ *  @return void
+ */
+void release_handle(int handle) {
+    stats.stored_pages--;
+    stats.pool_size -= entries[handle].len;
+    entries[handle].data = NULL;
+    free_handles[num_free_handles++] = handle;
+}
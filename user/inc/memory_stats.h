@@ -0,0 +1,32 @@
+/** @file memory_stats.h
+ *  @brief the memory_stats system call
+ *
+ *  The layout of memory_stats_t must match the one in
+ *  kern/inc/syscalls/system_check_syscalls.h.
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+
+#ifndef __MEMORY_STATS_H
+#define __MEMORY_STATS_H
+
+/** @brief memory use of the calling task and fault counters */
+typedef struct memory_stats {
+    /* Pages of the calling task */
+    int resident;           /* Pages with a frame nobody else maps */
+    int shared;             /* Pages with a frame mapped elsewhere too */
+    int cow;                /* Of those two, pages to be copied on write */
+    int compressed;         /* Pages in the compressed store */
+    int page_tables;        /* Page tables, shared ones included */
+
+    /* Faults handled since boot, for all tasks */
+    int cow_copies;         /* COW pages copied to a frame of their own */
+    int cow_upgrades;       /* COW pages made writable, as the last user */
+    int zero_fills;         /* Pages given a new zeroed frame */
+    int page_tables_freed;  /* Page tables freed after remove_pages() */
+} memory_stats_t;
+
+int memory_stats(memory_stats_t *stats);
+
+#endif /* __MEMORY_STATS_H */
@@ -0,0 +1,17 @@
+/** @file set_priority.h
+ *  @brief the set_priority system call
+ *
+ *  SCHED_LEVELS must match the one in kern/inc/core/task.h.
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+
+#ifndef __SET_PRIORITY_H
+#define __SET_PRIORITY_H
+
+#define SCHED_LEVELS 8      /* Priorities, 0 is the highest */
+
+int set_priority(int tid, int priority);
+
+#endif /* __SET_PRIORITY_H */
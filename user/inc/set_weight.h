@@ -0,0 +1,18 @@
+/** @file set_weight.h
+ *  @brief the set_weight system call
+ *
+ *  The weights must match the ones in kern/inc/core/scheduler.h.
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ */
+
+#ifndef __SET_WEIGHT_H
+#define __SET_WEIGHT_H
+
+#define SCHED_WEIGHT_DEFAULT 1024   /* Weight of a task at creation */
+#define SCHED_WEIGHT_MAX 65536      /* Largest weight a task can get */
+
+int set_weight(int tid, int weight);
+
+#endif /* __SET_WEIGHT_H */
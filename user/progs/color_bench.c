@@ -0,0 +1,127 @@
+/** @file color_bench.c
+ *
+ *  @brief Benchmark for the color aware frame allocation
+ *
+ *  Sweeps buffers of a few sizes around the size of the cache with a
+ *  stride of one cache line and prints the ticks the sweeps took. The
+ *  color aware mode of the frame allocator is picked at boot, so the
+ *  benchmark is run once on a kernel booted as usual and once on one
+ *  booted with "frame_coloring" on its command line.
+ *
+ *  Before that, physical memory is broken up by mapping a lot of single
+ *  pages and unmapping every other one. Without colors the buffers then
+ *  get every other frame, i.e. only half of the colors, and the sweeps
+ *  of buffers about as large as the cache suffer conflict misses. With
+ *  colors every page of a buffer gets a frame of its own color and the
+ *  sweeps run out of the cache.
+ *
+ *  The buffers start one page past a 4 MB boundary. new_pages() backs
+ *  4 MB aligned parts of a region with large pages, which take no
+ *  colors, and none of the buffers has such a part.
+ *
+ *  The numbers only mean something on real hardware, simulators do not
+ *  model the cache.
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ *
+ *  @bug None known
+ */
+
+#include <syscall.h>
+#include <stdio.h>
+#include <simics.h>
+
+#define SCRAMBLE_BASE ((char *)0x40000000)
+#define SCRAMBLE_PAGES 2048             /* Pages used to break memory up */
+#define BUF_BASE ((char *)0x50001000)  /* Not 4 MB aligned */
+#define MAX_BUF_SIZE (4 * 1024 * 1024)
+#define LINE_SIZE 64                    /* Stride of the sweeps */
+#define SWEEPS 64                       /* Sweeps timed per buffer */
+
+static int buf_sizes[] = { 128 * 1024, 256 * 1024, 512 * 1024,
+                           1024 * 1024, 2 * 1024 * 1024, MAX_BUF_SIZE };
+#define NUM_BUF_SIZES (sizeof(buf_sizes) / sizeof(buf_sizes[0]))
+
+/** @brief map single pages and unmap every other one
+ *
+ *  @return int 0 on success, -1 if out of memory
+ */
+static int scramble_memory() {
+    int i;
+    for (i = 0; i < SCRAMBLE_PAGES; i++) {
+        char *page = SCRAMBLE_BASE + i * PAGE_SIZE;
+        if (new_pages(page, PAGE_SIZE) < 0) {
+            return -1;
+        }
+        *page = 1;  /* Make sure a frame backs the page */
+    }
+    for (i = 1; i < SCRAMBLE_PAGES; i += 2) {
+        remove_pages(SCRAMBLE_BASE + i * PAGE_SIZE);
+    }
+    return 0;
+}
+
+/** @brief unmap the pages left over by scramble_memory()
+ *
+ *  @return void
+ */
+static void unscramble_memory() {
+    int i;
+    for (i = 0; i < SCRAMBLE_PAGES; i += 2) {
+        remove_pages(SCRAMBLE_BASE + i * PAGE_SIZE);
+    }
+}
+
+/** @brief time sweeps over a buffer
+ *
+ *  The buffer is mapped and swept once to bring it into the cache before the timed sweeps.
+ *
+ *  @param size size of the buffer in bytes
+ *  @return int the ticks the sweeps took, -1 if out of memory
+ */
+static int time_sweeps(int size) {
+    volatile char *buf = (volatile char *)BUF_BASE;
+    unsigned int start;
+    int i, sweep, sum = 0;
+
+    if (new_pages(BUF_BASE, size) < 0) {
+        return -1;
+    }
+    for (i = 0; i < size; i += LINE_SIZE) {
+        buf[i] = (char)i;
+    }
+    start = get_ticks();
+    for (sweep = 0; sweep < SWEEPS; sweep++) {
+        for (i = 0; i < size; i += LINE_SIZE) {
+            sum += buf[i];
+        }
+    }
+    start = get_ticks() - start;
+    remove_pages(BUF_BASE);
+
+    lprintf("color_bench: checksum %d", sum);
+    return (int)start;
+}
+
+int main() {
+    int ticks[NUM_BUF_SIZES];
+    int i;
+
+    if (scramble_memory() < 0) {
+        printf("color_bench: out of memory\n");
+        return -1;
+    }
+
+    for (i = 0; i < NUM_BUF_SIZES; i++) {
+        ticks[i] = time_sweeps(buf_sizes[i]);
+    }
+    unscramble_memory();
+
+    printf("%d sweeps with a stride of %d bytes\n", SWEEPS, LINE_SIZE);
+    printf("buffer KB   ticks\n");
+    for (i = 0; i < NUM_BUF_SIZES; i++) {
+        printf("%9d   %5d\n", buf_sizes[i] / 1024, ticks[i]);
+    }
+    return 0;
+}
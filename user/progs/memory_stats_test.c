@@ -0,0 +1,126 @@
+/** @file memory_stats_test.c
+ *
+ *  @brief Test program for the memory_stats system call
+ *
+ *  Maps some pages with new_pages(), fills them in, frees them again and
+ *  forks, and checks after each step that the counters handed back by
+ *  memory_stats() moved the way they should:
+ *
+ *  - writing to new pages gives each a zeroed frame, so the zero fill
+ *    count and the pages of the task go up by at least that many, and
+ *    so does the number of page tables, since the pages are in a 4 MB
+ *    part of the address space nothing else uses
+ *  - after remove_pages() the page table is freed, and the pages are
+ *    gone from the task
+ *  - after a fork the pages of the child are copy-on-write, and writing
+ *    to one of them is counted as a copy or an upgrade
+ *
+ *  Other tasks may be faulting at the same time, and the system wide
+ *  counters are only checked for growing at least as much as this test
+ *  makes them. Merging and compression move pages between the resident,
+ *  shared and compressed counts, so only their sum is checked.
+ *
+ *  Tests: memory_stats, new_pages, remove_pages, fork
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ *
+ *  @bug None known
+ */
+
+#include <syscall.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <simics.h>
+#include <memory_stats.h>
+#include "410_tests.h"
+#include <report.h>
+
+DEF_TEST_NAME("memory_stats_test:");
+
+#define TEST_BASE ((char *)0x48001000)  /* Alone in its 4 MB, unaligned */
+#define TEST_PAGES 16
+
+/* Pages of the task which have a frame or a compressed copy */
+#define TASK_PAGES(s) ((s)->resident + (s)->shared + (s)->compressed)
+
+static int cow_target = 1;  /* Written by the child after the fork */
+
+/** @brief check the counters of a child right after a fork
+ *
+ *  @return Does not return, exits with 0 if the checks pass
+ */
+static void check_child() {
+    memory_stats_t before, after;
+
+    REPORT_FAILOUT_ON_ERR(memory_stats(&before));
+    if (before.cow == 0) {
+        report_misc("no copy-on-write pages after fork");
+        exit(-1);
+    }
+    cow_target++;
+    REPORT_FAILOUT_ON_ERR(memory_stats(&after));
+    if (after.cow_copies + after.cow_upgrades
+        <= before.cow_copies + before.cow_upgrades) {
+        report_misc("write to a copy-on-write page not counted");
+        exit(-1);
+    }
+    exit(0);
+}
+
+int main() {
+    memory_stats_t start, mapped, freed;
+    int i, pid, status;
+
+    report_start(START_CMPLT);
+
+    if (memory_stats(NULL) >= 0
+        || memory_stats((memory_stats_t *)0x1000) >= 0) {
+        report_misc("kernel address accepted");
+        report_end(END_FAIL);
+        exit(-1);
+    }
+    REPORT_FAILOUT_ON_ERR(memory_stats(&start));
+
+    REPORT_FAILOUT_ON_ERR(new_pages(TEST_BASE, TEST_PAGES * PAGE_SIZE));
+    for (i = 0; i < TEST_PAGES; i++) {
+        /* Different contents, so that no two pages get merged */
+        *(int *)(TEST_BASE + i * PAGE_SIZE) = i + 1;
+    }
+    REPORT_FAILOUT_ON_ERR(memory_stats(&mapped));
+    if (mapped.zero_fills - start.zero_fills < TEST_PAGES
+        || TASK_PAGES(&mapped) - TASK_PAGES(&start) < TEST_PAGES
+        || mapped.page_tables <= start.page_tables) {
+        report_misc("new pages not counted");
+        report_end(END_FAIL);
+        exit(-1);
+    }
+
+    REPORT_FAILOUT_ON_ERR(remove_pages(TEST_BASE));
+    REPORT_FAILOUT_ON_ERR(memory_stats(&freed));
+    if (freed.page_tables_freed <= mapped.page_tables_freed
+        || freed.page_tables >= mapped.page_tables) {
+        report_misc("freed page table not counted");
+        report_end(END_FAIL);
+        exit(-1);
+    }
+    if (TASK_PAGES(&mapped) - TASK_PAGES(&freed) < TEST_PAGES) {
+        report_misc("removed pages still counted for the task");
+        report_end(END_FAIL);
+        exit(-1);
+    }
+
+    pid = fork();
+    REPORT_FAILOUT_ON_ERR(pid);
+    if (pid == 0) {
+        check_child();
+    }
+    if (wait(&status) != pid || status != 0) {
+        report_misc("checks in the child failed");
+        report_end(END_FAIL);
+        exit(-1);
+    }
+
+    report_end(END_SUCCESS);
+    exit(0);
+}
@@ -0,0 +1,154 @@
+/** @file mlfq_test.c
+ *
+ *  @brief Test program for the priorities of the scheduler
+ *
+ *  An interactive thread sleeps for a tick at a time while CPU bound
+ *  tasks spin, and measures how many ticks late it gets to run after
+ *  each sleep. This is done twice:
+ *
+ *  - at the highest priority. The spinning tasks use up their quanta
+ *    and get moved down, while the sleeping thread keeps the highest
+ *    priority and gets ahead of them as soon as it wakes up.
+ *  - moved to the lowest priority with set_priority(). The spinning
+ *    tasks it forks start out there too, and it has to wait for their
+ *    quanta like any of them.
+ *
+ *  The average and largest latency of both runs are printed. No bound
+ *  is put on the latencies themselves, which depend on how fast the
+ *  machine is. The test fails if the thread is not on average less
+ *  late at the highest priority than at the lowest, or if
+ *  set_priority() accepts a priority or a thread which does not exist.
+ *
+ *  Tests: set_priority, sleep, MLFQ demotion
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ *
+ *  @bug None known
+ */
+
+#include <syscall.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <simics.h>
+#include <set_priority.h>
+#include "410_tests.h"
+#include <report.h>
+
+DEF_TEST_NAME("mlfq_test:");
+
+#define NUM_HOGS 3          /* CPU bound tasks */
+#define SAMPLES 200         /* Most sleeps timed per run */
+#define RUN_TICKS 600       /* Ticks the hogs spin for */
+#define HOG_SLACK 20        /* Ticks they spin past the last sample */
+
+/** @brief latencies measured in one run */
+typedef struct latency {
+    int samples;
+    int total;
+    int max;
+} latency_t;
+
+/** @brief spin until a tick, then exit
+ *
+ *  @param until the tick to stop at
+ *  @return Does not return
+ */
+static void hog(unsigned int until) {
+    volatile int spins = 0;
+    while ((int)(get_ticks() - until) < 0) {
+        spins++;
+    }
+    exit(0);
+}
+
+/** @brief time sleeps of one tick while hogs spin
+ *
+ *  Stops short of SAMPLES sleeps if the hogs are about to be done.
+ *
+ *  @param lat where to put the latencies
+ *  @return void
+ */
+static void run(latency_t *lat) {
+    unsigned int until, start;
+    int i, pid, late, status;
+
+    until = get_ticks() + RUN_TICKS;
+    for (i = 0; i < NUM_HOGS; i++) {
+        pid = fork();
+        REPORT_FAILOUT_ON_ERR(pid);
+        if (pid == 0) {
+            hog(until);
+        }
+    }
+
+    lat->samples = 0;
+    lat->total = 0;
+    lat->max = 0;
+    while (lat->samples < SAMPLES
+           && (int)(get_ticks() + HOG_SLACK - until) < 0) {
+        start = get_ticks();
+        sleep(1);
+        late = (int)(get_ticks() - start) - 1;
+        if (late < 0) {
+            late = 0;
+        }
+        lat->samples++;
+        lat->total += late;
+        if (late > lat->max) {
+            lat->max = late;
+        }
+    }
+
+    for (i = 0; i < NUM_HOGS; i++) {
+        wait(&status);
+    }
+}
+
+/** @brief print the latencies of a run
+ *
+ *  @param priority the priority of the sleeping thread
+ *  @param lat the latencies
+ *  @return void
+ */
+static void print_latency(int priority, latency_t *lat) {
+    int hundredths = lat->samples > 0 ? lat->total * 100 / lat->samples : 0;
+
+    report_fmt("priority %d: %d sleeps, %d.%02d ticks late on average, "
+               "%d at most", priority, lat->samples, hundredths / 100,
+               hundredths % 100, lat->max);
+}
+
+int main() {
+    latency_t interactive, demoted;
+    int tid = gettid();
+
+    report_start(START_CMPLT);
+
+    if (set_priority(tid, -1) >= 0 || set_priority(tid, SCHED_LEVELS) >= 0
+        || set_priority(-1, 0) >= 0) {
+        report_misc("set_priority accepted bad arguments");
+        report_end(END_FAIL);
+        exit(-1);
+    }
+
+    REPORT_FAILOUT_ON_ERR(set_priority(tid, 0));
+    run(&interactive);
+    REPORT_FAILOUT_ON_ERR(set_priority(tid, SCHED_LEVELS - 1));
+    run(&demoted);
+    set_priority(tid, 0);
+
+    print_latency(0, &interactive);
+    print_latency(SCHED_LEVELS - 1, &demoted);
+
+    /* Compare the averages without dividing */
+    if (interactive.samples == 0 || demoted.samples == 0
+        || interactive.total * demoted.samples
+           >= demoted.total * interactive.samples) {
+        report_misc("highest priority no better than the lowest");
+        report_end(END_FAIL);
+        exit(-1);
+    }
+    report_end(END_SUCCESS);
+    exit(0);
+}
@@ -0,0 +1,200 @@
+/** @file weight_test.c
+ *
+ *  @brief Test program for the weights of tasks
+ *
+ *  Forks a few CPU bound tasks at the same priority and lets them spin
+ *  over the same stretch of ticks. Each thread counts the rounds of a
+ *  busy loop it gets through, which is proportional to the CPU time it
+ *  got, and each task hands the count of all its threads back as its
+ *  exit status. This is done twice:
+ *
+ *  - with single threaded tasks given different weights with
+ *    set_weight(), which must get CPU in proportion to them
+ *  - with a single threaded task and a task of NUM_THREADS threads at
+ *    the same weight, which must get the same share of the CPU no
+ *    matter how many threads each has
+ *
+ *  The share of the rounds each task got is printed next to the share
+ *  of its weight in the total. The test fails if a share is off by
+ *  more than TOLERANCE percent of what the weight asks for, or if
+ *  set_weight() accepts a weight out of range or a thread which does
+ *  not exist.
+ *
+ *  Tests: set_weight, proportional share between tasks
+ *
+ *  @author Rohit Upadhyaya (rjupadhy)
+ *  @author Prajwal Yadapadithaya (pyadapad)
+ *
+ *  @bug None known
+ */
+
+#include <syscall.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <simics.h>
+#include <thread.h>
+#include <set_weight.h>
+#include "410_tests.h"
+#include <report.h>
+
+DEF_TEST_NAME("weight_test:");
+
+#define START_DELAY 10      /* Ticks for the tasks to get ready */
+#define RUN_TICKS 300       /* Ticks the tasks spin for */
+#define ROUND_SPINS 1000    /* Iterations of the busy loop per round */
+#define TOLERANCE 25        /* Percent a share may be off by */
+#define NUM_THREADS 8       /* Threads of the many threaded task */
+#define MAX_TASKS 3
+
+static unsigned int start_tick, end_tick;
+static int thread_rounds[NUM_THREADS];
+
+static int weighted[] = { SCHED_WEIGHT_DEFAULT, 2 * SCHED_WEIGHT_DEFAULT,
+                          4 * SCHED_WEIGHT_DEFAULT };
+static int weighted_threads[] = { 1, 1, 1 };
+static int threaded[] = { SCHED_WEIGHT_DEFAULT, SCHED_WEIGHT_DEFAULT };
+static int threaded_threads[] = { 1, NUM_THREADS };
+
+/** @brief count rounds of a busy loop from start_tick to end_tick
+ *
+ *  @return int the number of rounds
+ */
+static int count_rounds() {
+    volatile int spins;
+    int rounds = 0, wait_ticks = (int)(start_tick - get_ticks());
+
+    if (wait_ticks > 0) {
+        sleep(wait_ticks);
+    }
+    while ((int)(get_ticks() - end_tick) < 0) {
+        for (spins = 0; spins < ROUND_SPINS; spins++) {
+            continue;
+        }
+        rounds++;
+    }
+    return rounds;
+}
+
+/** @brief count rounds in a thread of the many threaded task
+ *
+ *  @param arg the index of the thread
+ *  @return void * NULL
+ */
+static void *spinner(void *arg) {
+    thread_rounds[(int)arg] = count_rounds();
+    return NULL;
+}
+
+/** @brief count rounds in a task, then exit with the count
+ *
+ *  @param threads the number of threads counting
+ *  @return Does not return
+ */
+static void spin_task(int threads) {
+    int tids[NUM_THREADS];
+    int i, total = 0;
+
+    if (threads == 1) {
+        exit(count_rounds());
+    }
+    REPORT_FAILOUT_ON_ERR(thr_init(16 * PAGE_SIZE));
+    for (i = 1; i < threads; i++) {
+        tids[i] = thr_create(spinner, (void *)i);
+        REPORT_FAILOUT_ON_ERR(tids[i]);
+    }
+    thread_rounds[0] = count_rounds();
+    for (i = 1; i < threads; i++) {
+        thr_join(tids[i], NULL);
+    }
+    for (i = 0; i < threads; i++) {
+        total += thread_rounds[i];
+    }
+    exit(total);
+}
+
+/** @brief let some tasks spin together and check their shares
+ *
+ *  @param num_tasks the number of tasks
+ *  @param weights the weight of each task
+ *  @param threads the number of threads of each task
+ *  @return int 1 if every task got its share, 0 if not
+ */
+static int run(int num_tasks, int *weights, int *threads) {
+    int pids[MAX_TASKS], rounds[MAX_TASKS];
+    int i, j, pid, status, total = 0, total_weight = 0, ok = 1;
+    int shift = 0;
+
+    start_tick = get_ticks() + START_DELAY;
+    end_tick = start_tick + RUN_TICKS;
+    for (i = 0; i < num_tasks; i++) {
+        pid = fork();
+        REPORT_FAILOUT_ON_ERR(pid);
+        if (pid == 0) {
+            spin_task(threads[i]);
+        }
+        /* The first thread of a task has the id of the task */
+        REPORT_FAILOUT_ON_ERR(set_weight(pid, weights[i]));
+        pids[i] = pid;
+        rounds[i] = 0;
+        total_weight += weights[i];
+    }
+
+    for (i = 0; i < num_tasks; i++) {
+        pid = wait(&status);
+        for (j = 0; j < num_tasks; j++) {
+            if (pids[j] == pid) {
+                rounds[j] = status;
+                total += status;
+            }
+        }
+    }
+    if (total <= 0) {
+        report_misc("no rounds counted");
+        return 0;
+    }
+    /* Scale the counts down so that multiplying by 1000 cannot overflow */
+    while ((total >> shift) > 1000000) {
+        shift++;
+    }
+
+    for (i = 0; i < num_tasks; i++) {
+        /* Shares in tenths of a percent */
+        int expected = weights[i] * 1000 / total_weight;
+        int share = (rounds[i] >> shift) * 1000 / (total >> shift);
+        int off = share > expected ? share - expected : expected - share;
+
+        report_fmt("weight %d, %d threads: %d.%d%% expected, got %d.%d%%",
+                   weights[i], threads[i], expected / 10, expected % 10,
+                   share / 10, share % 10);
+        if (off * 100 > expected * TOLERANCE) {
+            ok = 0;
+        }
+    }
+    return ok;
+}
+
+int main() {
+    int tid = gettid();
+
+    report_start(START_CMPLT);
+
+    if (set_weight(tid, 0) >= 0 || set_weight(tid, SCHED_WEIGHT_MAX + 1) >= 0
+        || set_weight(-1, SCHED_WEIGHT_DEFAULT) >= 0) {
+        report_misc("set_weight accepted bad arguments");
+        report_end(END_FAIL);
+        exit(-1);
+    }
+
+    if (!run(3, weighted, weighted_threads)) {
+        report_misc("CPU not shared in proportion to the weights");
+        report_end(END_FAIL);
+        exit(-1);
+    }
+    if (!run(2, threaded, threaded_threads)) {
+        report_misc("CPU shared by thread instead of by task");
+        report_end(END_FAIL);
+        exit(-1);
+    }
+    report_end(END_SUCCESS);
+    exit(0);
+}